@@ -1,6 +1,7 @@
 #pragma once
 #include "MainIncl.h"
 #include "utils/types.h"
+#include "containers.h"
 #include <memory>
 #include <thread>
 
@@ -46,11 +47,13 @@ private:
 	//If your app is multithreaded, the main thread needs to be the one which handles opengl
 	//stuff
 	Window m_Window;
-	std::vector<VertexManager> m_VertexManagers;
+	//The meshes, textures and shaders are kept by SlotHandle, the render loop goes through the packed
+	//elements with a range for, which only sees the live ones
+	SlotMap<VertexManager> m_VertexManagers;
 	std::vector<Entity> m_SceneObjs;
-	std::vector<Texture> m_Textures;
+	SlotMap<Texture> m_Textures;
 	std::vector<CubeMap> m_CubeMaps;
-	std::vector<Shader> m_Shaders;
+	SlotMap<Shader> m_Shaders;
 #ifndef NO_ASSIMP
 	std::vector<Model> m_Models;
 #endif
@@ -0,0 +1,338 @@
+//Standalone benchmark of the string helpers of containers.h against the byte by byte loops they replaced.
+//The names mimic what the model import goes through: short uniform names, bone names with a common
+//prefix and texture paths. HashMap is compared with std::unordered_map on the sizes of a uniform cache,
+//of a skeleton and of a big table, the ring buffer queues with a mutex around a std::deque. Run with --json to get one JSON object per result line, --quick scales the
+//rounds down for smoke runs
+#include "containers.h"
+#include "macros.h"
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static bool g_json_output = false;
+static u32  g_scale       = 1;
+
+//The loops of containers.h before the vector paths, kept out of line so that they are not folded
+//into the benchmark loops
+#if defined(__GNUC__) || defined(__clang__)
+#	define BENCH_NOINLINE __attribute__((noinline))
+#else
+#	define BENCH_NOINLINE __declspec(noinline)
+#endif
+
+BENCH_NOINLINE static u32 scalar_string_length(const char* c_string)
+{
+	u32 size = 0;
+	for(; c_string[size] != 0; size++) {}
+	return size;
+}
+
+BENCH_NOINLINE static bool scalar_string_equals(const char* first, const char* second, u32 size)
+{
+	for(u32 i = 0; i < size; i++) {
+		if(first[i] != second[i])
+			return false;
+	}
+
+	return true;
+}
+
+BENCH_NOINLINE static s32 scalar_find_first_of(const char* string, u32 size, char c)
+{
+	for(s32 i = 0; i < (s32)size; i++) {
+		if(string[i] == c)
+			return i;
+	}
+
+	return -1;
+}
+
+BENCH_NOINLINE static s32 scalar_find_last_of(const char* string, u32 size, char c)
+{
+	for(s32 i = 0; i < (s32)size; i++) {
+		if(string[(size - 1) - i] == c)
+			return (size - 1) - i;
+	}
+
+	return -1;
+}
+
+struct BenchNames
+{
+	const char* label;
+	std::vector<std::string> names;
+	//Same size as names[i] and equal to it except for the last character one time out of four
+	std::vector<std::string> candidates;
+};
+
+static u32 bench_random(u64* state)
+{
+	u64 x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return static_cast<u32>(x >> 32);
+}
+
+static BenchNames bench_make_names(const char* label, const char* prefix, u32 min_suffix, u32 max_suffix)
+{
+	BenchNames names = {};
+	names.label = label;
+	u64 random_state = 0x9E3779B97F4A7C15ull + min_suffix;
+	for(u32 i = 0; i < 4096; i++) {
+		std::string name = prefix;
+		const u32 suffix_size = min_suffix + bench_random(&random_state) % (max_suffix - min_suffix + 1);
+		for(u32 c = 0; c < suffix_size; c++)
+			name += static_cast<char>('a' + bench_random(&random_state) % 26);
+
+		std::string candidate = name;
+		if(i % 4 == 0) candidate.back() = '#';
+
+		names.names.push_back(name);
+		names.candidates.push_back(candidate);
+	}
+
+	return names;
+}
+
+static void bench_report(const char* operation, const char* label, const char* implementation, u64 operations, f64 ns_per_op)
+{
+	if(g_json_output) {
+		log_message("{{\"pattern\":\"{}\",\"names\":\"{}\",\"implementation\":\"{}\",\"operations\":{},\"ns_per_op\":{:.2f}}}\n",
+			operation, label, implementation, operations, ns_per_op);
+	} else {
+		log_message("{:<16} {:<10} {:<8} {:>10} ops {:>9.2f} ns/op\n", operation, label, implementation, operations, ns_per_op);
+	}
+}
+
+//The result is accumulated into a volatile sink, so that the calls can't be skipped
+template<typename Function>
+static void bench_names(const char* operation, const BenchNames& names, const char* implementation, Function function)
+{
+	static volatile u64 sink = 0;
+	const u32 rounds = 2000 / g_scale;
+	u64 result = 0;
+
+	auto begin = std::chrono::steady_clock::now();
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < names.names.size(); i++)
+			result += function(names.names[i], names.candidates[i]);
+	}
+	auto end = std::chrono::steady_clock::now();
+	sink = sink + result;
+
+	const u64 operations = static_cast<u64>(rounds) * names.names.size();
+	const f64 ns_per_op = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / operations;
+	bench_report(operation, names.label, implementation, operations, ns_per_op);
+}
+
+static void bench_run_names(const BenchNames& names, char searched_char)
+{
+	bench_names("length", names, "scalar", [](const std::string& name, const std::string&) {
+		return scalar_string_length(name.c_str());
+	});
+	bench_names("length", names, "simd", [](const std::string& name, const std::string&) {
+		return get_c_string_length_no_null_terminating(name.c_str());
+	});
+
+	bench_names("equals", names, "scalar", [](const std::string& name, const std::string& candidate) {
+		return (u32)scalar_string_equals(name.c_str(), candidate.c_str(), (u32)name.size());
+	});
+	bench_names("equals", names, "simd", [](const std::string& name, const std::string& candidate) {
+		return (u32)string_equals(name.c_str(), candidate.c_str(), (u32)name.size());
+	});
+
+	bench_names("find_first_of", names, "scalar", [searched_char](const std::string& name, const std::string&) {
+		return (u32)scalar_find_first_of(name.c_str(), (u32)name.size(), searched_char);
+	});
+	bench_names("find_first_of", names, "simd", [searched_char](const std::string& name, const std::string&) {
+		return (u32)string_find_first_of(name.c_str(), (u32)name.size(), searched_char);
+	});
+
+	bench_names("find_last_of", names, "scalar", [searched_char](const std::string& name, const std::string&) {
+		return (u32)scalar_find_last_of(name.c_str(), (u32)name.size(), searched_char);
+	});
+	bench_names("find_last_of", names, "simd", [searched_char](const std::string& name, const std::string&) {
+		return (u32)string_find_last_of(name.c_str(), (u32)name.size(), searched_char);
+	});
+}
+
+//Same timing loop as bench_names, the function gets the key index
+template<typename Function>
+static void bench_keys(const char* operation, const char* label, const char* implementation, u32 key_count, u32 rounds, Function function)
+{
+	static volatile u64 sink = 0;
+	u64 result = 0;
+
+	auto begin = std::chrono::steady_clock::now();
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < key_count; i++)
+			result += function(i);
+	}
+	auto end = std::chrono::steady_clock::now();
+	sink = sink + result;
+
+	const u64 operations = static_cast<u64>(rounds) * key_count;
+	const f64 ns_per_op = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / operations;
+	bench_report(operation, label, implementation, operations, ns_per_op);
+}
+
+//The keys are random u64 like the uniform hashes, the misses are keys which were never inserted. The
+//insertions rebuild the map from empty every round, growth included
+static void bench_run_hash_maps(const char* label, u32 key_count)
+{
+	std::vector<u64> keys(key_count), missing_keys(key_count);
+	u64 random_state = 0x9E3779B97F4A7C15ull + key_count;
+	for(u32 i = 0; i < key_count; i++) {
+		keys[i]         = (static_cast<u64>(bench_random(&random_state)) << 32) | bench_random(&random_state);
+		missing_keys[i] = (static_cast<u64>(bench_random(&random_state)) << 32) | bench_random(&random_state);
+	}
+
+	const u32 rounds = (4000000 / key_count) / g_scale + 1;
+
+	HashMap<u64, s32> hash_map;
+	std::unordered_map<u64, s32> std_map;
+	bench_keys("map_insert", label, "std", key_count, rounds, [&](u32 i) {
+		if(i == 0) std_map = {};
+		std_map[keys[i]] = static_cast<s32>(i);
+		return 0u;
+	});
+	bench_keys("map_insert", label, "hash_map", key_count, rounds, [&](u32 i) {
+		if(i == 0) hash_map = HashMap<u64, s32>();
+		hash_map.insert(keys[i], static_cast<s32>(i));
+		return 0u;
+	});
+
+	bench_keys("map_find_hit", label, "std", key_count, rounds, [&](u32 i) {
+		auto it = std_map.find(keys[i]);
+		return it != std_map.end() ? static_cast<u32>(it->second) : 0u;
+	});
+	bench_keys("map_find_hit", label, "hash_map", key_count, rounds, [&](u32 i) {
+		const s32* value = hash_map.find(keys[i]);
+		return value ? static_cast<u32>(*value) : 0u;
+	});
+
+	bench_keys("map_find_miss", label, "std", key_count, rounds, [&](u32 i) {
+		return static_cast<u32>(std_map.find(missing_keys[i]) != std_map.end());
+	});
+	bench_keys("map_find_miss", label, "hash_map", key_count, rounds, [&](u32 i) {
+		return static_cast<u32>(hash_map.contains(missing_keys[i]));
+	});
+}
+
+//The baseline the queues replace, the same interface with a lock taken for every push and pop
+class MutexQueue
+{
+public:
+	explicit MutexQueue(u32 capacity) : queue_capacity(capacity) {}
+
+	u32 try_push_batch(const u64* batch, u32 count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		u32 pushed = 0;
+		for(; pushed < count && values.size() < queue_capacity; pushed++)
+			values.push_back(batch[pushed]);
+
+		return pushed;
+	}
+
+	u32 try_pop_batch(u64* batch, u32 max_count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		u32 popped = 0;
+		for(; popped < max_count && !values.empty(); popped++) {
+			batch[popped] = values.front();
+			values.pop_front();
+		}
+
+		return popped;
+	}
+
+private:
+	std::mutex mutex;
+	std::deque<u64> values;
+	u32 queue_capacity;
+};
+
+//Every producer thread pushes item_count values in batches of batch_size while the main thread pops
+//them, the time goes from the start of the producers to the last pop. The failed pushes and pops yield,
+//so that the numbers still mean something with fewer cores than threads
+template<typename Queue>
+static void bench_queue(const char* label, const char* implementation, u32 producer_count, u32 batch_size)
+{
+	static volatile u64 sink = 0;
+	const u32 item_count = 4000000 / g_scale;
+	Queue queue(1024);
+
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<std::thread> producers;
+	for(u32 p = 0; p < producer_count; p++) {
+		producers.emplace_back([&queue, batch_size, item_count]() {
+			u64 batch[64];
+			for(u32 next = 0; next < item_count;) {
+				u32 count = 0;
+				for(; count < batch_size && next + count < item_count; count++) batch[count] = next + count;
+
+				const u32 pushed = queue.try_push_batch(batch, count);
+				if(!pushed) std::this_thread::yield();
+				next += pushed;
+			}
+		});
+	}
+
+	u64 result = 0, batch[64];
+	for(u64 received = 0; received < static_cast<u64>(producer_count) * item_count;) {
+		const u32 popped = queue.try_pop_batch(batch, batch_size);
+		if(!popped) std::this_thread::yield();
+		for(u32 i = 0; i < popped; i++) result += batch[i];
+		received += popped;
+	}
+	for(auto& producer : producers) producer.join();
+	auto end = std::chrono::steady_clock::now();
+	sink = sink + result;
+
+	const u64 operations = static_cast<u64>(producer_count) * item_count;
+	const f64 ns_per_op = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / operations;
+	bench_report("queue_transfer", label, implementation, operations, ns_per_op);
+}
+
+static void bench_run_queues()
+{
+	bench_queue<MutexQueue>("spsc", "mutex", 1, 1);
+	bench_queue<SpscQueue<u64>>("spsc", "ring", 1, 1);
+	bench_queue<MutexQueue>("spsc_b32", "mutex", 1, 32);
+	bench_queue<SpscQueue<u64>>("spsc_b32", "ring", 1, 32);
+
+	const u32 producer_count = 4;
+	bench_queue<MutexQueue>("mpsc", "mutex", producer_count, 1);
+	bench_queue<MpscQueue<u64>>("mpsc", "ring", producer_count, 1);
+	bench_queue<MutexQueue>("mpsc_b32", "mutex", producer_count, 32);
+	bench_queue<MpscQueue<u64>>("mpsc_b32", "ring", producer_count, 32);
+}
+
+int main(int argc, char** argv)
+{
+	for(s32 i = 1; i < argc; i++) {
+		if(std::strcmp(argv[i], "--json") == 0)  g_json_output = true;
+		if(std::strcmp(argv[i], "--quick") == 0) g_scale = 16;
+	}
+
+	//The searched characters are the ones the import looks for: the separator of the bone names and the
+	//last slash of the texture paths
+	bench_run_names(bench_make_names("uniforms", "u_", 4, 14), ':');
+	bench_run_names(bench_make_names("bones", "mixamorig:", 6, 18), ':');
+	bench_run_names(bench_make_names("paths", "assets/models/character/textures/", 8, 40), '/');
+
+	bench_run_hash_maps("uniforms", 48);
+	bench_run_hash_maps("skeleton", 1024);
+	bench_run_hash_maps("large", 1 << 20);
+
+	bench_run_queues();
+	return 0;
+}
@@ -0,0 +1,394 @@
+//Standalone benchmark of the engine allocator against malloc, it only links the memory module so it
+//runs without a window or a GL context. Run with --json to get one JSON object per result line,
+//--quick scales every pattern down for smoke runs
+#include "memory.h"
+#include "macros.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <vector>
+
+extern gfx::Allocator* g_engine_allocator;
+
+enum BenchBackend : u8
+{
+	BENCH_BACKEND_GFX,
+	BENCH_BACKEND_MALLOC,
+	BENCH_BACKEND_COUNT,
+};
+
+struct BenchResult
+{
+	const char* pattern;
+	BenchBackend backend;
+	u64 operations;
+	f64 ns_per_op;
+	f64 p50_ns;
+	f64 p99_ns;
+	u64 peak_bytes;
+};
+
+struct BenchContext
+{
+	BenchBackend backend;
+	//Every single operation is timed, so the latencies also include the cost of reading the clock
+	std::vector<u32> latencies;
+	//Sampled while running, the engine allocator keeps track of its own peak in the tag stats
+	u64 sampled_peak_bytes;
+	u64 random_state;
+};
+
+static bool g_json_output = false;
+static u32  g_scale       = 1;
+
+static u32 bench_random(BenchContext* context)
+{
+	u64 x = context->random_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	context->random_state = x;
+	return static_cast<u32>(x >> 32);
+}
+
+//Sizes spread evenly over the powers of two between 16 bytes and max_size
+static u32 bench_random_size(BenchContext* context, u32 max_size)
+{
+	const u32 max_shift = std::bit_width(max_size) - 1;
+	const u32 shift     = 4 + bench_random(context) % (max_shift - 3);
+	const u32 base      = 1u << shift;
+	return base + bench_random(context) % base;
+}
+
+static u64 bench_malloc_footprint()
+{
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+//mallinfo2 is too slow to be called after every operation, it is out of the timed sections anyway
+static void bench_sample_malloc_peak(BenchContext* context)
+{
+	if(context->backend == BENCH_BACKEND_MALLOC && (context->latencies.size() & 63) == 0)
+		context->sampled_peak_bytes = std::max(context->sampled_peak_bytes, bench_malloc_footprint());
+}
+
+static void* bench_allocate(BenchContext* context, u32 bytes)
+{
+	auto begin = std::chrono::steady_clock::now();
+	void* ptr = context->backend == BENCH_BACKEND_GFX ? gfx::mem_allocate(bytes) : std::malloc(bytes);
+	auto end = std::chrono::steady_clock::now();
+	context->latencies.push_back(static_cast<u32>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+
+	//Touch the block so that both backends pay for the page faults
+	static_cast<u8*>(ptr)[0] = 1;
+	bench_sample_malloc_peak(context);
+	return ptr;
+}
+
+static void bench_free(BenchContext* context, void* ptr)
+{
+	auto begin = std::chrono::steady_clock::now();
+	if(context->backend == BENCH_BACKEND_GFX) gfx::mem_free(ptr);
+	else                                      std::free(ptr);
+	auto end = std::chrono::steady_clock::now();
+	context->latencies.push_back(static_cast<u32>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+}
+
+static void bench_lifo(BenchContext* context)
+{
+	const u32 block_count = 4096 / g_scale, rounds = 64 / g_scale;
+	std::vector<void*> blocks(block_count);
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < block_count; i++)
+			blocks[i] = bench_allocate(context, 64);
+		for(u32 i = block_count; i > 0; i--)
+			bench_free(context, blocks[i - 1]);
+	}
+}
+
+static void bench_random_free(BenchContext* context)
+{
+	const u32 block_count = 4096 / g_scale, rounds = 64 / g_scale;
+	std::vector<void*> blocks(block_count);
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < block_count; i++)
+			blocks[i] = bench_allocate(context, 256);
+
+		for(u32 i = block_count - 1; i > 0; i--)
+			std::swap(blocks[i], blocks[bench_random(context) % (i + 1)]);
+
+		for(u32 i = 0; i < block_count; i++)
+			bench_free(context, blocks[i]);
+	}
+}
+
+static void bench_mixed_sizes(BenchContext* context)
+{
+	const u32 block_count = 2048 / g_scale, rounds = 32 / g_scale;
+	std::vector<void*> blocks(block_count);
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < block_count; i++)
+			blocks[i] = bench_allocate(context, bench_random_size(context, 64 * 1024));
+		for(u32 i = 0; i < block_count; i++)
+			bench_free(context, blocks[i]);
+	}
+}
+
+//Long running churn over a live set of random sizes, the free space ends up split in many holes
+static void bench_fragmentation(BenchContext* context)
+{
+	const u32 live_count = 8192 / g_scale, steps = 400000 / g_scale;
+	std::vector<void*> blocks(live_count);
+	for(u32 i = 0; i < live_count; i++)
+		blocks[i] = bench_allocate(context, bench_random_size(context, 16 * 1024));
+
+	for(u32 step = 0; step < steps; step++) {
+		const u32 index = bench_random(context) % live_count;
+		bench_free(context, blocks[index]);
+		blocks[index] = bench_allocate(context, bench_random_size(context, 16 * 1024));
+	}
+
+	for(u32 i = 0; i < live_count; i++)
+		bench_free(context, blocks[i]);
+}
+
+static void bench_temporary_stack(BenchContext* context)
+{
+	const u32 depth = 64, rounds = 20000 / g_scale;
+	void* blocks[depth];
+	for(u32 round = 0; round < rounds; round++) {
+		for(u32 i = 0; i < depth; i++) {
+			const u32 bytes = 32 + (bench_random(context) & 1023);
+			auto begin = std::chrono::steady_clock::now();
+			blocks[i] = context->backend == BENCH_BACKEND_GFX ? gfx::temporary_allocate(bytes) : std::malloc(bytes);
+			auto end = std::chrono::steady_clock::now();
+			context->latencies.push_back(static_cast<u32>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+
+			if(context->backend == BENCH_BACKEND_GFX)
+				context->sampled_peak_bytes = std::max(context->sampled_peak_bytes, gfx::temporary_get_marker().used);
+			else
+				bench_sample_malloc_peak(context);
+		}
+
+		for(u32 i = depth; i > 0; i--) {
+			auto begin = std::chrono::steady_clock::now();
+			if(context->backend == BENCH_BACKEND_GFX) gfx::temporary_free(blocks[i - 1]);
+			else                                      std::free(blocks[i - 1]);
+			auto end = std::chrono::steady_clock::now();
+			context->latencies.push_back(static_cast<u32>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+		}
+	}
+}
+
+static void bench_report(const BenchResult& result)
+{
+	const char* backend_name = result.backend == BENCH_BACKEND_GFX ? "gfx" : "malloc";
+	if(g_json_output) {
+		log_message("{{\"pattern\":\"{}\",\"backend\":\"{}\",\"operations\":{},\"ns_per_op\":{:.2f},\"p50_ns\":{:.1f},\"p99_ns\":{:.1f},\"peak_bytes\":{}}}\n",
+			result.pattern, backend_name, result.operations, result.ns_per_op, result.p50_ns, result.p99_ns, result.peak_bytes);
+	} else {
+		log_message("{:<16} {:<8} {:>10} ops {:>9.2f} ns/op  p50 {:>7.1f} ns  p99 {:>8.1f} ns  peak {:>12} bytes\n",
+			result.pattern, backend_name, result.operations, result.ns_per_op, result.p50_ns, result.p99_ns, result.peak_bytes);
+	}
+}
+
+//ns_per_op is the mean of the timed operations, the bookkeeping of the benchmark itself is left out
+static BenchResult bench_results_from_latencies(const char* pattern, BenchBackend backend, std::vector<u32>& latencies, u64 peak_bytes)
+{
+	BenchResult result = {};
+	result.pattern    = pattern;
+	result.backend    = backend;
+	result.operations = latencies.size();
+	result.peak_bytes = peak_bytes;
+
+	if(!latencies.empty()) {
+		u64 total_ns = 0;
+		for(u32 latency : latencies)
+			total_ns += latency;
+
+		result.ns_per_op = (f64)total_ns / (f64)latencies.size();
+		std::sort(latencies.begin(), latencies.end());
+		result.p50_ns = latencies[latencies.size() / 2];
+		result.p99_ns = latencies[(latencies.size() * 99) / 100];
+	}
+
+	return result;
+}
+
+//Each pattern runs on a fresh allocator, so that the peak bytes only account for that pattern
+static void bench_run(const char* pattern, void(*function)(BenchContext*))
+{
+	for(u32 backend = 0; backend < BENCH_BACKEND_COUNT; backend++) {
+		gfx::Allocator allocator = gfx::allocator_create(4ull * 1024 * 1024 * 1024, 64 * 1024 * 1024);
+		if(backend == BENCH_BACKEND_GFX)
+			g_engine_allocator = &allocator;
+
+		BenchContext context = {};
+		context.backend      = static_cast<BenchBackend>(backend);
+		context.random_state = 0x9E3779B97F4A7C15ull;
+		context.latencies.reserve(1 << 22);
+		const u64 malloc_footprint_before = bench_malloc_footprint();
+
+		function(&context);
+
+		u64 peak_bytes = 0;
+		if(backend == BENCH_BACKEND_GFX) {
+			auto report = gfx::allocator_get_report(&allocator);
+			peak_bytes = std::max(report.tags[gfx::MEMORY_TAG_UNTAGGED].peak_bytes, context.sampled_peak_bytes);
+		} else {
+			peak_bytes = context.sampled_peak_bytes > malloc_footprint_before ? context.sampled_peak_bytes - malloc_footprint_before : 0;
+		}
+
+		g_engine_allocator = nullptr;
+		gfx::allocator_cleanup(&allocator);
+
+		bench_report(bench_results_from_latencies(pattern, context.backend, context.latencies, peak_bytes));
+	}
+}
+
+//Every thread churns small blocks, the latencies of all the threads are merged in the end
+static void bench_run_multithreaded()
+{
+	const u32 thread_count = std::max(2u, std::thread::hardware_concurrency());
+	const u32 operations_per_thread = 200000 / g_scale;
+
+	for(u32 backend = 0; backend < BENCH_BACKEND_COUNT; backend++) {
+		gfx::Allocator allocator = gfx::allocator_create(4ull * 1024 * 1024 * 1024, 64 * 1024 * 1024);
+		if(backend == BENCH_BACKEND_GFX)
+			g_engine_allocator = &allocator;
+
+		std::vector<BenchContext> contexts(thread_count);
+		std::vector<std::thread> threads;
+		const u64 malloc_footprint_before = bench_malloc_footprint();
+		for(u32 t = 0; t < thread_count; t++) {
+			threads.emplace_back([&, t]() {
+				auto& context        = contexts[t];
+				context.backend      = static_cast<BenchBackend>(backend);
+				context.random_state = 0x9E3779B97F4A7C15ull + t;
+				context.latencies.reserve(operations_per_thread * 2);
+
+				const u32 live_count = 256;
+				void* blocks[live_count];
+				for(u32 i = 0; i < live_count; i++)
+					blocks[i] = bench_allocate(&context, 16 + bench_random(&context) % 1024);
+
+				for(u32 i = 0; i < operations_per_thread; i++) {
+					const u32 index = bench_random(&context) % live_count;
+					bench_free(&context, blocks[index]);
+					blocks[index] = bench_allocate(&context, 16 + bench_random(&context) % 1024);
+				}
+
+				for(u32 i = 0; i < live_count; i++)
+					bench_free(&context, blocks[i]);
+
+				if(context.backend == BENCH_BACKEND_GFX)
+					gfx::allocator_flush_thread_cache();
+			});
+		}
+
+		for(auto& thread : threads)
+			thread.join();
+
+		std::vector<u32> latencies;
+		u64 peak_bytes = 0;
+		for(auto& context : contexts) {
+			latencies.insert(latencies.end(), context.latencies.begin(), context.latencies.end());
+			peak_bytes = std::max(peak_bytes, context.sampled_peak_bytes);
+		}
+
+		if(backend == BENCH_BACKEND_GFX)
+			peak_bytes = gfx::allocator_get_report(&allocator).tags[gfx::MEMORY_TAG_UNTAGGED].peak_bytes;
+		else
+			peak_bytes = peak_bytes > malloc_footprint_before ? peak_bytes - malloc_footprint_before : 0;
+
+		g_engine_allocator = nullptr;
+		gfx::allocator_cleanup(&allocator);
+
+		bench_report(bench_results_from_latencies("multithreaded", static_cast<BenchBackend>(backend), latencies, peak_bytes));
+	}
+}
+
+//Segments are inserted and looked up in random order, then one every four gets removed and the
+//holes are searched with sizes that only fit where neighbouring segments were removed together
+template<typename Index>
+static void bench_segment_index(const char* index_name, u32 segment_count)
+{
+	constexpr u64 segment_stride = 64, segment_size = 48;
+	BenchContext context = {};
+	context.random_state = 0x9E3779B97F4A7C15ull + segment_count;
+
+	std::vector<u64> starts(segment_count);
+	for(u32 i = 0; i < segment_count; i++)
+		starts[i] = i * segment_stride;
+	for(u32 i = segment_count - 1; i > 0; i--)
+		std::swap(starts[i], starts[bench_random(&context) % (i + 1)]);
+
+	Index index;
+	auto begin = std::chrono::steady_clock::now();
+	for(u32 i = 0; i < segment_count; i++)
+		index.add_node(starts[i], segment_size);
+	auto end = std::chrono::steady_clock::now();
+	const f64 insert_ns = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / segment_count;
+
+	for(u32 i = segment_count - 1; i > 0; i--)
+		std::swap(starts[i], starts[bench_random(&context) % (i + 1)]);
+
+	u64 found = 0;
+	begin = std::chrono::steady_clock::now();
+	for(u32 i = 0; i < segment_count; i++)
+		found += index.find_node(starts[i]) != nullptr;
+	end = std::chrono::steady_clock::now();
+	const f64 lookup_ns = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / segment_count;
+	assert(found == segment_count, "the index lost some segments");
+
+	for(u32 i = 0; i < segment_count / 4; i++)
+		index.remove_node(starts[i]);
+
+	const u32 fit_count = std::min(segment_count, 100000u);
+	u64 hole_start = 0;
+	begin = std::chrono::steady_clock::now();
+	for(u32 i = 0; i < fit_count; i++)
+		found += index.find_first_fit(segment_stride + 16 + bench_random(&context) % (segment_stride * 2), &hole_start);
+	end = std::chrono::steady_clock::now();
+	const f64 first_fit_ns = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / fit_count;
+
+	if(g_json_output) {
+		log_message("{{\"pattern\":\"segment_index\",\"index\":\"{}\",\"segments\":{},\"insert_ns\":{:.2f},\"lookup_ns\":{:.2f},\"first_fit_ns\":{:.2f}}}\n",
+			index_name, segment_count, insert_ns, lookup_ns, first_fit_ns);
+	} else {
+		log_message("{:<16} {:<8} {:>10} segs {:>8.2f} ns insert  {:>8.2f} ns lookup  {:>8.2f} ns first fit\n",
+			"segment_index", index_name, segment_count, insert_ns, lookup_ns, first_fit_ns);
+	}
+}
+
+static void bench_run_segment_index()
+{
+	const u32 max_segment_count = 1000000 / g_scale;
+	for(u32 segment_count = 1000; segment_count <= max_segment_count; segment_count *= 10) {
+		bench_segment_index<gfx::SegmentTree>("rbtree", segment_count);
+		bench_segment_index<gfx::SegmentBTree>("btree", segment_count);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	for(s32 i = 1; i < argc; i++) {
+		if(std::strcmp(argv[i], "--json") == 0)  g_json_output = true;
+		if(std::strcmp(argv[i], "--quick") == 0) g_scale = 16;
+	}
+
+	bench_run("lifo", bench_lifo);
+	bench_run("random_free", bench_random_free);
+	bench_run("mixed_sizes", bench_mixed_sizes);
+	bench_run("fragmentation", bench_fragmentation);
+	bench_run("temporary_stack", bench_temporary_stack);
+	bench_run_multithreaded();
+	bench_run_segment_index();
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include "Entity.h"
+#include "memory.h"
 #include <cstring>
 
 namespace gfx
@@ -76,6 +77,7 @@ namespace gfx
 
 		u32 instancebuffer;
 		glGenBuffers(1, &instancebuffer);
+		gfx::frame_audit_record_gl_buffers(1);
 
 		glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
 		glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(glm::vec3), positions, GL_STATIC_DRAW);
@@ -4,11 +4,13 @@
 #include "memory.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <cstdio>
 
 namespace gfx
 {
 	ModelData model_create(const String& filepath, bool load_textures)
 	{
+		MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
 		ModelData model_data = {};
 
 		Assimp::Importer importer;
@@ -33,7 +35,8 @@ namespace gfx
 		model_get_vertices_indices_bones_count(scene, &vertices_count, &indices_count, &bones_count);
 		model_data.bone_count = bones_count;
 
-		f32* vertices                 = temporary_allocate<f32>(vertices_count * vertex_stride);
+		//Cache line aligned, so that the vertices can be processed with aligned SIMD loads and stores
+		f32* vertices                 = temporary_allocate_aligned<f32>(vertices_count * vertex_stride, cache_line_size);
 		VertexWeight* vertices_weight = temporary_allocate<VertexWeight>(vertices_count);
 		u32* indices                  = temporary_allocate<u32>(indices_count);
 
@@ -45,15 +48,19 @@ namespace gfx
 
 		std::memset(vertices_weight, 0, vertices_count * sizeof(VertexWeight));
 
-		model_data.vertex_divisors = mem_allocate<u32>(scene->mNumMeshes);
-		model_data.index_divisors  = mem_allocate<u32>(scene->mNumMeshes);
+		//Both divisor arrays share the same block, index_divisors is never freed on its own
+		model_data.vertex_divisors = mem_allocate<u32>(scene->mNumMeshes * 2);
+		model_data.index_divisors  = model_data.vertex_divisors + scene->mNumMeshes;
 
 		u32 vertices_parsed_so_far = 0;
 		u32 indices_parsed_so_far  = 0;
 		u32 bones_incremental_idx  = 0;
 
 		auto& bone_transformations = model_data.bone_transformations;
-		bone_transformations = mem_allocate<BoneInfo>(bones_count);
+		bone_transformations = mem_allocate_aligned<BoneInfo>(bones_count, cache_line_size);
+		//The bones without a name keep null_atom, which no lookup matches
+		for(u32 i = 0; i < bones_count; i++)
+			new (&bone_transformations[i]) BoneInfo{};
 		model_map_bone_names_to_id(scene, bone_transformations, bones_count);
 
 		for (u32 i = 0; i < model_data.mesh_count; i++) {
@@ -106,8 +113,26 @@ namespace gfx
 		}
 		model_data.mesh_data.indices_count = indices_count;
 
+		//The channel names are interned here, the nodes are only looked up so that the names of the nodes
+		//which are neither bones nor animated don't end up in the atom table
+		{
+			const aiAnimation* animation = scene->mNumAnimations > 0 ? scene->mAnimations[0] : nullptr;
+			const u32 channel_count = animation ? animation->mNumChannels : 0;
+			Atom* channel_names = temporary_allocate<Atom>(channel_count);
+			defer { if(channel_names) temporary_free(channel_names); };
+			for(u32 i = 0; i < channel_count; i++) {
+				const aiString& channel_name = animation->mChannels[i]->mNodeName;
+				channel_names[i] = atom_intern(channel_name.data, channel_name.length);
+			}
+
+			model_data.node_count = model_count_nodes(scene->mRootNode);
+			model_data.node_info  = mem_allocate<ModelNodeInfo>(model_data.node_count);
+			u32 node_index = 0;
+			model_map_nodes(scene->mRootNode, bone_transformations, bones_count, channel_names, channel_count, model_data.node_info, &node_index);
+		}
+
 		//Parsing bone matrices
-		model_parse_bone_transformations(scene, scene->mRootNode, 135.0f, bone_transformations, bones_count, model_data.world_transformation);
+		model_parse_bone_transformations(model_data, 135.0f);
 
 		//Position, normals, texcoords
 		LayoutElement attributes[3] = {
@@ -125,18 +150,19 @@ namespace gfx
 		model_data.mesh_data = create_mesh_with_indices_and_push_attributes(vertices, vertices_count * vertex_stride * sizeof(f32), indices, indices_count * sizeof(u32), attributes, sizeof(attributes));
 
 		glGenBuffers(1, &model_data.vertex_weight_buffer);
+		frame_audit_record_gl_buffers(1);
 		glBindBuffer(GL_ARRAY_BUFFER, model_data.vertex_weight_buffer);
 		glBufferData(GL_ARRAY_BUFFER, vertices_count * sizeof(VertexWeight), vertices_weight, GL_STATIC_DRAW);
 
 		push_mesh_attributes(&model_data.mesh_data, weight_attributes, sizeof(weight_attributes), 3);
 		//Default texture loading might not work depending on where the textures are stored
 		if(load_textures) {
-			model_data.textures      = mem_allocate<TextureData>(scene->mNumMeshes);
-			model_data.texture_info  = mem_allocate<ModelTextureInfo>(scene->mNumMeshes);
-			model_data.texture_count = scene->mNumMeshes;
+			MemoryTagScope texture_tag_scope(MEMORY_TAG_TEXTURE);
+			model_data.texture_info  = mem_allocate_zeroed<ModelTextureInfo>(scene->mNumMeshes);
 
 			auto& texture_info = model_data.texture_info;
-			String current_working_dir;
+			//The textures are next to the model, the directory is only viewed and copied once for each texture
+			StringView current_working_dir;
 
 			{
 				s32 backslash = filepath.find_last_of('\\');
@@ -144,17 +170,13 @@ namespace gfx
 
 				assert(backslash != -1 || forwardslash != -1, "invalid path syntax");
 
-				if (backslash != -1) {
-				    current_working_dir = filepath.substr(0, backslash);
-				}
-
-				if (forwardslash != -1) {
-				    current_working_dir = filepath.substr(0, forwardslash);
-				}
+				const s32 last_separator = backslash > forwardslash ? backslash : forwardslash;
+				current_working_dir = StringView(filepath).substr(0, last_separator);
 			}
 
-			current_working_dir += "/";
-
+			//Texture atom to the handle of the texture loaded for it
+			HashMap<Atom, SlotHandle<TextureData>> loaded_textures;
+			loaded_textures.reserve(scene->mNumMeshes);
 			for(u32 i = 0; i < scene->mNumMeshes; i++) {
 				const aiMesh* mesh = scene->mMeshes[i];
 			    const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -163,22 +185,17 @@ namespace gfx
 			        aiString path;
 
 					if(material->GetTexture(aiTextureType_DIFFUSE, 0, &path, 0, 0, 0, 0, 0) == AI_SUCCESS) {
-						texture_info[i].name = path.data;
-						bool texture_already_loaded = false;
-
-						for(u32 j = 0; j < i; j++) {
-							if(texture_info[j].name == texture_info[i].name) {
-								texture_info[i].index = j;
-								texture_already_loaded = true;
-								break;
-							}
+						texture_info[i].name = atom_intern(path.data, path.length);
+						if(const SlotHandle<TextureData>* loaded_texture = loaded_textures.find(texture_info[i].name)) {
+							texture_info[i].texture = *loaded_texture;
+							continue;
 						}
 
-			        	if(texture_already_loaded) continue;
-
-			            String loading_path = current_working_dir + path.C_Str();
-						texture_info[i].index = i;
-			            model_data.textures[i] = texture_create(loading_path.c_str());
+			            String loading_path = current_working_dir;
+			            loading_path += '/';
+			            loading_path.append(path.data, path.length);
+						texture_info[i].texture = model_data.textures.insert(texture_create(loading_path.c_str()));
+						loaded_textures.insert(texture_info[i].name, texture_info[i].texture);
 			        }
 			    }
 			}
@@ -199,38 +216,31 @@ namespace gfx
 	void model_load_textures(ModelData& model_data, String* texture_paths, u32 texture_count)
 	{
 		assert(texture_paths, "the variable needs to be defined in this scope\n");
+		MemoryTagScope tag_scope(MEMORY_TAG_TEXTURE);
 		auto& texture_info = model_data.texture_info;
 		const auto& scene  = model_data.scene;
 
-		if(model_data.textures || model_data.texture_info) {
-			for(u32 i = 0; i < model_data.texture_count; i++)
-				texture_cleanup(&model_data.textures[i]);
+		for(TextureData& texture : model_data.textures)
+			texture_cleanup(&texture);
 
-			mem_free(model_data.textures);
-			mem_free(model_data.texture_info);
-		}
-		model_data.textures     = mem_allocate<TextureData>(scene->mNumMeshes);
-		model_data.texture_info = mem_allocate<ModelTextureInfo>(scene->mNumMeshes);
+		model_data.textures.clear();
+		mem_free(model_data.texture_info);
+		model_data.texture_info = mem_allocate_zeroed<ModelTextureInfo>(scene->mNumMeshes);
 
+		HashMap<Atom, SlotHandle<TextureData>> loaded_textures;
+		loaded_textures.reserve(texture_count);
 		for(u32 i = 0; i < texture_count; i++) {
 			const aiMesh* mesh = scene->mMeshes[i];
 			const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
-		    texture_info[i].name = texture_paths[i];
-		    bool texture_already_loaded = false;
-
-			for(u32 j = 0; j < i; j++) {
-				if(texture_info[j].name == texture_info[i].name) {
-					texture_info[i].index = j;
-					texture_already_loaded = true;
-					break;
-				}
+		    texture_info[i].name = atom_intern(texture_paths[i].c_str(), texture_paths[i].size());
+			if(const SlotHandle<TextureData>* loaded_texture = loaded_textures.find(texture_info[i].name)) {
+				texture_info[i].texture = *loaded_texture;
+				continue;
 			}
 
-		    if(texture_already_loaded) continue;
-
-			texture_info[i].index = i;
-		    model_data.textures[i] = texture_create(texture_paths[i].c_str());
+			texture_info[i].texture = model_data.textures.insert(texture_create(texture_paths[i].c_str()));
+			loaded_textures.insert(texture_info[i].name, texture_info[i].texture);
 		}
 	}
 
@@ -242,10 +252,10 @@ namespace gfx
 
 		u32 indices_drawn = 0;
 		for(u32 i = 0; i < model.mesh_count; i++) {
-			if(model.textures) {
-				auto& diffuse_texture = model.textures[model.texture_info[i].index];
-				texture_bind(diffuse_texture, 0);
-			}
+			//A stale or null handle is skipped, the mesh keeps the texture bound before it
+			const TextureData* diffuse_texture = model.texture_info ? model.textures.get(model.texture_info[i].texture) : nullptr;
+			if(diffuse_texture)
+				texture_bind(*diffuse_texture, 0);
 
 			shader.Uniform1i(0, diffuse_uniform);
 			glDrawElementsBaseVertex(GL_TRIANGLES, model.index_divisors[i], GL_UNSIGNED_INT,
@@ -291,16 +301,19 @@ namespace gfx
 
 	void model_map_bone_names_to_id(const aiScene* scene, BoneInfo* bone_info, u32 bones_count)
 	{
+		//The meshes share most of their bones, the names already mapped are looked up in the table
+		HashMap<Atom, u32> mapped_bones;
+		mapped_bones.reserve(bones_count);
 		u32 unique_bone_index = 0;
 		for(u32 i = 0; i < scene->mNumMeshes; i++) {
 			for(u32 j = 0; j < scene->mMeshes[i]->mNumBones; j++) {
 				auto& bone = scene->mMeshes[i]->mBones[j];
-				String bone_name = bone->mName.C_Str();
+				const Atom bone_name = atom_intern(bone->mName.data, bone->mName.length);
 
-				s32 bone_index = model_find_bone_info(bone_info, bones_count, bone_name);
-				if(bone_index == -1) {
+				if(!mapped_bones.contains(bone_name)) {
+					mapped_bones.insert(bone_name, unique_bone_index);
 					auto& transformation = bone_info[unique_bone_index];
-					transformation.name  = bone_name.c_str();
+					transformation.name  = bone_name;
 					transformation.id    = unique_bone_index;
 					transformation.local_transformation = glm_mat_cast(bone->mOffsetMatrix);
 
@@ -310,8 +323,11 @@ namespace gfx
 		}
 	}
 
-	s32 model_find_bone_info(const BoneInfo* data, u32 size, String& name)
+	s32 model_find_bone_info(const BoneInfo* data, u32 size, Atom name)
 	{
+		if(name == null_atom)
+			return -1;
+
 		for(u32 i = 0; i < size; i++) {
 			if(data[i].name == name)
 				return i;
@@ -320,16 +336,43 @@ namespace gfx
 		return -1;
 	}
 
-	aiNodeAnim* model_find_animation_channel(const aiAnimation* anim, const String& name)
+	s32 model_find_animation_channel(const Atom* channel_names, u32 channel_count, Atom name)
 	{
-		for(u32 i = 0; i < anim->mNumChannels; i++) {
-			aiNodeAnim* ptr = anim->mChannels[i];
-			if(std::strcmp(ptr->mNodeName.C_Str(), name.c_str()) == 0) {
-				return ptr;
-			}
+		if(name == null_atom)
+			return -1;
+
+		for(u32 i = 0; i < channel_count; i++) {
+			if(channel_names[i] == name)
+				return i;
 		}
 
-		return nullptr;
+		return -1;
+	}
+
+	u32 model_count_nodes(const aiNode* node)
+	{
+		if(!node) return 0;
+
+		u32 count = 1;
+		for(u32 i = 0; i < node->mNumChildren; i++)
+			count += model_count_nodes(node->mChildren[i]);
+
+		return count;
+	}
+
+	//Same depth first order of model_parse_bone_transformations
+	void model_map_nodes(const aiNode* node, const BoneInfo* bone_info, u32 bone_count, const Atom* channel_names, u32 channel_count,
+		ModelNodeInfo* node_info, u32* node_index)
+	{
+		if(!node) return;
+
+		const Atom node_name = atom_find(node->mName.data, node->mName.length);
+		auto& info = node_info[(*node_index)++];
+		info.bone_index    = model_find_bone_info(bone_info, bone_count, node_name);
+		info.channel_index = model_find_animation_channel(channel_names, channel_count, node_name);
+
+		for(u32 i = 0; i < node->mNumChildren; i++)
+			model_map_nodes(node->mChildren[i], bone_info, bone_count, channel_names, channel_count, node_info, node_index);
 	}
 
 	glm::vec3 model_lerp_keyframes_positions(const aiNodeAnim* node_anim, f32 ticks)
@@ -419,16 +462,17 @@ namespace gfx
 
 	void model_parse_bone_transformations(ModelData& model_data, f32 ticks)
 	{
-		model_parse_bone_transformations(model_data.scene, model_data.scene->mRootNode, ticks, model_data.bone_transformations, model_data.bone_count, model_data.world_transformation);
+		u32 node_index = 0;
+		model_parse_bone_transformations(model_data.scene, model_data.scene->mRootNode, model_data.node_info, &node_index, ticks, model_data.bone_transformations, model_data.world_transformation);
 	}
 
-	void model_parse_bone_transformations(const aiScene* scene, const aiNode* node, f32 ticks, BoneInfo* bone_info, u32 bone_info_count, glm::mat4& world_transformation, const glm::mat4& parent_transform)
+	void model_parse_bone_transformations(const aiScene* scene, const aiNode* node, const ModelNodeInfo* node_info, u32* node_index, f32 ticks, BoneInfo* bone_info, glm::mat4& world_transformation, const glm::mat4& parent_transform)
 	{
 		if(!node) return;
 		glm::mat4 current_transformation;
 
 		bool animation_file_loaded = (scene->mNumAnimations > 0);
-		String bone_name = node->mName.C_Str();
+		const ModelNodeInfo& info = node_info[(*node_index)++];
 
 		//INFO(C7) apparently the mTransform of the root node stores information about the
 		//physical rototranslation of the model in the environment, so the matrix is not used
@@ -439,7 +483,7 @@ namespace gfx
 			if(animation_file_loaded && ticks != 0.0f) {
 				//Default animation atm, should take this in as a parameter
 				aiAnimation* animation = scene->mAnimations[0];
-				aiNodeAnim* current_channel = model_find_animation_channel(animation, bone_name);
+				aiNodeAnim* current_channel = info.channel_index != -1 ? animation->mChannels[info.channel_index] : nullptr;
 
 				if(current_channel) {
 					glm::vec3 position = model_lerp_keyframes_positions(current_channel, ticks);
@@ -461,16 +505,14 @@ namespace gfx
 			world_transformation = glm_mat_cast(node->mTransformation);
 		}
 
-		s32 bone_index = model_find_bone_info(bone_info, bone_info_count, bone_name);
-		if(bone_index != -1) {
-			auto& current_bone_info = bone_info[bone_index];
-			current_bone_info.name  = bone_name;
+		if(info.bone_index != -1) {
+			auto& current_bone_info = bone_info[info.bone_index];
 			current_bone_info.final_transformation = current_transformation * current_bone_info.local_transformation;
 			current_bone_info.initialized = true;
 		}
 
 		for(u32 i = 0; i < node->mNumChildren; i++) {
-			model_parse_bone_transformations(scene, node->mChildren[i], ticks, bone_info, bone_info_count, world_transformation, current_transformation);
+			model_parse_bone_transformations(scene, node->mChildren[i], node_info, node_index, ticks, bone_info, world_transformation, current_transformation);
 		}
 	}
 
@@ -493,8 +535,8 @@ namespace gfx
 			s32 bone_index = -1;
 
 	    	{
-				String bone_name = mesh->mBones[i]->mName.C_Str();
-				bone_index = model_find_bone_info(bone_info, bone_info_count, bone_name);
+				const aiString& bone_name = mesh->mBones[i]->mName;
+				bone_index = model_find_bone_info(bone_info, bone_info_count, atom_find(bone_name.data, bone_name.length));
 				assert(bone_index != -1, "the bone name should be loaded by this point");
 			}
 
@@ -523,18 +565,17 @@ namespace gfx
 	    cleanup_mesh(&model->mesh_data);
 	    glDeleteBuffers(1, &model->vertex_weight_buffer);
 	    mem_free(model->vertex_divisors);
-	    mem_free(model->index_divisors);
 	    mem_free(model->bone_transformations);
+	    mem_free(model->node_info);
 	    mem_free(model->texture_info);
 	    //This is something which was allocated by another library, so just default delete
 	    delete model->scene;
 
-	    if(model->textures) {
-			for(u32 i = 0; i < model->texture_count; i++)
-				texture_cleanup(&model->textures[i]);
+		for(TextureData& texture : model->textures)
+			texture_cleanup(&texture);
 
-	        mem_free(model->textures);
-	    }
+		//Assigning an empty map gives its storage back to the allocator
+		model->textures = SlotMap<TextureData>();
 	}
 }
 
@@ -569,31 +610,47 @@ Model::~Model()
 		::operator delete(m_Vertices);
 	}
 
+	for (Mesh& mesh : m_Meshes)
+	{
+		if (mesh.instance_buffer)
+			glDeleteBuffers(1, &mesh.instance_buffer);
+	}
+
 	m_Cache.clear();
 	m_Meshes.clear();
 	m_Textures.clear();
 	m_ExternalTextures.clear();
 }
 
+//The uniform names of the mesh textures are texture1, texture2, ... and they are written on the stack,
+//so that drawing does not allocate every frame
+static const char* model_texture_uniform_name(char (&uniform_name)[16], int texture_index)
+{
+	std::snprintf(uniform_name, sizeof(uniform_name), "texture%d", texture_index + 1);
+	return uniform_name;
+}
+
 void Model::Draw(Shader& shd)
 {
+	char uniform_name_buffer[16];
+
 	for (int i = 0; i < m_Meshes.size(); i++)
 	{
 		for (int j = 0; j < m_Meshes[i].textureids.size(); j++)
 		{
 			glActiveTexture(GL_TEXTURE0 + j);
 			glBindTexture(GL_TEXTURE_2D, m_Meshes[i].textureids[j]);
-			std::string uniformname = "texture" + std::to_string(j + 1);
+			const char* uniformname = model_texture_uniform_name(uniform_name_buffer, j);
 
-			if (shd.IsUniformDefined(uniformname.c_str()))
-				shd.Uniform1i(j, uniformname.c_str());
+			if (shd.IsUniformDefined(uniformname))
+				shd.Uniform1i(j, uniformname);
 		}
 
 		//Manually textures loaded externally have priority over the ones defined in the meshes
 		for (int i = 0; i < m_ExternalTextures.size(); i++)
 		{
 			m_ExternalTextures[i].first.Bind(i);
-			std::string uniformname = m_ExternalTextures[i].second;
+			const std::string& uniformname = m_ExternalTextures[i].second;
 
 			if (shd.IsUniformDefined(uniformname.c_str()))
 				shd.Uniform1i(i, uniformname.c_str());
@@ -607,19 +664,34 @@ void Model::Draw(Shader& shd)
 
 void Model::DrawInstancedPositions(Shader& shd, u32 num_instances, glm::vec3* positions)
 {
-	u32* instancebuffers = new u32[m_Meshes.size()];
+	char uniform_name_buffer[16];
+	const u32 positions_size = num_instances * sizeof(glm::vec3);
 
 	for (int i = 0; i < m_Meshes.size(); i++)
 	{
 		//The following operation require the corrispondent VAO to be bound
-		m_Meshes[i].vm.BindVertexArray();
-
+		Mesh& mesh = m_Meshes[i];
+		mesh.vm.BindVertexArray();
 
-		//Generating a buffer which handles offsets for each mesh of the model
+		//Each mesh keeps its buffer of offsets between the draws, it is reallocated only when the
+		//instances do not fit anymore
 		//The rest of the code is almost identical to the function Draw's code
-		glGenBuffers(1, &instancebuffers[i]);
-		glBindBuffer(GL_ARRAY_BUFFER, instancebuffers[i]);
-		glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(glm::vec3), positions, GL_STATIC_DRAW);
+		if (!mesh.instance_buffer)
+		{
+			glGenBuffers(1, &mesh.instance_buffer);
+			gfx::frame_audit_record_gl_buffers(1);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.instance_buffer);
+		if (positions_size > mesh.instance_buffer_size)
+		{
+			glBufferData(GL_ARRAY_BUFFER, positions_size, positions, GL_DYNAMIC_DRAW);
+			mesh.instance_buffer_size = positions_size;
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, 0, positions_size, positions);
+		}
 
 		//We enable the 3rd index because we have already used the 0,1,2 for respectively positions, normals
 		//and texture coordinates
@@ -630,21 +702,21 @@ void Model::DrawInstancedPositions(Shader& shd, u32 num_instances, glm::vec3* po
 		glVertexAttribDivisor(3, 1);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		for (int j = 0; j < m_Meshes[i].textureids.size(); j++)
+		for (int j = 0; j < mesh.textureids.size(); j++)
 		{
 			glActiveTexture(GL_TEXTURE0 + j);
-			glBindTexture(GL_TEXTURE_2D, m_Meshes[i].textureids[j]);
-			std::string uniformname = "texture" + std::to_string(j + 1);
+			glBindTexture(GL_TEXTURE_2D, mesh.textureids[j]);
+			const char* uniformname = model_texture_uniform_name(uniform_name_buffer, j);
 
-			if (shd.IsUniformDefined(uniformname.c_str()))
-				shd.Uniform1i(j, uniformname.c_str());
+			if (shd.IsUniformDefined(uniformname))
+				shd.Uniform1i(j, uniformname);
 		}
 
 		//Manually textures loaded externally have priority over the ones defined in the meshes
 		for (int i = 0; i < m_ExternalTextures.size(); i++)
 		{
 			m_ExternalTextures[i].first.Bind(i);
-			std::string uniformname = m_ExternalTextures[i].second;
+			const std::string& uniformname = m_ExternalTextures[i].second;
 
 			if (shd.IsUniformDefined(uniformname.c_str()))
 				shd.Uniform1i(i, uniformname.c_str());
@@ -652,14 +724,8 @@ void Model::DrawInstancedPositions(Shader& shd, u32 num_instances, glm::vec3* po
 
 		shd.UniformMat4f(m_ModelMatrix, "model");
 		//And drawing the number of instances using the instanced version of the drawcall
-		glDrawElementsInstanced(GL_TRIANGLES, m_Meshes[i].vm.GetIndicesCount(), GL_UNSIGNED_INT, nullptr, num_instances);
+		glDrawElementsInstanced(GL_TRIANGLES, mesh.vm.GetIndicesCount(), GL_UNSIGNED_INT, nullptr, num_instances);
 	}
-
-	//Then cleaning up the buffers(this process can be optimized, made just to make the code more straight-forward)
-	for (int i = 0; i < m_Meshes.size(); i++)
-		glDeleteBuffers(1, &instancebuffers[i]);
-
-	delete[] instancebuffers;
 }
 
 
@@ -15,19 +15,29 @@ namespace gfx
 {
     static constexpr u32 max_bone_movement_per_vertex = 4;
 
+	//The names are atoms, so the lookups by name only compare integers
 	struct BoneInfo
 	{
-		String name;
+		Atom name;
 		u32 id;
 		glm::mat4 local_transformation;
 		glm::mat4 final_transformation;
 		bool initialized = false;
 	};
 
+	//The handle is null when the mesh has no diffuse texture
 	struct ModelTextureInfo
 	{
-		String name;
-		u32 index;
+		Atom name;
+		SlotHandle<TextureData> texture;
+	};
+
+	//Resolved once when the model is loaded, so the animation of a frame does no lookup by name. -1 when
+	//the node is not a bone or is not animated by the first animation of the scene
+	struct ModelNodeInfo
+	{
+		s32 bone_index;
+		s32 channel_index;
 	};
 
 	struct ModelData
@@ -47,14 +57,18 @@ namespace gfx
 		u32 bone_count;
 		BoneInfo* bone_transformations;
 
+		//One for each node of the scene, in depth first order
+		ModelNodeInfo* node_info;
+		u32 node_count;
+
 		//Extracted from the first offset matrix in the root node, that usually represents the rototranslation
 		//of the model in the world space
 		glm::mat4 world_transformation;
 
-		//Indexing this with the mesh index will return the index of the mesh texture
+		//Indexing this with the mesh index will return the handle of the mesh texture, the meshes which
+		//share a texture share its handle
 		ModelTextureInfo* texture_info;
-		TextureData* textures;
-		u32 texture_count;
+		SlotMap<TextureData> textures;
 
 		bool initialized;
 	};
@@ -73,15 +87,17 @@ namespace gfx
 	void          model_get_vertices_indices_bones_count(const aiScene* scene, u32* num_vertices, u32* num_indices, u32* num_bones);
 	bool          model_mesh_has_weights(const aiMesh* mesh);
 	void          model_map_bone_names_to_id(const aiScene* scene, BoneInfo* bone_info, u32 bones_count);
-	s32           model_find_bone_info(const BoneInfo* data, u32 size, String& name);
+	s32           model_find_bone_info(const BoneInfo* data, u32 size, Atom name);
 
-	aiNodeAnim*   model_find_animation_channel(const aiAnimation* anim, const String& name);
+	s32           model_find_animation_channel(const Atom* channel_names, u32 channel_count, Atom name);
+	u32           model_count_nodes(const aiNode* node);
+	void          model_map_nodes(const aiNode* node, const BoneInfo* bone_info, u32 bone_count, const Atom* channel_names, u32 channel_count, ModelNodeInfo* node_info, u32* node_index);
 	glm::vec3     model_lerp_keyframes_positions(const aiNodeAnim* node_anim, f32 ticks);
 	glm::quat     model_lerp_keyframes_rotations(const aiNodeAnim* node_anim, f32 ticks);
 	glm::vec3     model_lerp_keyframes_scales(const aiNodeAnim* node_anim, f32 ticks);
 
 	void          model_parse_bone_transformations(ModelData& model_data, f32 ticks);
-	void          model_parse_bone_transformations(const aiScene* scene, const aiNode* node, f32 ticks, BoneInfo* bone_info, u32 bone_info_count, glm::mat4& world_transformation, const glm::mat4& parent_transform = glm::mat4(1.0f));
+	void          model_parse_bone_transformations(const aiScene* scene, const aiNode* node, const ModelNodeInfo* node_info, u32* node_index, f32 ticks, BoneInfo* bone_info, glm::mat4& world_transformation, const glm::mat4& parent_transform = glm::mat4(1.0f));
 	void          model_parse_weights(const aiMesh* mesh, VertexWeight* weight_data, u32 weight_count, const BoneInfo* bone_info, u32 bone_info_count);
 	void          model_cleanup(ModelData* mesh);
 
@@ -93,6 +109,9 @@ struct Mesh
 {
 	VertexManager vm;
 	std::vector<unsigned int> textureids;
+	//Offsets of Model::DrawInstancedPositions, the buffer is created by the first draw and grows when needed
+	u32 instance_buffer = 0;
+	u32 instance_buffer_size = 0;
 };
 
 class Model
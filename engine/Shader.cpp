@@ -1,4 +1,5 @@
 #include "Shader.h"
+#include "memory.h"
 
 u64 simple_string_hash(const char* string)
 {
@@ -124,6 +125,7 @@ u32 Shader::GenUniformBuffer(const char* block_name, u32 size, u32 binding_point
 
 	//Generate a buffer and mem_allocate the desired space
 	glGenBuffers(1, &new_buffer);
+	gfx::frame_audit_record_gl_buffers(1);
 	glBindBuffer(GL_UNIFORM_BUFFER, new_buffer);
 	glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
 
@@ -265,8 +267,8 @@ s32 Shader::GetUniformLocation(const char* uniform_name) const
 	//Checking if the uniform is already stored in the cache
 
 	u64 uniform_hash = simple_string_hash(uniform_name);
-	if (m_UniformCache.find(uniform_hash) != m_UniformCache.end())
-		return m_UniformCache[uniform_hash];
+	if (const s32* cached_uniform = m_UniformCache.find(uniform_hash))
+		return *cached_uniform;
 
 	int uniform = glGetUniformLocation(m_programID, uniform_name);
 	if (uniform == -1)
@@ -275,7 +277,7 @@ s32 Shader::GetUniformLocation(const char* uniform_name) const
 		return -1;
 	}
 
-	m_UniformCache[uniform_hash] = uniform;
+	m_UniformCache.insert(uniform_hash, uniform);
 	return uniform;
 }
 
@@ -1,6 +1,5 @@
 #pragma once
 #include <iostream>
-#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <atomic>
@@ -11,6 +10,7 @@
 #include "glm/gtc/matrix_transform.hpp"
 
 #include "utils/types.h"
+#include "containers.h"
 
 #define GLError "[OpenGL]: Error in file:" << __FILE__ << ", line:" << __LINE__ << "\n"
 
@@ -71,5 +71,5 @@ private:
 	u32 m_programID;
 	std::vector<u32> m_UniformBuffers;
 	//Uniform cache
-	mutable std::unordered_map<u64, s32> m_UniformCache;
+	mutable HashMap<u64, s32> m_UniformCache;
 };
@@ -6,9 +6,13 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "VertexManager.h"
+#include "containers.h"
 
 namespace gfx
 {
+	//Every cubemap owns a single mesh, they are created and destroyed together with the cubemap
+	static Pool<VertexMesh> cubemap_mesh_pool;
+
 	TextureData texture_create(const char* filepath)
 	{
 		return texture_create(filepath, texture_default_args());
@@ -107,7 +111,7 @@ namespace gfx
 		for(u32 i = 0; i < vtx_cube_data_count; i++) {
 			buf[i] = vtx_cube_data[i] * args.cubemap_scaling;
 		}
-		texture_data.cubemap_mesh = new VertexMesh;
+		texture_data.cubemap_mesh = cubemap_mesh_pool.acquire();
 		*texture_data.cubemap_mesh = create_mesh_and_push_attributes(buf, vtx_cube_data_count * sizeof(f32),
 			&elem, sizeof(LayoutElement));
 
@@ -143,7 +147,7 @@ namespace gfx
 
 		if(data->cubemap_mesh) {
 			cleanup_mesh(data->cubemap_mesh);
-			delete data->cubemap_mesh;
+			cubemap_mesh_pool.release(data->cubemap_mesh);
 		}
 
 		glDeleteTextures(1, &data->id);
@@ -369,50 +373,34 @@ void DumpTexture(const std::string& filepath, const void* data, u32 width, u32 h
 
 void DumpTexture_PPM(std::ofstream& file, const void* data, u32 width, u32 height, TexFormat format)
 {
-	file << "P3\n";
-	file << std::to_string(width) << " " << std::to_string(height) << "\n";
+	//Every row is formatted in the temporary storage and written at once
+	StringBuilder row(width * 12 + 16);
+	row.append_many("P3\n", width, ' ', height, '\n');
 	//64 level of colors per channel
-	file << "255\n";
+	row.append("255\n");
+	file.write(row.view().data(), row.size());
 
 	//Initializing pointers that will be used depending on the texture format
 	const uint8_t* u8_data = static_cast<const uint8_t*>(data);
 	const float* f32_data = static_cast<const float*>(data);
 
+	//Alpha channel gets ignored
+	const u32 channels = format == TexFormat::Rgba8 ? 4 : 3;
+
 	switch (format)
 	{
 	case TexFormat::Rgb8:
-
-		for (uint32_t i = 0; i < height; i++)
-		{
-			for (uint32_t j = 0; j < width; j++)
-			{
-				std::string vals[3];
-				for (int k = 0; k < 3; k++)
-				{
-					uint32_t index = i * (width * 3) + (j * 3) + k;
-					vals[k] = std::to_string(static_cast<uint32_t>(u8_data[index]));
-				}
-
-				file << vals[0] << " " << vals[1] << " " << vals[2] << "\n";
-			}
-		}
-
-		break;
 	case TexFormat::Rgba8:
-		//Alpha channel gets ignored
+
 		for (uint32_t i = 0; i < height; i++)
 		{
+			row.clear();
 			for (uint32_t j = 0; j < width; j++)
 			{
-				std::string vals[3];
-				for (int k = 0; k < 3; k++)
-				{
-					uint32_t index = i * (width * 4) + (j * 4) + k;
-					vals[k] = std::to_string(static_cast<uint32_t>(u8_data[index]));
-				}
-
-				file << vals[0] << " " << vals[1] << " " << vals[2] << "\n";
+				const uint8_t* pixel = u8_data + i * (width * channels) + (j * channels);
+				row.append_many(static_cast<u32>(pixel[0]), ' ', static_cast<u32>(pixel[1]), ' ', static_cast<u32>(pixel[2]), '\n');
 			}
+			file.write(row.view().data(), row.size());
 		}
 
 		break;
@@ -420,13 +408,14 @@ void DumpTexture_PPM(std::ofstream& file, const void* data, u32 width, u32 heigh
 
 		for (uint32_t i = 0; i < height; i++)
 		{
+			row.clear();
 			for (uint32_t j = 0; j < width; j++)
 			{
 				uint32_t val = static_cast<uint32_t>(f32_data[i * width + j] * 255.0f);
-				std::string str = std::to_string(val);
-				file << str << " " << str << " " << str << "  ";
+				row.append_many(val, ' ', val, ' ', val, "  ");
 			}
-			file << "\n";
+			row.append('\n');
+			file.write(row.view().data(), row.size());
 		}
 
 		break;
@@ -1,5 +1,6 @@
 #include "VertexManager.h"
 #include "MainIncl.h"
+#include "memory.h"
 #include <utility>
 #include <cstring>
 
@@ -11,6 +12,7 @@ namespace gfx
         VertexMesh mesh = {};
 
         glGenBuffers(1, &mesh.vertex_buffer);
+        frame_audit_record_gl_buffers(1);
         glGenVertexArrays(1, &mesh.vertex_array);
 
         glBindVertexArray(mesh.vertex_array);
@@ -34,6 +36,7 @@ namespace gfx
 
         glGenBuffers(1, &mesh.vertex_buffer);
         glGenBuffers(1, &mesh.index_buffer);
+        frame_audit_record_gl_buffers(2);
         glGenVertexArrays(1, &mesh.vertex_array);
 
         glBindVertexArray(mesh.vertex_array);
@@ -101,6 +104,7 @@ namespace gfx
 
 		u32& buffer = mesh->instanced_buffers[mesh->instanced_buffers_count++];
 		glGenBuffers(1, &buffer);
+		frame_audit_record_gl_buffers(1);
 		glBindBuffer(GL_ARRAY_BUFFER, buffer);
 		glBufferData(GL_ARRAY_BUFFER, verts_size, verts, GL_DYNAMIC_DRAW);
 
@@ -168,6 +172,7 @@ VertexManager::VertexManager()
 {
 	glGenBuffers(1, &m_VBO);
 	glGenBuffers(1, &m_EBO);
+	gfx::frame_audit_record_gl_buffers(2);
 	glGenVertexArrays(1, &m_VAO);
 }
 
@@ -284,6 +289,7 @@ u32 VertexManager::PushInstancedAttribute(const void* verts, size_t verts_size,
 
 	u32& buffer = m_AdditionalBuffers.emplace_back();
 	glGenBuffers(1, &buffer);
+	gfx::frame_audit_record_gl_buffers(1);
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 	glBufferData(GL_ARRAY_BUFFER, verts_size, verts, GL_DYNAMIC_DRAW);
 
@@ -304,6 +310,7 @@ u32 VertexManager::PushInstancedMatrixBuffer(const void* verts, size_t verts_siz
 
 	u32& buffer = m_AdditionalBuffers.emplace_back();
 	glGenBuffers(1, &buffer);
+	gfx::frame_audit_record_gl_buffers(1);
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 	glBufferData(GL_ARRAY_BUFFER, verts_size, verts, GL_DYNAMIC_DRAW);
 
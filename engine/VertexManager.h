@@ -4,6 +4,7 @@
 #include <map>
 #include "GL/glew.h"
 #include "utils/types.h"
+#include "containers.h"
 
 struct LayoutElement
 {
@@ -177,6 +178,6 @@ private:
 	bool m_HasIndices;
 
 	//For extra instanced data
-	std::vector<u32> m_AdditionalBuffers;
+	DynamicArray<u32> m_AdditionalBuffers;
 	std::map<u32, void*> m_BufferPointers;
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Window.h"
+#include "memory.h"
 #include <iostream>
 #include <utility>
 
@@ -127,6 +128,8 @@ void Window::Update() const
 		glfwSetWindowShouldClose(m_Window, true);
 
 	glfwSwapBuffers(m_Window);
+	//The frame arenas follow the swap chain
+	gfx::memory_end_frame();
 }
 
 void Window::UpdateKeys()
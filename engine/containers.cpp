@@ -1,21 +1,191 @@
 #include "containers.h"
-#include "MainIncl.h"
+#include "macros.h"
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <charconv>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define STRING_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define STRING_SIMD_SSE2
+#endif
+
+//The length loop loads whole aligned blocks, which can go past the null terminating character but never
+//past its page. The sanitizer would report the bytes after the end of the string anyway
+#if defined(_MSC_VER)
+#	define STRING_NO_SANITIZE_ADDRESS __declspec(no_sanitize_address)
+#elif defined(__GNUC__) || defined(__clang__)
+#	define STRING_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#	define STRING_NO_SANITIZE_ADDRESS
+#endif
 
 extern gfx::Allocator* g_engine_allocator;
 
-u32 get_c_string_length(const char* c_string)
+#if defined(STRING_SIMD_AVX2)
+static constexpr u32 string_block_size = 32;
+
+//One bit for each byte of the block which is equal to c
+static u32 string_block_match(const char* block, char c)
 {
-	u32 size = 0;
-	for(; c_string[size] != 0; size++) {}
-	//Returns the size of the string + the null terminating character
-	return size + 1;
+	const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+	return static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c))));
+}
+
+//Aligned, so that the block never crosses a page
+STRING_NO_SANITIZE_ADDRESS
+static u32 string_block_null_mask(const char* aligned_block)
+{
+	const __m256i bytes = _mm256_load_si256(reinterpret_cast<const __m256i*>(aligned_block));
+	return static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())));
+}
+
+static bool string_block_equals(const char* first, const char* second)
+{
+	const __m256i first_bytes  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+	const __m256i second_bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second));
+	return static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(first_bytes, second_bytes))) == 0xFFFFFFFF;
+}
+#elif defined(STRING_SIMD_SSE2)
+static constexpr u32 string_block_size = 16;
+
+static u32 string_block_match(const char* block, char c)
+{
+	const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+	return static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c))));
+}
+
+STRING_NO_SANITIZE_ADDRESS
+static u32 string_block_null_mask(const char* aligned_block)
+{
+	const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(aligned_block));
+	return static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128())));
+}
+
+static bool string_block_equals(const char* first, const char* second)
+{
+	const __m128i first_bytes  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+	const __m128i second_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(first_bytes, second_bytes)) == 0xFFFF;
 }
+#endif
 
 u32 get_c_string_length_no_null_terminating(const char* c_string)
 {
+#if defined(STRING_SIMD_AVX2) || defined(STRING_SIMD_SSE2)
+	//The first aligned block can start before the string, its leading bytes are shifted out of the mask
+	const std::uintptr_t misalignment = reinterpret_cast<std::uintptr_t>(c_string) & (string_block_size - 1);
+	const char* block = c_string - misalignment;
+	u32 null_mask = string_block_null_mask(block) >> misalignment;
+	if(null_mask)
+		return static_cast<u32>(std::countr_zero(null_mask));
+
+	for(;;) {
+		block += string_block_size;
+		null_mask = string_block_null_mask(block);
+		if(null_mask)
+			return static_cast<u32>(block - c_string) + static_cast<u32>(std::countr_zero(null_mask));
+	}
+#else
 	u32 size = 0;
 	for(; c_string[size] != 0; size++) {}
 	return size;
+#endif
+}
+
+u32 get_c_string_length(const char* c_string)
+{
+	//Returns the size of the string + the null terminating character
+	return get_c_string_length_no_null_terminating(c_string) + 1;
+}
+
+bool string_equals(const char* first, const char* second, u32 size)
+{
+	u32 i = 0;
+#if defined(STRING_SIMD_AVX2) || defined(STRING_SIMD_SSE2)
+	if(size >= string_block_size) {
+		for(; i + string_block_size <= size; i += string_block_size) {
+			if(!string_block_equals(first + i, second + i))
+				return false;
+		}
+
+		//The last block overlaps the previous one instead of reading past the end
+		return i == size || string_block_equals(first + size - string_block_size, second + size - string_block_size);
+	}
+#endif
+
+	for(; i + sizeof(u64) <= size; i += sizeof(u64)) {
+		u64 first_word, second_word;
+		std::memcpy(&first_word, first + i, sizeof(u64));
+		std::memcpy(&second_word, second + i, sizeof(u64));
+		if(first_word != second_word)
+			return false;
+	}
+	for(; i < size; i++) {
+		if(first[i] != second[i])
+			return false;
+	}
+
+	return true;
+}
+
+s32 string_find_first_of(const char* string, u32 size, char c)
+{
+	u32 i = 0;
+#if defined(STRING_SIMD_AVX2) || defined(STRING_SIMD_SSE2)
+	for(; i + string_block_size <= size; i += string_block_size) {
+		const u32 match_mask = string_block_match(string + i, c);
+		if(match_mask)
+			return static_cast<s32>(i + std::countr_zero(match_mask));
+	}
+
+	//Overlapping the last full block, the bytes which were already checked have no match
+	if(i != size && size >= string_block_size) {
+		const u32 match_mask = string_block_match(string + size - string_block_size, c);
+		return match_mask ? static_cast<s32>(size - string_block_size + std::countr_zero(match_mask)) : -1;
+	}
+#endif
+
+	for(; i < size; i++) {
+		if(string[i] == c)
+			return static_cast<s32>(i);
+	}
+
+	return -1;
+}
+
+s32 string_find_last_of(const char* string, u32 size, char c)
+{
+	u32 end = size;
+#if defined(STRING_SIMD_AVX2) || defined(STRING_SIMD_SSE2)
+	for(; end >= string_block_size; end -= string_block_size) {
+		const u32 match_mask = string_block_match(string + end - string_block_size, c);
+		if(match_mask)
+			return static_cast<s32>(end - string_block_size + (31 - std::countl_zero(match_mask)));
+	}
+
+	if(end != 0 && size >= string_block_size) {
+		const u32 match_mask = string_block_match(string, c);
+		return match_mask ? static_cast<s32>(31 - std::countl_zero(match_mask)) : -1;
+	}
+#endif
+
+	for(; end > 0; end--) {
+		if(string[end - 1] == c)
+			return static_cast<s32>(end - 1);
+	}
+
+	return -1;
 }
 
 char* string_merge(const char* str1, const char* str2)
@@ -29,10 +199,619 @@ char* string_merge(const char* str1, const char* str2)
 	return buffer;
 }
 
+struct _AtomEntry
+{
+	const char* string;
+	u64 hash;
+	u32 size;
+};
+
+//Open addressing on twice the maximum amount of atoms, so the probe sequences stay short and the table
+//never needs to grow. Both arrays are zero pages until they get used
+static constexpr u32 atom_table_slot_count = atom_table_max_atoms * 2;
+static constexpr u32 atom_string_chunk_size = 64 * 1024;
+
+static std::atomic<Atom> g_atom_slots[atom_table_slot_count];
+static _AtomEntry        g_atom_entries[atom_table_max_atoms + 1];
+static std::mutex        g_atom_insert_mutex;
+static u32               g_atom_count = 0;
+static char*             g_atom_string_chunk = nullptr;
+static u32               g_atom_string_chunk_used = atom_string_chunk_size;
+
+static u64 atom_hash(const char* string, u32 size)
+{
+	u64 hash = 0x9E3779B97F4A7C15ull ^ size;
+	u32 i = 0;
+	for(; i + sizeof(u64) <= size; i += sizeof(u64)) {
+		u64 word;
+		std::memcpy(&word, string + i, sizeof(u64));
+		hash = (hash ^ word) * 0xBF58476D1CE4E5B9ull;
+		hash ^= hash >> 31;
+	}
+
+	u64 tail = 0;
+	std::memcpy(&tail, string + i, size - i);
+	hash = (hash ^ tail) * 0x94D049BB133111EBull;
+	return hash ^ (hash >> 29);
+}
+
+//The slot of the atom of the string, or the empty slot where it would go
+static u32 atom_probe(const char* string, u32 size, u64 hash, Atom* found_atom)
+{
+	u32 slot = static_cast<u32>(hash) & (atom_table_slot_count - 1);
+	for(;; slot = (slot + 1) & (atom_table_slot_count - 1)) {
+		const Atom atom = g_atom_slots[slot].load(std::memory_order_acquire);
+		if(atom == null_atom) {
+			*found_atom = null_atom;
+			return slot;
+		}
+
+		const _AtomEntry& entry = g_atom_entries[atom];
+		if(entry.hash == hash && entry.size == size && string_equals(entry.string, string, size)) {
+			*found_atom = atom;
+			return slot;
+		}
+	}
+}
+
+//The strings are packed in chunks which are never freed, so the pointers of the entries stay valid
+static const char* atom_store_string(const char* string, u32 size)
+{
+	char* stored_string = nullptr;
+	if(size + 1 > atom_string_chunk_size / 4) {
+		stored_string = static_cast<char*>(std::malloc(size + 1));
+	} else {
+		if(g_atom_string_chunk_used + size + 1 > atom_string_chunk_size) {
+			g_atom_string_chunk      = static_cast<char*>(std::malloc(atom_string_chunk_size));
+			g_atom_string_chunk_used = 0;
+		}
+
+		stored_string = g_atom_string_chunk + g_atom_string_chunk_used;
+		g_atom_string_chunk_used += size + 1;
+	}
+
+	assert(stored_string, "could not allocate the string of the atom");
+	std::memcpy(stored_string, string, size);
+	stored_string[size] = 0;
+	return stored_string;
+}
+
+Atom atom_find(const char* string, u32 size)
+{
+	Atom atom = null_atom;
+	atom_probe(string, size, atom_hash(string, size), &atom);
+	return atom;
+}
+
+Atom atom_intern(const char* string, u32 size)
+{
+	const u64 hash = atom_hash(string, size);
+	Atom atom = null_atom;
+	atom_probe(string, size, hash, &atom);
+	if(atom != null_atom)
+		return atom;
+
+	//Another thread could have added the same string since the probe, so it probes again under the lock
+	std::lock_guard lock(g_atom_insert_mutex);
+	const u32 slot = atom_probe(string, size, hash, &atom);
+	if(atom != null_atom)
+		return atom;
+
+	assert(g_atom_count < atom_table_max_atoms, "the atom table is full");
+	atom = ++g_atom_count;
+	g_atom_entries[atom] = { atom_store_string(string, size), hash, size };
+	//Publishes the entry to the lookups which do not take the lock
+	g_atom_slots[slot].store(atom, std::memory_order_release);
+	return atom;
+}
+
+Atom atom_intern(const char* string)
+{
+	return atom_intern(string, get_c_string_length_no_null_terminating(string));
+}
+
+const char* atom_get_string(Atom atom)
+{
+	assert(atom != null_atom && atom <= atom_table_max_atoms, "invalid atom");
+	return g_atom_entries[atom].string;
+}
+
+u32 atom_get_size(Atom atom)
+{
+	assert(atom != null_atom && atom <= atom_table_max_atoms, "invalid atom");
+	return g_atom_entries[atom].size;
+}
+
+
+StringBuilder::StringBuilder(u32 initial_capacity)
+{
+	_grow(initial_capacity + 1);
+}
+
+StringBuilder::~StringBuilder()
+{
+	if(end_marker.used == 0 || gfx::temporary_get_marker().used == end_marker.used)
+		gfx::temporary_free(buffer);
+}
+
+StringBuilder& StringBuilder::append_fixed(f64 value, u32 precision)
+{
+	reserve(builder_size + 32 + precision);
+	//The integer part of the big values does not fit the first guess
+	for(;;) {
+		const std::to_chars_result result = std::to_chars(buffer + builder_size, buffer + builder_capacity - 1, value,
+			std::chars_format::fixed, static_cast<int>(precision));
+		if(result.ec == std::errc()) {
+			builder_size = static_cast<u32>(result.ptr - buffer);
+			return *this;
+		}
+
+		reserve(builder_capacity * 2);
+	}
+}
+
+void StringBuilder::_grow(u32 capacity)
+{
+	u32 new_capacity = builder_capacity + builder_capacity / 2;
+	if(new_capacity < capacity)
+		new_capacity = capacity;
+
+	//Freeing the buffer on top of the temporary storage only moves the counter back, the allocation which
+	//follows starts at the same address and the characters are still there
+	const bool on_top = end_marker.used != 0 && gfx::temporary_get_marker().used == end_marker.used;
+	if(on_top) {
+		gfx::temporary_free(buffer);
+		char* grown = static_cast<char*>(gfx::temporary_allocate(new_capacity));
+		if(grown != buffer)
+			std::memmove(grown, buffer, builder_size);
+		buffer = grown;
+	} else {
+		char* grown = static_cast<char*>(gfx::temporary_allocate(new_capacity));
+		if(builder_size)
+			std::memcpy(grown, buffer, builder_size);
+		//The heap buffers are freed right away, the ones in the temporary storage wait for their scope
+		if(buffer && end_marker.used == 0)
+			gfx::temporary_free(buffer);
+		buffer = grown;
+	}
+
+	builder_capacity = new_capacity;
+	end_marker = gfx::temporary_get_marker();
+}
+
 
 namespace gfx {
+	//The vector paths are compared with plain loops for every length around the block sizes and every
+	//alignment of the string, with the characters placed at the ends of the blocks
 	void test_string()
 	{
-		//Can be used to test the string when some new features get implemented
+		alignas(64) char buffer[256];
+		alignas(64) char other[256];
+		for(u32 offset = 0; offset < 64; offset++) {
+			for(u32 length = 0; length < 130; length++) {
+				char* string = buffer + offset;
+				std::memset(buffer, 'x', sizeof(buffer));
+				for(u32 i = 0; i < length; i++) string[i] = static_cast<char>('a' + i % 23);
+				string[length] = 0;
+
+				assert(get_c_string_length_no_null_terminating(string) == length, "wrong string length");
+				assert(get_c_string_length(string) == length + 1, "wrong string length");
+
+				std::memcpy(other, string, length + 1);
+				assert(string_equals(string, other, length), "equal strings were found different");
+				for(u32 i = 0; i < length; i += 7) {
+					other[i] = '#';
+					assert(!string_equals(string, other, length), "different strings were found equal");
+					other[i] = string[i];
+				}
+
+				assert(string_find_first_of(string, length, '#') == -1 && string_find_last_of(string, length, '#') == -1,
+					"a missing character was found");
+				for(u32 first = 0; first < length; first += 5) {
+					for(u32 last = first; last < length; last += 11) {
+						string[first] = '#';
+						string[last]  = '#';
+						assert(string_find_first_of(string, length, '#') == static_cast<s32>(first), "wrong first character");
+						assert(string_find_last_of(string, length, '#') == static_cast<s32>(last), "wrong last character");
+						string[first] = static_cast<char>('a' + first % 23);
+						string[last]  = static_cast<char>('a' + last % 23);
+					}
+				}
+
+				//The characters after the size are never part of the string
+				string[length] = '#';
+				assert(string_find_first_of(string, length, '#') == -1 && string_find_last_of(string, length, '#') == -1,
+					"a character after the end of the string was found");
+			}
+		}
+
+		String name = "mixamorig:LeftHandThumb1";
+		assert(name == "mixamorig:LeftHandThumb1" && name != "mixamorig:LeftHandThumb2", "wrong string comparison");
+		assert(name.find_first_of(':') == 9 && name.find_last_of('b') == 22, "wrong character search");
+	}
+
+	void test_atoms()
+	{
+		const Atom hand = atom_intern("mixamorig:LeftHand");
+		const Atom empty = atom_intern("");
+		assert(hand != null_atom && empty != null_atom && hand != empty, "atoms need to be unique");
+		assert(atom_intern("mixamorig:LeftHand") == hand && atom_intern("mixamorig:LeftHandThumb1", 18) == hand, "equal strings need the same atom");
+		assert(atom_find("mixamorig:LeftHandThumb1", 24) == null_atom, "atom_find can't add strings");
+		assert(atom_get_size(hand) == 18 && std::strcmp(atom_get_string(hand), "mixamorig:LeftHand") == 0, "the atom lost its string");
+
+		//Every thread interns the same names, they all need to agree on the atoms
+		const u32 thread_count = 4, name_count = 2000;
+		static Atom thread_atoms[thread_count][name_count];
+		std::vector<std::thread> threads;
+		for(u32 t = 0; t < thread_count; t++) {
+			threads.emplace_back([t]() {
+				char name[32];
+				for(u32 i = 0; i < name_count; i++) {
+					const u32 name_index = (i * 7 + t * 13) % name_count;
+					std::snprintf(name, sizeof(name), "bone_%u", name_index);
+					thread_atoms[t][name_index] = atom_intern(name);
+				}
+			});
+		}
+		for(auto& thread : threads) thread.join();
+
+		for(u32 i = 0; i < name_count; i++) {
+			char name[32];
+			std::snprintf(name, sizeof(name), "bone_%u", i);
+			for(u32 t = 1; t < thread_count; t++)
+				assert(thread_atoms[t][i] == thread_atoms[0][i], "the threads got different atoms for the same string");
+			assert(std::strcmp(atom_get_string(thread_atoms[0][i]), name) == 0, "the atom points to the wrong string");
+		}
+	}
+
+	//Trivial elements go through mem_reallocate, Strings are moved one by one, both arrays start inline
+	void test_arrays()
+	{
+		SmallVector<u32, 4> numbers;
+		for(u32 i = 0; i < 1000; i++) {
+			numbers.push_back(i);
+			if(i == 3) assert(numbers.capacity() == 4, "the first elements need to stay inline");
+		}
+		for(u32 i = 0; i < 1000; i++)
+			assert(numbers[i] == i, "the elements were lost while growing");
+
+		numbers.remove_swap(0);
+		assert(numbers.size() == 999 && numbers[0] == 999 && numbers.back() == 998, "wrong element after remove_swap");
+
+		SmallVector<u32, 4> moved_numbers = static_cast<SmallVector<u32, 4>&&>(numbers);
+		assert(moved_numbers.size() == 999 && numbers.empty() && numbers.capacity() == 4, "the heap block needs to be stolen");
+
+		SmallVector<String, 2> names;
+		char name[48];
+		for(u32 i = 0; i < 100; i++) {
+			std::snprintf(name, sizeof(name), "mixamorig:Spine%u_with_a_long_suffix", i);
+			names.emplace_back(name);
+		}
+
+		SmallVector<String, 2> copied_names = names;
+		DynamicArray<String> moved_names;
+		moved_names.push_back(static_cast<String&&>(names[99]));
+		for(u32 i = 0; i < 99; i++) {
+			std::snprintf(name, sizeof(name), "mixamorig:Spine%u_with_a_long_suffix", i);
+			assert(names[i] == name && copied_names[i] == name, "the strings were lost while growing");
+		}
+		assert(moved_names[0] == copied_names[99], "the string was not moved");
+
+		SmallVector<String, 2> inline_names;
+		inline_names.emplace_back("Hips");
+		SmallVector<String, 2> moved_inline_names = static_cast<SmallVector<String, 2>&&>(inline_names);
+		assert(moved_inline_names.size() == 1 && moved_inline_names[0] == "Hips" && inline_names.empty(), "the inline elements need to be moved");
+
+		moved_inline_names.resize(3);
+		assert(moved_inline_names[2].empty() && moved_inline_names.size() == 3, "resize needs to value initialize");
+		moved_inline_names.resize(1);
+		assert(moved_inline_names.size() == 1 && moved_inline_names[0] == "Hips", "resize needs to keep the first elements");
+
+		//A view and a substring of the same path, neither of them allocates a temporary copy
+		String path = "assets/models/character/textures/diffuse.png";
+		StringView view = path;
+		const s32 slash = view.find_last_of('/');
+		assert(view.substr(0, slash) == StringView("assets/models/character/textures"), "wrong directory view");
+		assert(view.substr(slash + 1, view.size()) == "diffuse.png", "wrong file name view");
+		assert(path.substr(0, slash) == "assets/models/character/textures", "wrong substring");
+
+		path = view.substr(7, slash);
+		assert(path == "models/character/textures", "a string can be assigned its own view");
+	}
+
+	//Random insertions and removals checked against std::unordered_map, the removals leave enough
+	//tombstones to go through the rehash in place
+	void test_hash_map()
+	{
+		HashMap<u64, u32> map;
+		std::unordered_map<u64, u32> reference;
+		u64 random_state = 0x9E3779B97F4A7C15ull;
+		for(u32 i = 0; i < 200000; i++) {
+			random_state ^= random_state << 13;
+			random_state ^= random_state >> 7;
+			random_state ^= random_state << 17;
+			const u64 key = random_state % 5000;
+			switch((random_state >> 32) % 4) {
+			case 0:
+			case 1:
+				map.insert(key, i);
+				reference[key] = i;
+				break;
+			case 2:
+				assert(map.remove(key) == (reference.erase(key) == 1), "wrong removal");
+				break;
+			case 3: {
+				const u32* value = map.find(key);
+				auto it = reference.find(key);
+				assert((value != nullptr) == (it != reference.end()) && (!value || *value == it->second), "wrong value found");
+				break;
+			}
+			}
+			assert(map.size() == reference.size(), "wrong element count");
+		}
+
+		u32 visited = 0;
+		map.for_each([&](const u64& key, u32 value) {
+			assert(reference.at(key) == value, "for_each gave a wrong pair");
+			visited++;
+		});
+		assert(visited == reference.size(), "for_each missed elements");
+
+		//The values are destroyed by remove, clear and the destructor, the copy owns its own strings
+		HashMap<const void*, String> names;
+		char name[48];
+		for(u32 i = 0; i < 300; i++) {
+			std::snprintf(name, sizeof(name), "u_material.texture_diffuse_with_a_long_name%u", i);
+			names[reinterpret_cast<const void*>(static_cast<std::uintptr_t>(i * 16 + 16))] = name;
+		}
+		HashMap<const void*, String> copied_names = names;
+		for(u32 i = 0; i < 300; i += 2)
+			names.remove(reinterpret_cast<const void*>(static_cast<std::uintptr_t>(i * 16 + 16)));
+		assert(names.size() == 150 && copied_names.size() == 300, "the copy shares the elements");
+		assert(*copied_names.find(reinterpret_cast<const void*>(16)) == "u_material.texture_diffuse_with_a_long_name0", "the copy lost a string");
+
+		HashMap<const void*, String> moved_names = static_cast<HashMap<const void*, String>&&>(names);
+		assert(names.empty() && !names.contains(reinterpret_cast<const void*>(32)) && moved_names.contains(reinterpret_cast<const void*>(32)),
+			"the table needs to be stolen");
+		moved_names.clear();
+		assert(moved_names.empty() && !moved_names.find(reinterpret_cast<const void*>(32)), "clear left elements");
+	}
+
+	//The numbers are compared with printf and parsed back, the chains are checked with and without a
+	//temporary allocation between the builder and the top of the temporary storage
+	void test_string_builder()
+	{
+		char expected[64];
+		u64 random_state = 0x9E3779B97F4A7C15ull;
+		for(u32 i = 0; i < 10000; i++) {
+			random_state ^= random_state << 13;
+			random_state ^= random_state >> 7;
+			random_state ^= random_state << 17;
+
+			StringBuilder builder(4);
+			const s32 signed_value = static_cast<s32>(random_state) >> (i % 31);
+			const u64 unsigned_value = random_state >> (i % 63);
+			builder.append_many("s32 ", signed_value, ", u64 ", unsigned_value, ';');
+			std::snprintf(expected, sizeof(expected), "s32 %d, u64 %llu;", signed_value, static_cast<unsigned long long>(unsigned_value));
+			assert(std::strcmp(builder.c_str(), expected) == 0, "wrong integer formatting");
+
+			//The shortest form of a float parses back to the same value
+			const f64 float_value = static_cast<f64>(static_cast<s64>(random_state)) / static_cast<f64>((random_state >> 40) + 1);
+			builder.clear();
+			builder.append(float_value);
+			f64 parsed_value = 0.0;
+			std::from_chars(builder.view().data(), builder.view().data() + builder.size(), parsed_value);
+			assert(parsed_value == float_value, "the float does not round trip");
+		}
+
+		StringBuilder fixed(1);
+		fixed.append_fixed(3.14159, 2).append(' ').append_fixed(-0.5, 0).append(' ').append_fixed(1e40, 1);
+		assert(fixed.view() == "3.14 -0 10000000000000000303786028427003666890752.0", "wrong fixed formatting");
+
+		//The second builder is created on top of the first one, which has to move when it grows
+		const gfx::TemporaryMarker marker = gfx::temporary_get_marker();
+		{
+			gfx::TemporaryScope temporary_scope;
+			String bone = "mixamorig:Spine";
+			StringBuilder path(8);
+			path.append_many("bones[", 2u, "].", bone, '.', true);
+			StringBuilder uniform(8);
+			uniform.append("u_model");
+			for(u32 i = 0; i < 100; i++)
+				path.append(StringView("_suffix"));
+			assert(path.size() == 29 + 700 && path.view().substr(0, 31) == "bones[2].mixamorig:Spine.true_s", "the characters were lost while growing");
+			assert(path.to_string().size() == path.size() && uniform.view() == "u_model", "wrong string copy");
+		}
+		assert(gfx::temporary_get_marker().used == marker.used, "the scope needs to release the builders");
+
+		//A builder which stays on top grows in place and is released by its destructor
+		{
+			StringBuilder first(16);
+			first.append_many("u_material.texture", 12, "_diffuse_with_a_name_longer_than_the_buffer");
+			assert(first.view() == "u_material.texture12_diffuse_with_a_name_longer_than_the_buffer", "wrong chain");
+		}
+		assert(gfx::temporary_get_marker().used == marker.used, "the builder on top needs to be released");
+	}
+
+	//The handles are checked against a reference map after random insertions and removals, the elements
+	//are move only and count their destructions
+	void test_slot_map()
+	{
+		struct Resource
+		{
+			Resource(u32 id, s32* alive) : id(id), alive(alive) { (*alive)++; }
+			Resource(Resource&& right) noexcept : id(right.id), alive(right.alive) { (*alive)++; }
+			Resource(const Resource&) = delete;
+			Resource& operator=(const Resource&) = delete;
+			~Resource() { (*alive)--; }
+
+			u32 id;
+			s32* alive;
+		};
+
+		s32 alive = 0;
+		{
+			SlotMap<Resource> resources;
+			std::unordered_map<u32, u32> reference;
+			DynamicArray<SlotHandle<Resource>> removed_handles;
+			u64 random_state = 0x9E3779B97F4A7C15ull;
+			for(u32 i = 0; i < 50000; i++) {
+				random_state ^= random_state << 13;
+				random_state ^= random_state >> 7;
+				random_state ^= random_state << 17;
+
+				if(reference.empty() || (random_state >> 32) % 3 != 0) {
+					const SlotHandle<Resource> handle = resources.emplace(i, &alive);
+					assert(handle && reference.find(handle.value) == reference.end(), "the handle was given twice");
+					reference[handle.value] = i;
+				} else {
+					const u32 dense_index = static_cast<u32>(random_state % resources.size());
+					const SlotHandle<Resource> handle = resources.handle_at(dense_index);
+					assert(resources.get(handle) == &resources[dense_index], "handle_at gave the wrong handle");
+					assert(resources.remove(handle) && !resources.remove(handle), "the handle needs to be removed once");
+					reference.erase(handle.value);
+					removed_handles.push_back(handle);
+				}
+				assert(resources.size() == reference.size() && alive == static_cast<s32>(reference.size()), "wrong element count");
+			}
+
+			for(const auto& [handle_value, id] : reference) {
+				const Resource* resource = resources.get({ handle_value });
+				assert(resource && resource->id == id, "the handle points to the wrong element");
+			}
+			for(SlotHandle<Resource> handle : removed_handles) {
+				if(reference.find(handle.value) == reference.end())
+					assert(!resources.contains(handle), "a stale handle was accepted");
+			}
+
+			u32 visited = 0;
+			for(const Resource& resource : resources)
+				visited += reference.at(resources.handle_at(static_cast<u32>(&resource - resources.begin())).value) == resource.id;
+			assert(visited == reference.size(), "the dense iteration missed elements");
+
+			const SlotHandle<Resource> last = resources.handle_at(0);
+			resources.clear();
+			assert(resources.empty() && alive == 0 && !resources.get(last) && !resources.get({}), "clear left elements");
+			resources.emplace(0u, &alive);
+		}
+		assert(alive == 0, "the destructor left elements");
+
+		//The same slot is reused until its generation wraps, the handles are never zero
+		SlotMap<u32> numbers;
+		for(u32 i = 0; i < 2 * slot_map_generation_mask; i++) {
+			const SlotHandle<u32> handle = numbers.insert(i);
+			assert(handle && (handle.value & (slot_map_max_slots - 1)) == 0 && *numbers.get(handle) == i, "wrong handle after a wrap");
+			numbers.remove(handle);
+		}
+
+		//A stale handle which matches the generation of a free slot, as after a wrap, does not resolve even
+		//when the slot links to another free one
+		SlotMap<u32> wrapped;
+		wrapped.insert(7);
+		const SlotHandle<u32> first  = wrapped.insert(1);
+		const SlotHandle<u32> second = wrapped.insert(2);
+		wrapped.remove(first);
+		wrapped.remove(second);
+		const SlotHandle<u32> wrapped_handle = { second.value + (1 << slot_map_index_bits) };
+		assert(!wrapped.contains(wrapped_handle) && !wrapped.get(wrapped_handle), "a free slot resolved");
+		assert(wrapped.insert(3) == wrapped_handle && *wrapped.get(wrapped_handle) == 3, "the free list lost a slot");
+	}
+
+	//Every producer pushes an increasing sequence, alone or in batches, the consumer checks that each
+	//sequence arrives complete and in order. The elements left in the queues are destroyed with them
+	void test_queues()
+	{
+		const u32 item_count = 200000;
+		for(u32 batched = 0; batched < 2; batched++) {
+			SpscQueue<u32> queue(256);
+			std::thread producer([&queue, batched]() {
+				u32 batch[37];
+				for(u32 next = 0; next < item_count;) {
+					if(batched) {
+						u32 count = 0;
+						for(; count < 37 && next + count < item_count; count++) batch[count] = next + count;
+						const u32 pushed = queue.try_push_batch(batch, count);
+						if(!pushed) std::this_thread::yield();
+						next += pushed;
+					} else if(queue.try_push(next)) {
+						next++;
+					} else {
+						std::this_thread::yield();
+					}
+				}
+			});
+
+			u32 expected = 0, batch[64];
+			while(expected < item_count) {
+				const u32 popped = batched ? queue.try_pop_batch(batch, 64) : queue.try_pop(batch);
+				if(!popped) std::this_thread::yield();
+				for(u32 i = 0; i < popped; i++)
+					assert(batch[i] == expected++, "the spsc queue lost the order");
+			}
+			producer.join();
+			assert(queue.size_approx() == 0 && !queue.try_pop(batch), "the spsc queue is not empty");
+		}
+
+		const u32 producer_count = 4;
+		for(u32 batched = 0; batched < 2; batched++) {
+			MpscQueue<u64> queue(128);
+			std::vector<std::thread> producers;
+			for(u64 p = 0; p < producer_count; p++) {
+				producers.emplace_back([&queue, batched, p]() {
+					u64 batch[13];
+					for(u64 next = 0; next < item_count;) {
+						if(batched) {
+							u32 count = 0;
+							for(; count < 13 && next + count < item_count; count++) batch[count] = (p << 32) | (next + count);
+							const u32 pushed = queue.try_push_batch(batch, count);
+							if(!pushed) std::this_thread::yield();
+							next += pushed;
+						} else if(queue.try_push((p << 32) | next)) {
+							next++;
+						} else {
+							std::this_thread::yield();
+						}
+					}
+				});
+			}
+
+			u64 expected[producer_count] = {};
+			u64 batch[32];
+			for(u32 received = 0; received < producer_count * item_count;) {
+				const u32 popped = batched ? queue.try_pop_batch(batch, 32) : queue.try_pop(batch);
+				if(!popped) std::this_thread::yield();
+				for(u32 i = 0; i < popped; i++) {
+					const u64 p = batch[i] >> 32;
+					assert(p < producer_count && (batch[i] & 0xFFFFFFFF) == expected[p]++, "the mpsc queue lost the order of a producer");
+				}
+				received += popped;
+			}
+			for(auto& producer : producers) producer.join();
+			assert(!queue.try_pop(batch), "the mpsc queue is not empty");
+		}
+
+		//Full queues refuse the push, the strings still inside are freed by the destructors
+		SpscQueue<String> names(4);
+		MpscQueue<String> commands(4);
+		for(u32 i = 0; i < 4; i++) {
+			assert(names.try_push(String("mixamorig:Spine_with_a_long_name")) && commands.try_emplace("draw_the_model_with_a_long_name"), "the queue is full too early");
+		}
+		assert(!names.try_push(String("Hips")) && !commands.try_push(String("Hips")), "a full queue accepted an element");
+		String name;
+		assert(names.try_pop(&name) && name == "mixamorig:Spine_with_a_long_name" && names.try_push(static_cast<String&&>(name)), "wrong element");
+		String batch_names[2] = { "first", "second" };
+		assert(commands.try_pop(&name) && commands.try_push_batch(batch_names, 2) == 1, "the batch needs to stop when the queue is full");
+	}
+
+	void containers_run_tests()
+	{
+		test_string();
+		test_atoms();
+		test_arrays();
+		test_hash_map();
+		test_string_builder();
+		test_slot_map();
+		test_queues();
+		log_message("(containers_run_tests) tests: OK\n");
 	}
 }
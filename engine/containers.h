@@ -3,15 +3,97 @@
 #include "utils/types.h"
 #include <type_traits>
 #include <string>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <new>
 #include "memory.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define HASH_MAP_SIMD_SSE2
+#endif
+
 #define local_assert(x, msg) if(!(x)) { *(int*)0 = 0; }
 
+//The string helpers use AVX2 or SSE2 when the compiler targets them, a scalar loop otherwise
 u32  get_c_string_length(const char* c_string);
 u32  get_c_string_length_no_null_terminating(const char* c_string);
+bool string_equals(const char* first, const char* second, u32 size);
+//-1 when the character is not in the first size characters
+s32  string_find_first_of(const char* string, u32 size, char c);
+s32  string_find_last_of(const char* string, u32 size, char c);
 //INFO buffer needs to be FREED after function call
 char* string_merge(const char* str1, const char* str2);
 
+//Interned strings, equal strings always get the same atom so they can be compared as integers. The table
+//is global and thread safe, only the insertions take a lock and the interned strings are never freed.
+//null_atom is never returned by atom_intern, the empty string gets its own atom
+typedef u32 Atom;
+static constexpr Atom null_atom = 0;
+static constexpr u32  atom_table_max_atoms = 1 << 18;
+
+Atom        atom_intern(const char* string);
+Atom        atom_intern(const char* string, u32 size);
+//Same as atom_intern, but it returns null_atom instead of adding the string
+Atom        atom_find(const char* string, u32 size);
+//Null terminated
+const char* atom_get_string(Atom atom);
+u32         atom_get_size(Atom atom);
+
+//Non-owning range of characters, it is not null terminated so it can't be passed where a C string is
+//expected. The viewed string needs to outlive it
+class StringView
+{
+public:
+	StringView() {}
+	StringView(const char* string) : string(string), string_size(get_c_string_length_no_null_terminating(string)) {}
+	StringView(const char* string, u32 size) : string(string), string_size(size) {}
+
+	const char* data() const { return string; }
+	u32  size() const  { return string_size; }
+	bool empty() const { return string_size == 0; }
+
+	char operator[](u32 index) const
+	{
+		local_assert(index < string_size, "index out of bounds");
+		return string[index];
+	}
+
+	bool operator==(StringView view) const
+	{
+		return string_size == view.string_size && string_equals(string, view.string, string_size);
+	}
+
+	bool operator!=(StringView view) const
+	{
+		return !operator==(view);
+	}
+
+	s32 find_first_of(char c) const
+	{
+		return string_find_first_of(string, string_size, c);
+	}
+
+	s32 find_last_of(char c) const
+	{
+		return string_find_last_of(string, string_size, c);
+	}
+
+	//The characters between begin and end, end excluded
+	StringView substr(u32 begin, u32 end) const
+	{
+		local_assert(begin <= end && end <= string_size, "the range is out of the view");
+		return StringView(string + begin, end - begin);
+	}
+
+private:
+	const char* string = "";
+	u32 string_size = 0;
+};
+
 template <typename CharType>
 class GenericString
 {
@@ -37,57 +119,40 @@ public:
 	}
 
 
+	//The characters do not need to be null terminated
 	GenericString(const char* string, u32 size)
 	{
-		u32 actual_size = get_c_string_length_no_null_terminating(string);
-		local_assert(size < actual_size, "specified size must be smaller than the actual string size");
-
-		CharType* buf = gfx::temporary_allocate<CharType>(size + 1);
+		_assign(string, size);
+	}
 
-		std::memcpy(buf, string, size);
-		buf[size] = 0;
-		*this = buf;
-		gfx::temporary_free(buf);
+	GenericString(StringView view)
+	{
+		_assign(view.data(), view.size());
 	}
 
 	GenericString& operator=(const char* string)
 	{
-		string_size = get_c_string_length_no_null_terminating(string);
-		if(string_size < stack_buffer_size) {
-			std::memset(stack_buffer, 0, stack_buffer_size);
-			std::memcpy(stack_buffer, string, string_size);
-			stack_buffer[string_size] = 0;
-
-			if (heap_buffer)
-				_free_heap();
-
-		} else {
-			if(heap_buffer) {
-				if(string_size < heap_capacity) {
-					std::memset(heap_buffer, 0, heap_capacity);
-					std::memcpy(heap_buffer, string, string_size);
-					return *this;
-				} else {
-					_free_heap();
-				}
-			}
-
-			heap_capacity = (string_size * 3) / 2;
-			heap_buffer = gfx::mem_allocate_zeroed<CharType>(heap_capacity);
-			std::memcpy(heap_buffer, string, string_size);
-
-			std::memset(stack_buffer, 0, stack_buffer_size);
-		}
+		_assign(string, get_c_string_length_no_null_terminating(string));
+		return *this;
+	}
 
+	GenericString& operator=(StringView view)
+	{
+		_assign(view.data(), view.size());
 		return *this;
 	}
 
+	operator StringView() const
+	{
+		return StringView(data(), string_size);
+	}
+
 	GenericString& operator=(const GenericString& string) noexcept
 	{
 		string_size = string.string_size;
 		if(string.heap_buffer) {
 			heap_capacity = string.heap_capacity;
-			heap_buffer = gfx::mem_allocate_zeroed<CharType>(heap_capacity);
+			heap_buffer = _allocate_heap(heap_capacity);
 			std::memcpy(heap_buffer, string.heap_buffer, string_size);
 		} else {
 			std::memcpy(stack_buffer, string.stack_buffer, string_size);
@@ -112,7 +177,7 @@ public:
 		return *this;
 	}
 
-	u32 size()
+	u32 size() const
 	{
 		return string_size;
 	}
@@ -126,13 +191,23 @@ public:
 
 	void append(const CharType* string)
 	{
-		const u32 size = get_c_string_length_no_null_terminating(string);
+		append(string, get_c_string_length_no_null_terminating(string));
+	}
+
+	void append(StringView view)
+	{
+		append(view.data(), view.size());
+	}
+
+	//The characters do not need to be null terminated
+	void append(const CharType* string, u32 size)
+	{
 		if(!heap_buffer) {
 			if(string_size + size < stack_buffer_size) {
 				std::memcpy(stack_buffer + string_size, string, size);
 			} else {
 				heap_capacity = ((string_size + size) * 3) / 2;
-				heap_buffer = gfx::mem_allocate_zeroed<CharType>(heap_capacity);
+				heap_buffer = _allocate_heap(heap_capacity);
 				std::memcpy(heap_buffer, stack_buffer, string_size);
 				std::memcpy(heap_buffer + string_size, string, size);
 
@@ -143,11 +218,15 @@ public:
 			if(string_size + size >= heap_capacity) {
 				//Still allocate a bit of quantity so that even if we are appending a single char we are not
 				//reallocating for just 2 slots
-				heap_capacity += (size > 3 ? size : 3) * 2;
-				CharType* new_heap_buffer = gfx::mem_allocate_zeroed<CharType>(heap_capacity);
-				std::memcpy(new_heap_buffer, heap_buffer, string_size);
-				gfx::mem_free(heap_buffer);
-				heap_buffer = new_heap_buffer;
+				const u32 new_capacity = heap_capacity + (size > 3 ? size : 3) * 2;
+				//Grows in place when the allocator has free space right after the buffer. On failure the
+				//buffer is kept as it was, the same as mem_allocate the string can't go on without memory
+				gfx::MemoryTagScope tag_scope(gfx::MEMORY_TAG_STRING);
+				CharType* new_buffer = gfx::mem_reallocate(heap_buffer, new_capacity);
+				local_assert(new_buffer, "the hard budget of the string tag was reached");
+				heap_buffer   = new_buffer;
+				heap_capacity = new_capacity;
+				std::memset(heap_buffer + string_size, 0, heap_capacity - string_size);
 			}
 			std::memcpy(heap_buffer + string_size, string, size);
 		}
@@ -158,16 +237,16 @@ public:
 
 	void append_s32(const s32 value)
 	{
-		CharType buf[16] = {};
-		_itoa_s(value, buf, sizeof(buf), 10);
-		append(buf);
+		CharType buf[16];
+		const std::to_chars_result result = std::to_chars(buf, buf + sizeof(buf), value);
+		append(buf, static_cast<u32>(result.ptr - buf));
 	}
 
 	void append_u32(const u32 value)
 	{
-		CharType buf[16] = {};
-		_ultoa_s(value, buf, sizeof(buf), 10);
-		append(buf);
+		CharType buf[16];
+		const std::to_chars_result result = std::to_chars(buf, buf + sizeof(buf), value);
+		append(buf, static_cast<u32>(result.ptr - buf));
 	}
 
 	void operator+=(const CharType ch)
@@ -180,7 +259,7 @@ public:
 	}
 	void operator+=(const GenericString& string)
 	{
-		append(string.c_str());
+		append(string.data(), string.string_size);
 	}
 
 	const CharType* data() const
@@ -254,15 +333,7 @@ public:
 		if(string_size != string.string_size)
 			return false;
 
-		const CharType* first_buf  = data();
-		const CharType* second_buf = string.data();
-
-		for(u32 i = 0; i < string_size; i++) {
-			if(first_buf[i] != second_buf[i])
-				return false;
-		}
-
-		return true;
+		return string_equals(data(), string.data(), string_size);
 	}
 
 	bool operator==(const char* string) const
@@ -270,15 +341,7 @@ public:
 		if(string_size != get_c_string_length_no_null_terminating(string))
 			return false;
 
-		const CharType* first_buf  = data();
-		const CharType* second_buf = string;
-
-		for(u32 i = 0; i < string_size; i++) {
-			if(first_buf[i] != second_buf[i])
-				return false;
-		}
-
-		return true;
+		return string_equals(data(), string, string_size);
 	}
 
 	bool operator!=(const GenericString& string) const
@@ -293,26 +356,15 @@ public:
 
 	s32 find_first_of(CharType c) const
 	{
-		const CharType* buf = data();
-		for(s32 i = 0; i < (s32)string_size; i++) {
-			if(buf[i] == c)
-				return i;
-		}
-
-		return -1;
+		return string_find_first_of(data(), string_size, c);
 	}
 
 	s32 find_last_of(CharType c) const
 	{
-		const CharType* buf = data();
-		for(s32 i = 0; i < (s32)string_size; i++) {
-			if(buf[(string_size - 1) - i] == c)
-				return (string_size - 1) - i;
-		}
-
-		return -1;
+		return string_find_last_of(data(), string_size, c);
 	}
 
+	//The characters between begin and end, end excluded, copied straight into the new string
 	GenericString substr(u32 begin, u32 end) const
 	{
 		if(begin >= string_size || end >= string_size)
@@ -327,7 +379,7 @@ public:
 		clear();
 
 		if(size >= stack_buffer_size) {
-			gfx::mem_allocate_zeroed<CharType>(size);
+			heap_buffer   = _allocate_heap(size);
 			heap_capacity = size;
 		}
 
@@ -365,6 +417,42 @@ public:
 
 private:
 
+	//The characters can also come from this same string, like when it is assigned one of its views
+	//The buffer is picked before the single copy, so the copy is always bounded by the capacity of its
+	//destination. The characters can come from the current heap buffer, which is freed after the copy
+	void _assign(const char* string, u32 size)
+	{
+		string_size = size;
+		CharType* destination  = stack_buffer;
+		u32 capacity           = stack_buffer_size;
+		CharType* freed_buffer = nullptr;
+		if(string_size >= stack_buffer_size) {
+			if(!heap_buffer || string_size >= heap_capacity) {
+				freed_buffer  = heap_buffer;
+				heap_capacity = (string_size * 3) / 2;
+				heap_buffer   = _allocate_heap(heap_capacity);
+				std::memset(stack_buffer, 0, stack_buffer_size);
+			}
+			destination = heap_buffer;
+			capacity    = heap_capacity;
+		} else if(heap_buffer) {
+			freed_buffer  = heap_buffer;
+			heap_buffer   = nullptr;
+			heap_capacity = 0;
+		}
+
+		std::memmove(destination, string, string_size);
+		std::memset(destination + string_size, 0, capacity - string_size);
+		if(freed_buffer)
+			gfx::mem_free(freed_buffer);
+	}
+
+	CharType* _allocate_heap(u32 capacity)
+	{
+		gfx::MemoryTagScope tag_scope(gfx::MEMORY_TAG_STRING);
+		return gfx::mem_allocate_zeroed<CharType>(capacity);
+	}
+
 	void _free_heap()
 	{
 		gfx::mem_free(heap_buffer);
@@ -396,10 +484,1178 @@ GenericString<T> operator+(const GenericString<T>& a, const T* b)
 	return result;
 }
 
-using String = GenericString<char>;
+//Array which keeps its first inline_capacity elements inside of the object, the ones after go to the gfx
+//allocator. The trivially copyable elements grow in place with mem_reallocate when possible, the other
+//ones are moved to the new block. Pointers to the elements are invalidated when the array grows
+template<typename T, u32 inline_capacity>
+class SmallVector
+{
+	static_assert(alignof(T) <= gfx::max_allocation_alignment, "T needs a bigger alignment than the allocator can guarantee");
+public:
+	SmallVector() {}
+
+	SmallVector(const SmallVector& array)
+	{
+		operator=(array);
+	}
+
+	SmallVector(SmallVector&& right) noexcept
+	{
+		operator=(static_cast<SmallVector&&>(right));
+	}
+
+	SmallVector& operator=(const SmallVector& array)
+	{
+		if(this == &array)
+			return *this;
+
+		clear();
+		reserve(array.element_count);
+		for(u32 i = 0; i < array.element_count; i++)
+			new (elements + i) T(array.elements[i]);
+
+		element_count = array.element_count;
+		return *this;
+	}
+
+	//The heap block is stolen, the inline elements can only be moved one by one
+	SmallVector& operator=(SmallVector&& right) noexcept
+	{
+		if(this == &right)
+			return *this;
+
+		clear();
+		if(!right._is_inline()) {
+			_free_heap();
+			elements         = right.elements;
+			element_capacity = right.element_capacity;
+			element_count    = right.element_count;
+			right.elements         = right._inline_elements();
+			right.element_capacity = inline_capacity;
+			right.element_count    = 0;
+			return *this;
+		}
+
+		reserve(right.element_count);
+		for(u32 i = 0; i < right.element_count; i++)
+			new (elements + i) T(static_cast<T&&>(right.elements[i]));
+
+		element_count = right.element_count;
+		right.clear();
+		return *this;
+	}
+
+	~SmallVector()
+	{
+		clear();
+		_free_heap();
+	}
+
+	T& push_back(const T& element)
+	{
+		return emplace_back(element);
+	}
+
+	T& push_back(T&& element)
+	{
+		return emplace_back(static_cast<T&&>(element));
+	}
+
+	template<typename... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if(element_count == element_capacity)
+			_grow(element_count + 1);
+
+		T* element = new (elements + element_count) T(static_cast<Args&&>(args)...);
+		element_count++;
+		return *element;
+	}
+
+	void pop_back()
+	{
+		local_assert(element_count, "the array is empty");
+		elements[--element_count].~T();
+	}
+
+	//Moves the last element in place of the removed one
+	void remove_swap(u32 index)
+	{
+		local_assert(index < element_count, "index out of bounds");
+		if(index != element_count - 1)
+			elements[index] = static_cast<T&&>(elements[element_count - 1]);
+
+		pop_back();
+	}
+
+	void reserve(u32 capacity)
+	{
+		if(capacity > element_capacity)
+			_grow(capacity);
+	}
+
+	//The new elements are value initialized
+	void resize(u32 size)
+	{
+		reserve(size);
+		for(u32 i = element_count; i < size; i++)
+			new (elements + i) T();
+		for(u32 i = size; i < element_count; i++)
+			elements[i].~T();
+
+		element_count = size;
+	}
+
+	//Keeps the capacity
+	void clear()
+	{
+		if constexpr(!std::is_trivially_destructible_v<T>) {
+			for(u32 i = 0; i < element_count; i++)
+				elements[i].~T();
+		}
+
+		element_count = 0;
+	}
+
+	u32  size() const     { return element_count; }
+	u32  capacity() const { return element_capacity; }
+	bool empty() const    { return element_count == 0; }
+
+	T*       data()       { return elements; }
+	const T* data() const { return elements; }
+
+	T*       begin()       { return elements; }
+	const T* begin() const { return elements; }
+	T*       end()         { return elements + element_count; }
+	const T* end() const   { return elements + element_count; }
+
+	T& back()
+	{
+		local_assert(element_count, "the array is empty");
+		return elements[element_count - 1];
+	}
+
+	const T& back() const
+	{
+		local_assert(element_count, "the array is empty");
+		return elements[element_count - 1];
+	}
+
+	T& operator[](u32 index)
+	{
+		local_assert(index < element_count, "index out of bounds");
+		return elements[index];
+	}
+
+	const T& operator[](u32 index) const
+	{
+		local_assert(index < element_count, "index out of bounds");
+		return elements[index];
+	}
+
+private:
+	//The capacity grows by half of itself, so that pushing one element at a time stays amortized O(1)
+	void _grow(u32 min_capacity)
+	{
+		u32 new_capacity = element_capacity + element_capacity / 2;
+		if(new_capacity < min_capacity) new_capacity = min_capacity;
+		if(new_capacity < 4)            new_capacity = 4;
+
+		if constexpr(std::is_trivially_copyable_v<T>) {
+			if(!_is_inline()) {
+				//The array is only updated once the block is there, a failed reallocation keeps the old one
+				T* new_elements = static_cast<T*>(gfx::mem_reallocate(static_cast<void*>(elements), new_capacity * sizeof(T)));
+				local_assert(new_elements, "the hard budget of the tag was reached");
+				elements         = new_elements;
+				element_capacity = new_capacity;
+				return;
+			}
+		}
+
+		T* new_elements = static_cast<T*>(gfx::mem_allocate_aligned(new_capacity * sizeof(T), alignof(T)));
+		for(u32 i = 0; i < element_count; i++) {
+			new (new_elements + i) T(static_cast<T&&>(elements[i]));
+			elements[i].~T();
+		}
+
+		_free_heap();
+		elements         = new_elements;
+		element_capacity = new_capacity;
+	}
+
+	void _free_heap()
+	{
+		if(!_is_inline())
+			gfx::mem_free(elements);
+
+		elements         = _inline_elements();
+		element_capacity = inline_capacity;
+	}
+
+	bool _is_inline() const
+	{
+		return elements == _inline_elements();
+	}
+
+	T* _inline_elements()
+	{
+		return reinterpret_cast<T*>(inline_storage);
+	}
+
+	const T* _inline_elements() const
+	{
+		return reinterpret_cast<const T*>(inline_storage);
+	}
+
+	//Never empty, so that every array has its own address for the inline elements
+	alignas(T) u8 inline_storage[inline_capacity ? inline_capacity * sizeof(T) : 1];
+	T*  elements         = _inline_elements();
+	u32 element_count    = 0;
+	u32 element_capacity = inline_capacity;
+};
+
+//Growable array which keeps every element in the gfx allocator
+template<typename T>
+using DynamicArray = SmallVector<T, 0>;
+
+//Keys are hashed once and mixed, so that the low bits pick the group and the high ones the tag. The
+//identity of the integers would put the sequential keys in the same group
+template<typename K>
+struct HashMapHash
+{
+	static_assert(std::is_integral_v<K> || std::is_enum_v<K> || std::is_pointer_v<K>, "HashMap needs a hash functor for this key type");
+
+	u64 operator()(const K& key) const
+	{
+		u64 hash;
+		if constexpr(std::is_pointer_v<K>)
+			hash = static_cast<u64>(reinterpret_cast<std::uintptr_t>(key));
+		else
+			hash = static_cast<u64>(key);
+
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		hash *= 0xC4CEB9FE1A85EC53ull;
+		return hash ^ (hash >> 33);
+	}
+};
+
+static constexpr u32 hash_map_group_size = 16;
+static constexpr u8  hash_map_control_empty   = 0x80;
+static constexpr u8  hash_map_control_deleted = 0xFE;
+
+//One bit for each control byte of the group equal to the tag
+inline u32 hash_map_group_match(const u8* group, u8 tag)
+{
+#ifdef HASH_MAP_SIMD_SSE2
+	const __m128i controls = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+	return static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(controls, _mm_set1_epi8(static_cast<char>(tag)))));
+#else
+	u32 mask = 0;
+	for(u32 i = 0; i < hash_map_group_size; i++)
+		mask |= static_cast<u32>(group[i] == tag) << i;
+	return mask;
+#endif
+}
+
+//The empty and the deleted control bytes are the only ones with the high bit set
+inline u32 hash_map_group_match_free(const u8* group)
+{
+#ifdef HASH_MAP_SIMD_SSE2
+	return static_cast<u32>(_mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+	u32 mask = 0;
+	for(u32 i = 0; i < hash_map_group_size; i++)
+		mask |= static_cast<u32>(group[i] >> 7) << i;
+	return mask;
+#endif
+}
+
+//Open addressing map in the style of the Swiss tables. Every slot has a control byte with 7 bits of the
+//hash, the control bytes of a group of 16 slots are matched at once and the keys are compared only for
+//the matching slots. The groups are probed in triangular order, removed slots become tombstones which
+//are dropped when the table gets rehashed. The table keeps at most 7/8 of the slots full, its memory
+//comes from the gfx allocator. Pointers to the values are invalidated by the insertions
+template<typename K, typename V, typename Hash = HashMapHash<K>>
+class HashMap
+{
+	struct _Slot
+	{
+		K key;
+		V value;
+	};
+
+	static_assert(alignof(_Slot) <= gfx::max_allocation_alignment, "the slots need a bigger alignment than the allocator can guarantee");
+public:
+	HashMap() {}
+
+	HashMap(const HashMap& map)
+	{
+		operator=(map);
+	}
+
+	HashMap(HashMap&& right) noexcept
+	{
+		operator=(static_cast<HashMap&&>(right));
+	}
+
+	HashMap& operator=(const HashMap& map)
+	{
+		if(this == &map)
+			return *this;
+
+		clear();
+		reserve(map.element_count);
+		map.for_each([this](const K& key, const V& value) { insert(key, value); });
+		return *this;
+	}
+
+	HashMap& operator=(HashMap&& right) noexcept
+	{
+		if(this == &right)
+			return *this;
+
+		_destroy();
+		controls      = right.controls;
+		slots         = right.slots;
+		slot_capacity = right.slot_capacity;
+		element_count = right.element_count;
+		growth_left   = right.growth_left;
+		right.controls      = nullptr;
+		right.slots         = nullptr;
+		right.slot_capacity = 0;
+		right.element_count = 0;
+		right.growth_left   = 0;
+		return *this;
+	}
+
+	~HashMap()
+	{
+		_destroy();
+	}
+
+	//nullptr when the key is not in the map
+	V* find(const K& key)
+	{
+		const u32 slot = _find_slot(key, Hash{}(key));
+		return slot != invalid_slot ? &slots[slot].value : nullptr;
+	}
+
+	const V* find(const K& key) const
+	{
+		const u32 slot = _find_slot(key, Hash{}(key));
+		return slot != invalid_slot ? &slots[slot].value : nullptr;
+	}
+
+	bool contains(const K& key) const
+	{
+		return find(key) != nullptr;
+	}
+
+	//The value of a key already in the map is replaced
+	V& insert(const K& key, const V& value)
+	{
+		bool inserted = false;
+		V& stored_value = _find_or_prepare(key, &inserted);
+		if(inserted)
+			new (&stored_value) V(value);
+		else
+			stored_value = value;
+
+		return stored_value;
+	}
+
+	//Value initialized when the key was not in the map
+	V& operator[](const K& key)
+	{
+		bool inserted = false;
+		V& stored_value = _find_or_prepare(key, &inserted);
+		if(inserted)
+			new (&stored_value) V();
+
+		return stored_value;
+	}
+
+	bool remove(const K& key)
+	{
+		const u32 slot = _find_slot(key, Hash{}(key));
+		if(slot == invalid_slot)
+			return false;
+
+		slots[slot].key.~K();
+		slots[slot].value.~V();
+		controls[slot] = hash_map_control_deleted;
+		element_count--;
+		return true;
+	}
+
+	//Keeps the capacity
+	void clear()
+	{
+		if(!slot_capacity)
+			return;
+
+		_destroy_elements();
+		std::memset(controls, hash_map_control_empty, slot_capacity);
+		element_count = 0;
+		growth_left   = _max_elements(slot_capacity);
+	}
+
+	void reserve(u32 count)
+	{
+		if(count > _max_elements(slot_capacity))
+			_rehash(_capacity_for(count));
+	}
+
+	u32  size() const  { return element_count; }
+	bool empty() const { return element_count == 0; }
+
+	template<typename Function>
+	void for_each(Function&& function)
+	{
+		for(u32 i = 0; i < slot_capacity; i++) {
+			if(!(controls[i] & 0x80))
+				function(static_cast<const K&>(slots[i].key), slots[i].value);
+		}
+	}
+
+	template<typename Function>
+	void for_each(Function&& function) const
+	{
+		for(u32 i = 0; i < slot_capacity; i++) {
+			if(!(controls[i] & 0x80))
+				function(slots[i].key, static_cast<const V&>(slots[i].value));
+		}
+	}
+
+private:
+	static constexpr u32 invalid_slot = 0xFFFFFFFF;
+
+	static u32 _max_elements(u32 capacity)
+	{
+		return capacity - capacity / 8;
+	}
+
+	static u32 _capacity_for(u32 count)
+	{
+		u32 capacity = hash_map_group_size;
+		while(_max_elements(capacity) < count)
+			capacity *= 2;
+
+		return capacity;
+	}
+
+	static u8 _tag(u64 hash)
+	{
+		return static_cast<u8>(hash >> 57);
+	}
+
+	u32 _find_slot(const K& key, u64 hash) const
+	{
+		if(!slot_capacity)
+			return invalid_slot;
+
+		const u32 group_mask = slot_capacity / hash_map_group_size - 1;
+		const u8 tag = _tag(hash);
+		u32 group = static_cast<u32>(hash) & group_mask;
+		for(u32 probe = 1;; probe++) {
+			const u8* group_controls = controls + group * hash_map_group_size;
+			for(u32 match = hash_map_group_match(group_controls, tag); match; match &= match - 1) {
+				const u32 slot = group * hash_map_group_size + static_cast<u32>(std::countr_zero(match));
+				if(slots[slot].key == key)
+					return slot;
+			}
+
+			//A group with an empty slot ends the probe sequences which went through it
+			if(hash_map_group_match(group_controls, hash_map_control_empty))
+				return invalid_slot;
+
+			group = (group + probe) & group_mask;
+		}
+	}
+
+	//The first free slot of the probe sequence, the table always has one
+	u32 _find_free_slot(u64 hash) const
+	{
+		const u32 group_mask = slot_capacity / hash_map_group_size - 1;
+		u32 group = static_cast<u32>(hash) & group_mask;
+		for(u32 probe = 1;; probe++) {
+			const u32 free_mask = hash_map_group_match_free(controls + group * hash_map_group_size);
+			if(free_mask)
+				return group * hash_map_group_size + static_cast<u32>(std::countr_zero(free_mask));
+
+			group = (group + probe) & group_mask;
+		}
+	}
+
+	//The key is constructed in the new slots, the caller constructs the value when inserted is set
+	V& _find_or_prepare(const K& key, bool* inserted)
+	{
+		const u64 hash = Hash{}(key);
+		const u32 found_slot = _find_slot(key, hash);
+		if(found_slot != invalid_slot) {
+			*inserted = false;
+			return slots[found_slot].value;
+		}
+
+		u32 slot = slot_capacity ? _find_free_slot(hash) : invalid_slot;
+		if(slot == invalid_slot || (controls[slot] == hash_map_control_empty && !growth_left)) {
+			//A table filled mostly by tombstones is rehashed in place, a full one doubles
+			if(!slot_capacity)
+				_rehash(hash_map_group_size);
+			else
+				_rehash(element_count < _max_elements(slot_capacity) / 2 ? slot_capacity : slot_capacity * 2);
+			slot = _find_free_slot(hash);
+		}
+
+		growth_left -= controls[slot] == hash_map_control_empty;
+		controls[slot] = _tag(hash);
+		new (&slots[slot].key) K(key);
+		element_count++;
+		*inserted = true;
+		return slots[slot].value;
+	}
+
+	void _rehash(u32 new_capacity)
+	{
+		u8*    old_controls = controls;
+		_Slot* old_slots    = slots;
+		const u32 old_capacity = slot_capacity;
+
+		//The control bytes and the slots share the same block
+		const u32 slots_offset = (new_capacity + alignof(_Slot) - 1) & ~(static_cast<u32>(alignof(_Slot)) - 1);
+		const u32 alignment = alignof(_Slot) > hash_map_group_size ? alignof(_Slot) : hash_map_group_size;
+		u8* block = static_cast<u8*>(gfx::mem_allocate_aligned(slots_offset + new_capacity * sizeof(_Slot), alignment));
+		controls      = block;
+		slots         = reinterpret_cast<_Slot*>(block + slots_offset);
+		slot_capacity = new_capacity;
+		growth_left   = _max_elements(new_capacity) - element_count;
+		std::memset(controls, hash_map_control_empty, new_capacity);
+
+		for(u32 i = 0; i < old_capacity; i++) {
+			if(old_controls[i] & 0x80)
+				continue;
+
+			const u64 hash = Hash{}(old_slots[i].key);
+			const u32 slot = _find_free_slot(hash);
+			controls[slot] = _tag(hash);
+			new (&slots[slot]) _Slot{ static_cast<K&&>(old_slots[i].key), static_cast<V&&>(old_slots[i].value) };
+			old_slots[i].~_Slot();
+		}
+
+		if(old_controls)
+			gfx::mem_free(old_controls);
+	}
+
+	void _destroy_elements()
+	{
+		if constexpr(!std::is_trivially_destructible_v<K> || !std::is_trivially_destructible_v<V>) {
+			for(u32 i = 0; i < slot_capacity; i++) {
+				if(!(controls[i] & 0x80))
+					slots[i].~_Slot();
+			}
+		}
+	}
+
+	void _destroy()
+	{
+		if(!controls)
+			return;
+
+		_destroy_elements();
+		gfx::mem_free(controls);
+		controls      = nullptr;
+		slots         = nullptr;
+		slot_capacity = 0;
+		element_count = 0;
+		growth_left   = 0;
+	}
+
+	u8*    controls      = nullptr;
+	_Slot* slots         = nullptr;
+	u32    slot_capacity = 0;
+	u32    element_count = 0;
+	//Empty slots which can still be filled before the table goes over 7/8, the tombstones are not counted
+	u32    growth_left   = 0;
+};
+
+//Handle of an element of a SlotMap<T>. The low slot_map_index_bits are the index of the slot, the high
+//ones the generation the slot had when the element was inserted. Removing the element changes the
+//generation, so a stale handle is caught by a single compare. The generation wraps after 4095 removals
+//from the same slot. The zero handle is never given out
+template<typename T>
+struct SlotHandle
+{
+	u32 value = 0;
+
+	bool operator==(SlotHandle handle) const { return value == handle.value; }
+	bool operator!=(SlotHandle handle) const { return value != handle.value; }
+	explicit operator bool() const { return value != 0; }
+};
+
+static constexpr u32 slot_map_index_bits      = 20;
+static constexpr u32 slot_map_max_slots       = 1 << slot_map_index_bits;
+static constexpr u32 slot_map_generation_mask = (1 << (32 - slot_map_index_bits)) - 1;
+
+//Elements are packed in a dense array which can be iterated directly, the slots map the handles to
+//their position in it. Removing swaps the last element into the hole, so the pointers to the elements
+//and their order are not stable, only the handles are. T only needs to be move constructible
+template<typename T>
+class SlotMap
+{
+	//dense_index is invalid_slot while the slot is in the free list, so that a stale handle which matches
+	//the generation of a free slot after a wrap does not resolve
+	struct _Slot
+	{
+		u32 dense_index;
+		u32 generation;
+		u32 next_free_slot;
+	};
+
+	static constexpr u32 invalid_slot = 0xFFFFFFFF;
+public:
+	template<typename... Args>
+	SlotHandle<T> emplace(Args&&... args)
+	{
+		u32 slot_index = free_slot_head;
+		if(slot_index != invalid_slot) {
+			free_slot_head = slots[slot_index].next_free_slot;
+		} else {
+			local_assert(slots.size() < slot_map_max_slots, "the slot map is full");
+			slot_index = slots.size();
+			slots.push_back({ invalid_slot, 1, invalid_slot });
+		}
+
+		_Slot& slot = slots[slot_index];
+		slot.dense_index = dense.size();
+		dense.emplace_back(static_cast<Args&&>(args)...);
+		dense_slots.push_back(slot_index);
+		return { (slot.generation << slot_map_index_bits) | slot_index };
+	}
+
+	SlotHandle<T> insert(const T& value) { return emplace(value); }
+	SlotHandle<T> insert(T&& value)      { return emplace(static_cast<T&&>(value)); }
+
+	//nullptr when the element was removed
+	T* get(SlotHandle<T> handle)
+	{
+		const u32 dense_index = _dense_index(handle);
+		return dense_index != invalid_slot ? &dense[dense_index] : nullptr;
+	}
+
+	const T* get(SlotHandle<T> handle) const
+	{
+		const u32 dense_index = _dense_index(handle);
+		return dense_index != invalid_slot ? &dense[dense_index] : nullptr;
+	}
+
+	bool contains(SlotHandle<T> handle) const
+	{
+		return _dense_index(handle) != invalid_slot;
+	}
+
+	bool remove(SlotHandle<T> handle)
+	{
+		const u32 dense_index = _dense_index(handle);
+		if(dense_index == invalid_slot)
+			return false;
+
+		//T may not be move assignable, the last element is moved into the hole by construction
+		const u32 last_index = dense.size() - 1;
+		if(dense_index != last_index) {
+			dense[dense_index].~T();
+			new (&dense[dense_index]) T(static_cast<T&&>(dense[last_index]));
+			dense_slots[dense_index] = dense_slots[last_index];
+			slots[dense_slots[dense_index]].dense_index = dense_index;
+		}
+		dense.pop_back();
+		dense_slots.pop_back();
+
+		_free_slot(handle.value & (slot_map_max_slots - 1));
+		return true;
+	}
+
+	//Every handle becomes stale, the slots are kept for the next insertions
+	void clear()
+	{
+		for(u32 slot_index : dense_slots)
+			_free_slot(slot_index);
+
+		dense.clear();
+		dense_slots.clear();
+	}
+
+	//Handle of the element at a position of the dense array
+	SlotHandle<T> handle_at(u32 dense_index) const
+	{
+		const u32 slot_index = dense_slots[dense_index];
+		return { (slots[slot_index].generation << slot_map_index_bits) | slot_index };
+	}
+
+	u32  size() const  { return dense.size(); }
+	bool empty() const { return dense.empty(); }
+
+	T&       operator[](u32 dense_index)       { return dense[dense_index]; }
+	const T& operator[](u32 dense_index) const { return dense[dense_index]; }
+
+	T*       begin()       { return dense.begin(); }
+	const T* begin() const { return dense.begin(); }
+	T*       end()         { return dense.end(); }
+	const T* end() const   { return dense.end(); }
+
+private:
+	u32 _dense_index(SlotHandle<T> handle) const
+	{
+		const u32 slot_index = handle.value & (slot_map_max_slots - 1);
+		if(slot_index >= slots.size())
+			return invalid_slot;
+
+		const _Slot& slot = slots[slot_index];
+		return slot.generation == handle.value >> slot_map_index_bits ? slot.dense_index : invalid_slot;
+	}
+
+	void _free_slot(u32 slot_index)
+	{
+		_Slot& slot = slots[slot_index];
+		//The generation zero is skipped so that the zero handle stays invalid
+		slot.generation = (slot.generation + 1) & slot_map_generation_mask;
+		if(!slot.generation)
+			slot.generation = 1;
+
+		slot.dense_index    = invalid_slot;
+		slot.next_free_slot = free_slot_head;
+		free_slot_head      = slot_index;
+	}
+
+	DynamicArray<T>     dense;
+	//Slot of each element of dense
+	DynamicArray<u32>   dense_slots;
+	DynamicArray<_Slot> slots;
+	u32 free_slot_head = invalid_slot;
+};
+
+//Bounded ring buffer with a single producer and a single consumer thread. The capacity needs to be a
+//power of two, the storage comes from the gfx allocator. Producer and consumer own a cache line each
+//with their index and a cached copy of the other one, which is reloaded only when the queue looks full
+//or empty. Push and pop never wait, they return false instead, the batch versions move as many elements
+//as fit with one release store
+template<typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(u32 capacity) : queue_capacity(capacity), mask(capacity - 1)
+	{
+		local_assert(capacity && (capacity & (capacity - 1)) == 0 && capacity <= (1u << 31), "the capacity needs to be a power of two");
+		values = static_cast<T*>(gfx::mem_allocate_aligned(capacity * sizeof(T), alignof(T) > gfx::cache_line_size ? alignof(T) : gfx::cache_line_size));
+	}
+
+	~SpscQueue()
+	{
+		const u32 tail = producer.tail.load(std::memory_order_acquire);
+		for(u32 head = consumer.head.load(std::memory_order_relaxed); head != tail; head++)
+			values[head & mask].~T();
+
+		gfx::mem_free(values);
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	bool try_push(const T& value) { return try_emplace(value); }
+	bool try_push(T&& value)      { return try_emplace(static_cast<T&&>(value)); }
+
+	template<typename... Args>
+	bool try_emplace(Args&&... args)
+	{
+		const u32 tail = producer.tail.load(std::memory_order_relaxed);
+		if(tail - producer.cached_head == queue_capacity) {
+			producer.cached_head = consumer.head.load(std::memory_order_acquire);
+			if(tail - producer.cached_head == queue_capacity)
+				return false;
+		}
+
+		new (&values[tail & mask]) T(static_cast<Args&&>(args)...);
+		producer.tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Number of elements pushed, from the front of batch
+	u32 try_push_batch(const T* batch, u32 count)
+	{
+		const u32 tail = producer.tail.load(std::memory_order_relaxed);
+		u32 free_count = queue_capacity - (tail - producer.cached_head);
+		if(free_count < count) {
+			producer.cached_head = consumer.head.load(std::memory_order_acquire);
+			free_count = queue_capacity - (tail - producer.cached_head);
+		}
+
+		const u32 pushed = count < free_count ? count : free_count;
+		for(u32 i = 0; i < pushed; i++)
+			new (&values[(tail + i) & mask]) T(batch[i]);
+
+		producer.tail.store(tail + pushed, std::memory_order_release);
+		return pushed;
+	}
+
+	bool try_pop(T* value)
+	{
+		const u32 head = consumer.head.load(std::memory_order_relaxed);
+		if(head == consumer.cached_tail) {
+			consumer.cached_tail = producer.tail.load(std::memory_order_acquire);
+			if(head == consumer.cached_tail)
+				return false;
+		}
+
+		T& stored_value = values[head & mask];
+		*value = static_cast<T&&>(stored_value);
+		stored_value.~T();
+		consumer.head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Number of elements written to the front of batch
+	u32 try_pop_batch(T* batch, u32 max_count)
+	{
+		const u32 head = consumer.head.load(std::memory_order_relaxed);
+		u32 ready_count = consumer.cached_tail - head;
+		if(ready_count < max_count) {
+			consumer.cached_tail = producer.tail.load(std::memory_order_acquire);
+			ready_count = consumer.cached_tail - head;
+		}
+
+		const u32 popped = max_count < ready_count ? max_count : ready_count;
+		for(u32 i = 0; i < popped; i++) {
+			T& stored_value = values[(head + i) & mask];
+			batch[i] = static_cast<T&&>(stored_value);
+			stored_value.~T();
+		}
+
+		consumer.head.store(head + popped, std::memory_order_release);
+		return popped;
+	}
+
+	//Exact only when called by the producer or the consumer while the other one is idle
+	u32 size_approx() const
+	{
+		return producer.tail.load(std::memory_order_acquire) - consumer.head.load(std::memory_order_acquire);
+	}
+
+	u32 capacity() const { return queue_capacity; }
+
+private:
+	struct alignas(gfx::cache_line_size) _ProducerState
+	{
+		std::atomic<u32> tail{0};
+		u32 cached_head = 0;
+	};
+
+	struct alignas(gfx::cache_line_size) _ConsumerState
+	{
+		std::atomic<u32> head{0};
+		u32 cached_tail = 0;
+	};
+
+	//Only read after the construction, they share the line with the other members of the owner
+	T*  values = nullptr;
+	u32 queue_capacity;
+	u32 mask;
+	_ProducerState producer;
+	_ConsumerState consumer;
+};
+
+//Bounded ring buffer with any number of producer threads and a single consumer thread, every cell has a
+//sequence number which tells whether it can be written or read on the current lap. The producers claim
+//cells with a compare exchange on the tail, so pushing is lock-free, popping never waits. The batch
+//push claims a run of cells with a single compare exchange, halving it while the last cell is still
+//taken. The capacity needs to be a power of two, the cells come from the gfx allocator
+template<typename T>
+class MpscQueue
+{
+	struct _Cell
+	{
+		std::atomic<u32> sequence;
+		alignas(T) u8 storage[sizeof(T)];
+
+		T* value() { return reinterpret_cast<T*>(storage); }
+	};
+public:
+	explicit MpscQueue(u32 capacity) : queue_capacity(capacity), mask(capacity - 1)
+	{
+		local_assert(capacity && (capacity & (capacity - 1)) == 0 && capacity <= (1u << 31), "the capacity needs to be a power of two");
+		cells = static_cast<_Cell*>(gfx::mem_allocate_aligned(capacity * sizeof(_Cell), alignof(_Cell) > gfx::cache_line_size ? alignof(_Cell) : gfx::cache_line_size));
+		for(u32 i = 0; i < capacity; i++)
+			new (&cells[i].sequence) std::atomic<u32>(i);
+	}
+
+	~MpscQueue()
+	{
+		for(u32 head = consumer.head;; head++) {
+			_Cell& cell = cells[head & mask];
+			if(cell.sequence.load(std::memory_order_acquire) != head + 1)
+				break;
+
+			cell.value()->~T();
+			cell.sequence.store(head + queue_capacity, std::memory_order_relaxed);
+		}
+
+		gfx::mem_free(cells);
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	bool try_push(const T& value) { return try_emplace(value); }
+	bool try_push(T&& value)      { return try_emplace(static_cast<T&&>(value)); }
+
+	template<typename... Args>
+	bool try_emplace(Args&&... args)
+	{
+		u32 tail = producer.tail.load(std::memory_order_relaxed);
+		for(;;) {
+			_Cell& cell = cells[tail & mask];
+			const s32 difference = static_cast<s32>(cell.sequence.load(std::memory_order_acquire) - tail);
+			if(difference == 0) {
+				if(producer.tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+					new (cell.storage) T(static_cast<Args&&>(args)...);
+					cell.sequence.store(tail + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(difference < 0) {
+				//The consumer did not read this cell on the previous lap yet
+				return false;
+			} else {
+				tail = producer.tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//Number of elements pushed, from the front of batch. They stay contiguous in the queue
+	u32 try_push_batch(const T* batch, u32 count)
+	{
+		if(!count)
+			return 0;
+
+		u32 tail = producer.tail.load(std::memory_order_relaxed);
+		for(;;) {
+			//The cells are freed in order, when the last one of the run can be written the others can too
+			u32 run = count < queue_capacity ? count : queue_capacity;
+			s32 difference = 0;
+			for(;;) {
+				const u32 last = tail + run - 1;
+				difference = static_cast<s32>(cells[last & mask].sequence.load(std::memory_order_acquire) - last);
+				if(difference >= 0 || run == 1)
+					break;
+
+				run /= 2;
+			}
+
+			if(difference == 0) {
+				if(producer.tail.compare_exchange_weak(tail, tail + run, std::memory_order_relaxed)) {
+					for(u32 i = 0; i < run; i++) {
+						_Cell& cell = cells[(tail + i) & mask];
+						new (cell.storage) T(batch[i]);
+						cell.sequence.store(tail + i + 1, std::memory_order_release);
+					}
+					return run;
+				}
+			} else if(difference < 0) {
+				return 0;
+			} else {
+				tail = producer.tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//Consumer thread only
+	bool try_pop(T* value)
+	{
+		const u32 head = consumer.head;
+		_Cell& cell = cells[head & mask];
+		if(cell.sequence.load(std::memory_order_acquire) != head + 1)
+			return false;
+
+		*value = static_cast<T&&>(*cell.value());
+		cell.value()->~T();
+		cell.sequence.store(head + queue_capacity, std::memory_order_release);
+		consumer.head = head + 1;
+		return true;
+	}
+
+	//Stops at the first cell which is claimed but not written yet, number of elements written to batch
+	u32 try_pop_batch(T* batch, u32 max_count)
+	{
+		u32 popped = 0;
+		while(popped < max_count && try_pop(&batch[popped]))
+			popped++;
+
+		return popped;
+	}
+
+	u32 capacity() const { return queue_capacity; }
+
+private:
+	struct alignas(gfx::cache_line_size) _ProducerState
+	{
+		std::atomic<u32> tail{0};
+	};
+
+	struct alignas(gfx::cache_line_size) _ConsumerState
+	{
+		u32 head = 0;
+	};
+
+	_Cell* cells = nullptr;
+	u32 queue_capacity;
+	u32 mask;
+	_ProducerState producer;
+	_ConsumerState consumer;
+};
+
+using String = GenericString<char>;
+
+//Builds a string in the temporary storage without going through iostreams or locales. The numbers are
+//written with std::to_chars, floats in their shortest round trip form. append_many reserves the upper
+//bound of all its arguments first, so a chain of appends grows the buffer at most once.
+//A buffer on top of the temporary storage grows in place and is released by the destructor, one left
+//behind by other temporary allocations stays there until the enclosing TemporaryScope ends. Like the rest
+//of the temporary storage a builder belongs to the thread which created it
+class StringBuilder
+{
+public:
+	explicit StringBuilder(u32 initial_capacity = 256);
+	~StringBuilder();
+	StringBuilder(const StringBuilder&) = delete;
+	StringBuilder& operator=(const StringBuilder&) = delete;
+
+	StringBuilder& append(char c)
+	{
+		reserve(builder_size + 1);
+		buffer[builder_size++] = c;
+		return *this;
+	}
+
+	StringBuilder& append(StringView view)
+	{
+		reserve(builder_size + view.size());
+		std::memcpy(buffer + builder_size, view.data(), view.size());
+		builder_size += view.size();
+		return *this;
+	}
+
+	StringBuilder& append(const char* string) { return append(StringView(string)); }
+	StringBuilder& append(const String& string) { return append(StringView(string.data(), string.size())); }
+	StringBuilder& append(bool value) { return append(value ? StringView("true", 4) : StringView("false", 5)); }
+
+	template<typename T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>, int> = 0>
+	StringBuilder& append(T value)
+	{
+		reserve(builder_size + _max_size(value));
+		_append_number(value);
+		return *this;
+	}
+
+	//Fixed notation with precision digits after the point
+	StringBuilder& append_fixed(f64 value, u32 precision);
+
+	template<typename... Args>
+	StringBuilder& append_many(const Args&... args)
+	{
+		return _append_pieces(_piece(args)...);
+	}
+
+	void reserve(u32 capacity)
+	{
+		//One more character for the terminator of c_str
+		if(capacity + 1 > builder_capacity)
+			_grow(capacity + 1);
+	}
+
+	void clear() { builder_size = 0; }
+
+	StringView view() const { return StringView(buffer, builder_size); }
+	String to_string() const { return String(buffer, builder_size); }
+	const char* c_str() const
+	{
+		buffer[builder_size] = 0;
+		return buffer;
+	}
+
+	u32  size() const  { return builder_size; }
+	bool empty() const { return builder_size == 0; }
+
+private:
+	void _grow(u32 capacity);
+
+	static u32 _max_size(char)            { return 1; }
+	static u32 _max_size(bool)            { return 5; }
+	static u32 _max_size(StringView view) { return view.size(); }
+
+	//Sign and digits of a 64 bit integer, the longest shortest round trip double is 24 characters
+	template<typename T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>, int> = 0>
+	static u32 _max_size(T)
+	{
+		return std::is_integral_v<T> ? 20 : 32;
+	}
+
+	template<typename T>
+	void _append_number(T value)
+	{
+		const std::to_chars_result result = std::to_chars(buffer + builder_size, buffer + builder_capacity - 1, value);
+		builder_size = static_cast<u32>(result.ptr - buffer);
+	}
+
+	//The arguments of append_many become numbers or views first, so that the C strings are measured once
+	template<typename T>
+	static auto _piece(const T& value)
+	{
+		if constexpr(std::is_arithmetic_v<T>)
+			return value;
+		else
+			return StringView(value);
+	}
+
+	template<typename... Pieces>
+	StringBuilder& _append_pieces(const Pieces&... pieces)
+	{
+		reserve(builder_size + (0 + ... + _max_size(pieces)));
+		(_append_reserved(pieces), ...);
+		return *this;
+	}
+
+	template<typename T>
+	void _append_reserved(const T& piece)
+	{
+		if constexpr(std::is_same_v<T, char>) {
+			buffer[builder_size++] = piece;
+		} else if constexpr(std::is_same_v<T, bool>) {
+			_append_reserved(piece ? StringView("true", 4) : StringView("false", 5));
+		} else if constexpr(std::is_arithmetic_v<T>) {
+			_append_number(piece);
+		} else {
+			std::memcpy(buffer + builder_size, piece.data(), piece.size());
+			builder_size += piece.size();
+		}
+	}
+
+	char* buffer           = nullptr;
+	u32   builder_size     = 0;
+	u32   builder_capacity = 0;
+	//Top of the temporary storage right after the current buffer, zero when the buffers come from the heap
+	gfx::TemporaryMarker end_marker = {};
+};
 
 namespace gfx {
 	void test_string();
+	void test_atoms();
+	void test_arrays();
+	void test_hash_map();
+	void test_string_builder();
+	void test_slot_map();
+	void test_queues();
+
+	//Runs every test above, like memory_run_tests
+	void containers_run_tests();
 }
 
 #undef local_assert
\ No newline at end of file
@@ -2,10 +2,10 @@
 #include <format>
 #include <iostream>
 
-#define log_message(msg, ...) std::cout << std::format(msg, __VA_ARGS__)
+#define log_message(msg, ...) std::cout << std::format(msg, ##__VA_ARGS__)
 
 #ifdef _DEBUG
-#	define log_message_debug(msg, ...) std::cout << std::format(msg, __VA_ARGS__)
+#	define log_message_debug(msg, ...) std::cout << std::format(msg, ##__VA_ARGS__)
 #else
 #	define log_message_debug(msg, ...)
 #endif
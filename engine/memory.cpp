@@ -1,12 +1,59 @@
 #include "memory.h"
-#include "MainIncl.h"
+#include "macros.h"
+#include <cstring>
+#include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef WINDOWS_OS
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#	include <sys/stat.h>
+#elif defined LINUX_OS
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <execinfo.h>
+#	include <cxxabi.h>
+//Linux 5.14, older headers do not define it and older kernels reject it
+#	ifndef MADV_POPULATE_WRITE
+#		define MADV_POPULATE_WRITE 23
+#	endif
+#else
+	static_assert(false, "This OS is not supported");
+#endif
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#elif defined(__SSE4_2__)
+#	include <nmmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#	define MEMORY_NOINLINE __declspec(noinline)
+#else
+#	define MEMORY_NOINLINE __attribute__((noinline))
+#endif
 
 gfx::Allocator* g_engine_allocator = nullptr;
 std::mutex      g_engine_allocator_mutex;
 
 namespace gfx
 {
+	//Defined with the allocator, the segment tree reserves the storage of its nodes with them
+	static MemoryStorage storage_create(u64 bytes, bool huge_pages = false);
+	static void storage_cleanup(MemoryStorage* storage);
+	static bool storage_commit(MemoryStorage* storage, u64 bytes);
 
 	static _Node* grandparent(_Node* node)
 	{
@@ -23,28 +70,45 @@ namespace gfx
 		return grandparent(node)->left;
 	}
 
-	static _Node* sibling(_Node* node)
+	static _NodeColor get_node_color(_Node* node)
+	{
+		if(!node) return NODE_COLOR_BLACK;
+		return node->color;
+	}
+
+	//Recomputes the augmented data of the node, assuming the one of the children is already valid
+	static void update_subtree_info(_Node* node)
 	{
-		//assert(node->parent, "no sibling can be found without a defined parent");
-		if(!node->parent)
-			return nullptr;
+		const u64 node_end = node->segment.start + node->segment.size;
+		u64 max_gap = 0;
+
+		node->subtree_start = node->segment.start;
+		node->subtree_end   = node_end;
+
+		if(node->left) {
+			const u64 gap_before_node = node->segment.start - node->left->subtree_end;
+			node->subtree_start = node->left->subtree_start;
+			max_gap = node->left->subtree_max_gap > gap_before_node ? node->left->subtree_max_gap : gap_before_node;
+		}
 
-		if(node->parent->left == node) {
-			return node->parent->right;
+		if(node->right) {
+			const u64 gap_after_node = node->right->subtree_start - node_end;
+			node->subtree_end = node->right->subtree_end;
+			if(gap_after_node > max_gap)                max_gap = gap_after_node;
+			if(node->right->subtree_max_gap > max_gap)  max_gap = node->right->subtree_max_gap;
 		}
 
-		return node->parent->left;
+		node->subtree_max_gap = max_gap;
 	}
 
-	static _NodeColor get_node_color(_Node* node)
+	static void update_subtree_info_up_to_root(_Node* node)
 	{
-		if(!node) return NODE_COLOR_BLACK;
-		return node->color;
+		for(; node; node = node->parent)
+			update_subtree_info(node);
 	}
 
-	static _Node* rotate_right(_Node* node)
+	void SegmentTree::rotate_right(_Node* node)
 	{
-
 		if(node->parent) {
 			if(node == node->parent->left) {
 				node->parent->left = node->left;
@@ -62,10 +126,13 @@ namespace gfx
 		rotated->right->left = old_right;
 		if(old_right) old_right->parent = node;
 
-		return rotated;
+		//The old node is now a child of the rotated one, so it needs to be updated first
+		update_subtree_info(node);
+		update_subtree_info(rotated);
+		if(!rotated->parent) root = rotated;
 	}
 
-	static _Node* rotate_left(_Node* node)
+	void SegmentTree::rotate_left(_Node* node)
 	{
 		if(node->parent) {
 			if(node == node->parent->left) {
@@ -84,7 +151,9 @@ namespace gfx
 		rotated->left->right = old_left;
 		if(old_left) old_left->parent = node;
 
-		return rotated;
+		update_subtree_info(node);
+		update_subtree_info(rotated);
+		if(!rotated->parent) root = rotated;
 	}
 
 
@@ -125,20 +194,62 @@ namespace gfx
 		grandparent(node)->color = NODE_COLOR_RED;
 
 		if(node == node->parent->left && node->parent == grandparent(node)->left) {
-			auto new_node = rotate_right(grandparent(node));
-			if(!new_node->parent) root = new_node;
+			rotate_right(grandparent(node));
 		} else {
-			auto new_node = rotate_left(grandparent(node));
-			if(!new_node->parent) root = new_node;
+			rotate_left(grandparent(node));
+		}
+	}
+
+	SegmentTree::SegmentTree(SegmentTree&& right) noexcept
+	{
+		operator=(static_cast<SegmentTree&&>(right));
+	}
+
+	SegmentTree& SegmentTree::operator=(SegmentTree&& right) noexcept
+	{
+		cleanup();
+
+		root         = right.root;
+		node_storage = right.node_storage;
+		nodes_used   = right.nodes_used;
+		free_nodes   = right.free_nodes;
+
+		right.root         = nullptr;
+		right.node_storage = {};
+		right.nodes_used   = 0;
+		right.free_nodes   = nullptr;
+		return *this;
+	}
+
+	_Node* SegmentTree::allocate_node()
+	{
+		if(free_nodes) {
+			_Node* node = free_nodes;
+			free_nodes = node->parent;
+			return node;
 		}
+
+		if(!node_storage.buffer)
+			node_storage = storage_create(static_cast<u64>(segment_tree_max_nodes) * sizeof(_Node));
+
+		assert(nodes_used < segment_tree_max_nodes, "the segment tree is full\n");
+		bool committed = storage_commit(&node_storage, static_cast<u64>(nodes_used + 1) * sizeof(_Node));
+		assert(committed, "could not commit the nodes of the segment tree\n");
+		return static_cast<_Node*>(node_storage.buffer) + nodes_used++;
+	}
+
+	void SegmentTree::free_node(_Node* node)
+	{
+		node->parent = free_nodes;
+		free_nodes = node;
 	}
 
-	void SegmentTree::add_node(u32 start, u32 size)
+	_Node* SegmentTree::add_node(u64 start, u64 size)
 	{
 		_Node* parent = nullptr;
 		_Node** iterator = find_place_to_insert_node(start, &parent);
 
-		*iterator = new _Node;
+		*iterator = allocate_node();
 		std::memset(*iterator, 0, sizeof(_Node));
 		_Node* current_node = *iterator;
 
@@ -148,14 +259,17 @@ namespace gfx
 		current_node->segment.start = start;
 		current_node->segment.size  = size;
 
-		tree_insert_check(*iterator);
+		//The gap information needs to be valid before the rotations, which only update the rotated nodes
+		update_subtree_info_up_to_root(current_node);
+		tree_insert_check(current_node);
+		return current_node;
 	}
 
-	_Node** SegmentTree::find_place_to_insert_node(u32 start, _Node** parent)
+	_Node** SegmentTree::find_place_to_insert_node(u64 start, _Node** parent)
 	{
 		_Node** iterator = &root;
 		while(*iterator) {
-			u32 segment_start = (*iterator)->segment.start;
+			u64 segment_start = (*iterator)->segment.start;
 			assert(start != segment_start, "cannot allocate a new segment of memory where another one is already defined, check the memory declaration");
 			if(segment_start > start) {
 				if(parent) *parent = *iterator;
@@ -169,11 +283,11 @@ namespace gfx
 		return iterator;
 	}
 
-	_Node* SegmentTree::find_node(u32 start)
+	_Node* SegmentTree::find_node(u64 start)
 	{
 		_Node** iterator = &root;
 		while(*iterator) {
-			u32 segment_start = (*iterator)->segment.start;
+			u64 segment_start = (*iterator)->segment.start;
 
 			if((*iterator)->segment.start == start)
 				return *iterator;
@@ -210,186 +324,217 @@ namespace gfx
 		return iter;
 	}
 
-	void SegmentTree::remove_node(u32 start)
+	static u64 align_up(u64 value, u64 alignment)
 	{
-		_Node* parent = nullptr;
-		_Node* iterator = find_node(start);
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
 
-		auto current_node = iterator;
+	static bool hole_fits(u64 hole_start, u64 hole_end, u64 bytes, u64 alignment)
+	{
+		u64 aligned_start = align_up(hole_start, alignment);
+		return aligned_start <= hole_end && hole_end - aligned_start >= bytes;
+	}
 
-		//The node to delete does not exist, just exit
-		if(!current_node) return;
-		_Node* node_to_delete = nullptr;
+	bool SegmentTree::find_first_fit(u64 bytes, u64* start, u64 alignment) const
+	{
+		assert(alignment != 0 && (alignment & (alignment - 1)) == 0, "the alignment needs to be a power of two");
+		if(!root) return false;
 
-		if(!current_node->left || !current_node->right) {
-			//In the case in which both of the nodes are null, null gets yielded, which is fine
-			auto replaced_node = current_node->left ? current_node->left : current_node->right;
+		//The space before the first segment is not tracked by any node
+		if(root->subtree_start >= bytes) {
+			*start = 0;
+			return true;
+		}
 
-			//The null nodes are considered black by default
-			if(replaced_node) {
-				node_to_delete = replaced_node;
-				current_node->segment = replaced_node->segment;
-			} else {
-				node_to_delete = current_node;
+		if(root->subtree_max_gap < bytes) return false;
+
+		//The holes are visited in address order, the ones in the left subtree come first, then the one
+		//right before the node, the one right after the node and lastly the ones in the right subtree.
+		//We only descend in subtrees which are known to contain a big enough hole
+		const u64 required_subtree_gap = bytes + alignment - 1;
+		const _Node* node = root;
+		while(node) {
+			const _Node* left  = node->left;
+			const _Node* right = node->right;
+			const u64 node_end = node->segment.start + node->segment.size;
+
+			if(left && left->subtree_max_gap >= required_subtree_gap) {
+				node = left;
+				continue;
 			}
-		} else {
-			auto lowest_in_right_subtree = current_node->right;
-			bool has_the_right_son_one_single_child = true;
 
-			while(lowest_in_right_subtree->left) {
-				lowest_in_right_subtree = lowest_in_right_subtree->left;
-				has_the_right_son_one_single_child = false;
+			if(left && hole_fits(left->subtree_end, node->segment.start, bytes, alignment)) {
+				*start = align_up(left->subtree_end, alignment);
+				return true;
 			}
 
-			node_to_delete = lowest_in_right_subtree;
-			current_node->segment = lowest_in_right_subtree->segment;
+			if(right && hole_fits(node_end, right->subtree_start, bytes, alignment)) {
+				*start = align_up(node_end, alignment);
+				return true;
+			}
+
+			node = (right && right->subtree_max_gap >= required_subtree_gap) ? right : nullptr;
 		}
 
-		assert(node_to_delete, "there was an implementation problem if the node here is null");
-		tree_delete_check(node_to_delete, true);
+		//Aligned requests can skip holes which only fit the bytes with the right padding
+		assert(alignment > 1, "the gap information stored in the tree is not consistent");
+		return false;
 	}
 
-	static void red_black_tree_delete(_Node* node)
+	void SegmentTree::resize_node(_Node* node, u64 size)
 	{
-		if(!node) return;
+		assert(node && size != 0, "a segment can't be resized to zero bytes");
+		node->segment.size = size;
+		update_subtree_info_up_to_root(node);
+	}
 
-		red_black_tree_delete(node->left);
-		red_black_tree_delete(node->right);
-		delete node;
+	void SegmentTree::move_node(_Node* node, u64 start)
+	{
+		assert(node, "the node needs to be defined");
+		node->segment.start = start;
+		update_subtree_info_up_to_root(node);
 	}
 
-	static void node_removal_utility(_Node* node_to_delete, bool perform_deletion)
+	_Node* SegmentTree::find_lower_bound_node(u64 start)
 	{
-		if(!perform_deletion) {
-			if(node_to_delete->color & NODE_COLOR_DOUBLE_BLACK) {
-				node_to_delete->color = NODE_COLOR_BLACK;
+		_Node* lower_bound = nullptr;
+		_Node* iterator = root;
+		while(iterator) {
+			if(iterator->segment.start >= start) {
+				lower_bound = iterator;
+				iterator = iterator->left;
+			} else {
+				iterator = iterator->right;
 			}
-
-			return;
-		}
-
-		if(node_to_delete->parent) {
-			if(node_to_delete->parent->left == node_to_delete)
-				node_to_delete->parent->left = nullptr;
-			else
-				node_to_delete->parent->right = nullptr;
 		}
 
-		delete node_to_delete;
-	}
-
-	void SegmentTree::cleanup()
-	{
-		red_black_tree_delete(root);
-		root = nullptr;
+		return lower_bound;
 	}
 
-	void SegmentTree::tree_delete_check(_Node* node_to_delete, bool perform_deletion)
+	void SegmentTree::remove_node(u64 start)
 	{
-		auto node_sibling = sibling(node_to_delete);
-		if(!node_to_delete->left && !node_to_delete->right && get_node_color(node_to_delete) & NODE_COLOR_RED) {
-			node_removal_utility(node_to_delete, perform_deletion);
-			return;
-		}
+		_Node* current_node = find_node(start);
 
-		if(!node_to_delete->parent && perform_deletion) {
-			//This was the last node, reset tree
-			root = nullptr;
-			assert(perform_deletion, "there should not be no way this flag is false when we have only one node");
-			node_removal_utility(node_to_delete, perform_deletion);
-			return;
-		}
+		//The node to delete does not exist, just exit
+		if(!current_node) return;
 
-		if(!node_sibling) {
-			if(node_to_delete->color == NODE_COLOR_DOUBLE_BLACK)
-				node_to_delete->color = NODE_COLOR_BLACK;
+		//A node with two children takes the segment of its in-order successor, which has at most one
+		//child and can be unlinked instead
+		if(current_node->left && current_node->right) {
+			auto lowest_in_right_subtree = current_node->right;
+			while(lowest_in_right_subtree->left)
+				lowest_in_right_subtree = lowest_in_right_subtree->left;
 
-			return;
+			current_node->segment = lowest_in_right_subtree->segment;
+			current_node->tag     = lowest_in_right_subtree->tag;
+			current_node->handle  = lowest_in_right_subtree->handle;
+			current_node = lowest_in_right_subtree;
 		}
 
-		if(get_node_color(node_sibling) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_BLACK && get_node_color(node_sibling->left) & NODE_COLOR_BLACK) {
-			auto parent_color   = node_sibling->parent->color;
-			node_sibling->color = NODE_COLOR_RED;
+		_Node* node_to_delete = current_node;
+		_Node* replaced_node  = node_to_delete->left ? node_to_delete->left : node_to_delete->right;
+		_Node* parent         = node_to_delete->parent;
 
-			if(parent_color & NODE_COLOR_RED) {
-				node_sibling->parent->color = NODE_COLOR_BLACK;
-				node_removal_utility(node_to_delete, perform_deletion);
-			} else {
-				//Black or double black
-				node_sibling->parent->color = NODE_COLOR_DOUBLE_BLACK;
-				node_removal_utility(node_to_delete, perform_deletion);
-				tree_delete_check(node_sibling->parent, false);
-			}
+		if(replaced_node)
+			replaced_node->parent = parent;
 
-			return;
+		if(!parent) {
+			root = replaced_node;
+		} else if(parent->left == node_to_delete) {
+			parent->left = replaced_node;
+		} else {
+			parent->right = replaced_node;
 		}
 
-		if(get_node_color(node_sibling) & NODE_COLOR_RED) {
-			auto temp_color             = node_sibling->parent->color;
-			node_sibling->parent->color = node_sibling->color;
-			node_sibling->color         = temp_color;
+		//The node which eventually received the successor segment is an ancestor of the unlinked one,
+		//so this also refreshes its gap information
+		update_subtree_info_up_to_root(parent);
 
-			if(node_sibling == node_sibling->parent->left) {
-				auto new_node = rotate_right(node_sibling->parent);
-				if(!new_node->parent)
-					root = new_node;
-				tree_delete_check(node_to_delete, true);
-			}
-			//INFO @C7 node sibling could be the new root node here, so make sure it still has a parent
-			if(node_sibling->parent && node_sibling == node_sibling->parent->right) {
-				auto new_node = rotate_left(node_sibling->parent);
-				if(!new_node->parent)
-					root = new_node;
-				tree_delete_check(node_to_delete, true);
-			}
+		//Removing a red node does not change the black height of any path
+		if(node_to_delete->color & NODE_COLOR_BLACK)
+			tree_delete_check(replaced_node, parent);
 
-			return;
-		}
+		free_node(node_to_delete);
+	}
 
-		if(node_sibling == node_sibling->parent->left) {
-			//Case 5
-			if(get_node_color(node_sibling) & NODE_COLOR_BLACK && get_node_color(node_sibling->left) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_RED) {
-				node_sibling->right->color = node_sibling->color;
-				node_sibling->color        = NODE_COLOR_RED;
+	void SegmentTree::cleanup()
+	{
+		//The nodes do not own anything, so releasing the reservation is enough
+		if(node_storage.buffer)
+			storage_cleanup(&node_storage);
 
-				rotate_right(node_sibling->parent);
-			}
-			//Case 6
-			if(get_node_color(node_sibling) & NODE_COLOR_BLACK && get_node_color(node_sibling->left) & NODE_COLOR_RED) {
-				auto temp_color             = node_sibling->parent->color;
-				node_sibling->parent->color = node_sibling->color;
-				node_sibling->color         = temp_color;
+		root       = nullptr;
+		nodes_used = 0;
+		free_nodes = nullptr;
+	}
 
-				node_sibling->left->color   = NODE_COLOR_BLACK;
+	//The node passed carries an extra black that needs to be pushed up the tree or absorbed by a red node
+	void SegmentTree::tree_delete_check(_Node* node, _Node* parent)
+	{
+		while(node != root && get_node_color(node) & NODE_COLOR_BLACK) {
+			if(node == parent->left) {
+				_Node* node_sibling = parent->right;
+
+				if(get_node_color(node_sibling) & NODE_COLOR_RED) {
+					node_sibling->color = NODE_COLOR_BLACK;
+					parent->color       = NODE_COLOR_RED;
+					rotate_left(parent);
+					node_sibling = parent->right;
+				}
 
-				rotate_right(node_sibling->parent);
-			}
+				if(get_node_color(node_sibling->left) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_BLACK) {
+					node_sibling->color = NODE_COLOR_RED;
+					node   = parent;
+					parent = node->parent;
+					continue;
+				}
 
-		} else {
-		//Case 5
-			if(get_node_color(node_sibling) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_BLACK && get_node_color(node_sibling->left) & NODE_COLOR_RED) {
-				node_sibling->left->color = node_sibling->color;
-				node_sibling->color       = NODE_COLOR_RED;
+				if(get_node_color(node_sibling->right) & NODE_COLOR_BLACK) {
+					node_sibling->left->color = NODE_COLOR_BLACK;
+					node_sibling->color       = NODE_COLOR_RED;
+					rotate_right(node_sibling);
+					node_sibling = parent->right;
+				}
 
-				rotate_left(node_sibling->parent);
-			}
+				node_sibling->color        = parent->color;
+				parent->color              = NODE_COLOR_BLACK;
+				node_sibling->right->color = NODE_COLOR_BLACK;
+				rotate_left(parent);
+				node = root;
+			} else {
+				_Node* node_sibling = parent->left;
+
+				if(get_node_color(node_sibling) & NODE_COLOR_RED) {
+					node_sibling->color = NODE_COLOR_BLACK;
+					parent->color       = NODE_COLOR_RED;
+					rotate_right(parent);
+					node_sibling = parent->left;
+				}
 
-			//Case 6
-			if(get_node_color(node_sibling) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_RED) {
-				auto temp_color             = node_sibling->parent->color;
-				node_sibling->parent->color = node_sibling->color;
-				node_sibling->color         = temp_color;
+				if(get_node_color(node_sibling->left) & NODE_COLOR_BLACK && get_node_color(node_sibling->right) & NODE_COLOR_BLACK) {
+					node_sibling->color = NODE_COLOR_RED;
+					node   = parent;
+					parent = node->parent;
+					continue;
+				}
 
-				node_sibling->right->color  = NODE_COLOR_BLACK;
+				if(get_node_color(node_sibling->left) & NODE_COLOR_BLACK) {
+					node_sibling->right->color = NODE_COLOR_BLACK;
+					node_sibling->color        = NODE_COLOR_RED;
+					rotate_left(node_sibling);
+					node_sibling = parent->left;
+				}
 
-				rotate_left(node_sibling->parent);
+				node_sibling->color       = parent->color;
+				parent->color             = NODE_COLOR_BLACK;
+				node_sibling->left->color = NODE_COLOR_BLACK;
+				rotate_right(parent);
+				node = root;
 			}
 		}
 
-		if (!node_sibling->parent)
-			root = node_sibling;
-
-		node_removal_utility(node_to_delete, perform_deletion);
+		if(node)
+			node->color = NODE_COLOR_BLACK;
 	}
 
 	static _Node* find_next_node(const _Node* node)
@@ -422,8 +567,20 @@ namespace gfx
 
 	static _Node* find_prev_node(const _Node* node)
 	{
-		assert(false, "function still not implemented");
-		return nullptr;
+		if(node->left) {
+			auto iter = node->left;
+			while(iter->right)
+				iter = iter->right;
+
+			return iter;
+		}
+
+		//Climb until the node is found in the right subtree of an ancestor, that ancestor is the predecessor
+		auto iter = node;
+		while(iter->parent && iter->parent->left == iter)
+			iter = iter->parent;
+
+		return iter->parent;
 	}
 
 	static void check_all_paths_have_the_same_amount_of_black_nodes(const _Node* node, u32 check_val, u32 current_val = 0)
@@ -450,9 +607,25 @@ namespace gfx
 		}
 	}
 
+	static void check_subtree_info_is_consistent(const _Node* node)
+	{
+		if(!node) return;
+
+		check_subtree_info_is_consistent(node->left);
+		check_subtree_info_is_consistent(node->right);
+
+		_Node expected = *node;
+		update_subtree_info(&expected);
+		assert(expected.subtree_start == node->subtree_start && expected.subtree_end == node->subtree_end &&
+			expected.subtree_max_gap == node->subtree_max_gap, "the gap information of a subtree is not up to date");
+	}
+
 	void assert_red_black_tree_validity(const SegmentTree& segment_tree)
 	{
 		const auto root = segment_tree.get_root();
+		//An empty tree is always valid
+		if(!root) return;
+
 		assert(root->color & NODE_COLOR_BLACK, "the start of a red black tree requires a black node");
 
 		//If all the black paths need to have the same black lenght, just pick a random path first, measure the black
@@ -465,305 +638,3381 @@ namespace gfx
 
 		check_all_paths_have_the_same_amount_of_black_nodes(root, left_path_black_nodes);
 		check_all_red_nodes_have_black_children(root);
+		check_subtree_info_is_consistent(root);
 	}
 
-	namespace test
+	//Amount of keys lower than value. The unused slots hold segment_btree_key_padding, so the whole
+	//array is compared without looking at the count of the node
+	static u32 btree_count_keys_below(const u64* keys, u64 value)
 	{
-		static void tree_test_code_1()
-		{
-			gfx::SegmentTree this_tree;
-			defer { this_tree.cleanup(); };
-
-			this_tree.add_node(1, 0);
-			this_tree.add_node(2, 0);
-			this_tree.add_node(3, 0);
-			this_tree.add_node(4, 0);
-			this_tree.add_node(5, 0);
-			this_tree.add_node(6, 0);
-			this_tree.add_node(7, 0);
-			this_tree.add_node(8, 0);
-			this_tree.add_node(9, 0);
-			this_tree.add_node(10, 0);
-			this_tree.add_node(20, 0);
-			this_tree.add_node(30, 0);
-
-			this_tree.remove_node(2);
-			this_tree.remove_node(4);
-			this_tree.remove_node(1);
-			this_tree.remove_node(8);
+#if defined(__AVX2__)
+		const __m256i values = _mm256_set1_epi64x(static_cast<s64>(value));
+		u32 count = 0;
+		for(u32 i = 0; i < segment_btree_fanout; i += 4) {
+			const __m256i lower = _mm256_cmpgt_epi64(values, _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i)));
+			count += std::popcount(static_cast<u32>(_mm256_movemask_pd(_mm256_castsi256_pd(lower))));
+		}
 
-			assert_red_black_tree_validity(this_tree);
+		return count;
+#elif defined(__SSE4_2__)
+		const __m128i values = _mm_set1_epi64x(static_cast<s64>(value));
+		u32 count = 0;
+		for(u32 i = 0; i < segment_btree_fanout; i += 2) {
+			const __m128i lower = _mm_cmpgt_epi64(values, _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i)));
+			count += std::popcount(static_cast<u32>(_mm_movemask_pd(_mm_castsi128_pd(lower))));
 		}
 
-		static void tree_test_code_2()
-		{
-			gfx::SegmentTree this_tree;
-			defer { this_tree.cleanup(); };
+		return count;
+#else
+		//Branchless, so that the compiler can vectorize it with whatever instruction set is available
+		u32 count = 0;
+		for(u32 i = 0; i < segment_btree_fanout; i++)
+			count += static_cast<s64>(keys[i]) < static_cast<s64>(value);
 
-			this_tree.add_node(2, 0);
-			this_tree.add_node(1, 0);
-			this_tree.add_node(3, 0);
+		return count;
+#endif
+	}
 
-			this_tree.remove_node(1);
-			this_tree.remove_node(3);
+	//Index of the child whose subtree can contain start
+	static u32 btree_child_index(const _BTreeNode* node, u64 start)
+	{
+		const u32 index = btree_count_keys_below(node->keys, start + 1);
+		return index ? index - 1 : 0;
+	}
 
+	static void btree_update_node_info(_BTreeNode* node)
+	{
+		u64 max_gap = 0;
+		if(node->is_leaf) {
+			for(u32 i = 1; i < node->count; i++) {
+				const u64 gap = node->records[i].segment.start - (node->records[i - 1].segment.start + node->records[i - 1].segment.size);
+				if(gap > max_gap) max_gap = gap;
+			}
 
+			const auto& last = node->records[node->count - 1].segment;
+			node->subtree_start = node->records[0].segment.start;
+			node->subtree_end   = last.start + last.size;
+		} else {
+			for(u32 i = 0; i < node->count; i++) {
+				const _BTreeNode* child = node->children[i];
+				node->keys[i] = child->subtree_start;
+				if(child->subtree_max_gap > max_gap) max_gap = child->subtree_max_gap;
+				if(i && child->subtree_start - node->children[i - 1]->subtree_end > max_gap)
+					max_gap = child->subtree_start - node->children[i - 1]->subtree_end;
+			}
 
-			assert_red_black_tree_validity(this_tree);
+			node->subtree_start = node->children[0]->subtree_start;
+			node->subtree_end   = node->children[node->count - 1]->subtree_end;
 		}
 
-		static void tree_test_code_3()
-		{
-			gfx::SegmentTree this_tree;
-			defer { this_tree.cleanup(); };
+		node->subtree_max_gap = max_gap;
+	}
 
-			this_tree.add_node(10, 0);
-			this_tree.add_node(9, 0);
-			this_tree.add_node(8, 0);
-			this_tree.add_node(7, 0);
-			this_tree.add_node(6, 0);
-			this_tree.add_node(5, 0);
-			this_tree.add_node(4, 0);
-			this_tree.add_node(3, 0);
-			this_tree.add_node(2, 0);
+	//Moves the entries of the node, starting from index, count slots to the right
+	static void btree_shift_right(_BTreeNode* node, u32 index, u32 count)
+	{
+		std::memmove(&node->keys[index + count], &node->keys[index], (node->count - index) * sizeof(u64));
+		if(node->is_leaf) std::memmove(&node->records[index + count], &node->records[index], (node->count - index) * sizeof(SegmentRecord));
+		else              std::memmove(&node->children[index + count], &node->children[index], (node->count - index) * sizeof(_BTreeNode*));
+	}
 
-			auto node_to_find = this_tree.find_node(6);
-			auto next_node = find_next_node(node_to_find);
-			assert(next_node->segment.start == 7, "implementation error");
+	static void btree_remove_entry(_BTreeNode* node, u32 index)
+	{
+		std::memmove(&node->keys[index], &node->keys[index + 1], (node->count - index - 1) * sizeof(u64));
+		if(node->is_leaf) std::memmove(&node->records[index], &node->records[index + 1], (node->count - index - 1) * sizeof(SegmentRecord));
+		else              std::memmove(&node->children[index], &node->children[index + 1], (node->count - index - 1) * sizeof(_BTreeNode*));
 
-			this_tree.remove_node(9);
-			this_tree.remove_node(8);
+		node->count--;
+		node->keys[node->count] = segment_btree_key_padding;
+	}
 
-			assert_red_black_tree_validity(this_tree);
-		}
+	//Appends every entry of right to left, the caller checks that they fit
+	static void btree_merge_nodes(_BTreeNode* left, const _BTreeNode* right)
+	{
+		std::memcpy(&left->keys[left->count], right->keys, right->count * sizeof(u64));
+		if(left->is_leaf) std::memcpy(&left->records[left->count], right->records, right->count * sizeof(SegmentRecord));
+		else              std::memcpy(&left->children[left->count], right->children, right->count * sizeof(_BTreeNode*));
 
-		static void tree_test_code_4()
-		{
-			gfx::SegmentTree this_tree;
-			defer { this_tree.cleanup(); };
+		left->count += right->count;
+	}
 
-			this_tree.add_node(1, 0);
-			this_tree.add_node(2, 0);
-			this_tree.add_node(3, 0);
-			this_tree.add_node(4, 0);
-			this_tree.add_node(5, 0);
+	SegmentBTree::SegmentBTree(SegmentBTree&& right) noexcept
+	{
+		operator=(static_cast<SegmentBTree&&>(right));
+	}
 
-			auto node_to_check = this_tree.find_first_node();
-			for(u32 i = 0; i < 5; i++) {
-				assert(node_to_check->segment.start == i + 1, "find_next_node algorithm not working\n");
-				node_to_check = find_next_node(node_to_check);
-			}
-		}
+	SegmentBTree& SegmentBTree::operator=(SegmentBTree&& right) noexcept
+	{
+		cleanup();
 
-		static void allocator_test_code_1()
-		{
-			auto allocator = allocator_create(1024, 1024);
-			auto current_allocator_save = g_engine_allocator;
-			defer {
-				g_engine_allocator = current_allocator_save;
-				allocator_cleanup(&allocator);
-			};
+		root       = right.root;
+		free_nodes = right.free_nodes;
 
-			g_engine_allocator = &allocator;
-			void* ptr1 = mem_allocate(0x10);
-			void* ptr2 = mem_allocate(0x10);
-			void* ptr3 = mem_allocate(0x10);
-			void* ptr4 = mem_allocate(0x10);
-			void* ptr5 = mem_allocate(0x10);
-			void* ptr6 = mem_allocate(0x10);
+		right.root       = nullptr;
+		right.free_nodes = nullptr;
+		return *this;
+	}
 
-			mem_free(ptr1);
-			mem_free(ptr2);
-			mem_free(ptr3);
-			mem_free(ptr5);
+	_BTreeNode* SegmentBTree::allocate_node(bool is_leaf)
+	{
+		_BTreeNode* node = free_nodes;
+		if(node) free_nodes = node->children[0];
+		else     node = static_cast<_BTreeNode*>(::operator new(sizeof(_BTreeNode), std::align_val_t{alignof(_BTreeNode)}));
 
-			void* new_ptr = mem_allocate(0x10);
-		}
+		for(u32 i = 0; i < segment_btree_fanout; i++)
+			node->keys[i] = segment_btree_key_padding;
 
-		static void allocator_test_code_2()
-		{
-			auto allocator = allocator_create(1024, 1024);
-			auto current_allocator_save = g_engine_allocator;
-			defer {
-				g_engine_allocator = current_allocator_save;
-				allocator_cleanup(&allocator);
-			};
-			g_engine_allocator = &allocator;
+		node->subtree_start = node->subtree_end = node->subtree_max_gap = 0;
+		node->count   = 0;
+		node->is_leaf = is_leaf;
+		return node;
+	}
 
+	void SegmentBTree::free_node(_BTreeNode* node)
+	{
+		node->children[0] = free_nodes;
+		free_nodes = node;
+	}
 
-			const u32 pointer_count = 8;
-			void* ptrs[pointer_count];
+	static void btree_release_subtree(_BTreeNode* node)
+	{
+		if(!node->is_leaf) {
+			for(u32 i = 0; i < node->count; i++)
+				btree_release_subtree(node->children[i]);
+		}
 
-			for(u32 i = 0; i < pointer_count; i++) {
-				ptrs[i] = mem_allocate(10);
-			}
+		::operator delete(node, std::align_val_t{alignof(_BTreeNode)});
+	}
 
+	void SegmentBTree::cleanup()
+	{
+		if(root) btree_release_subtree(root);
+		root = nullptr;
 
-			for(u32 i = 0; i < pointer_count; i++) {
-				mem_free(ptrs[i]);
-			}
+		while(free_nodes) {
+			_BTreeNode* next = free_nodes->children[0];
+			::operator delete(free_nodes, std::align_val_t{alignof(_BTreeNode)});
+			free_nodes = next;
+		}
+	}
 
+	u32 SegmentBTree::find_path(u64 start, _BTreeNode** path, u32* indices) const
+	{
+		u32 depth = 0;
+		_BTreeNode* node = root;
+		while(!node->is_leaf) {
+			assert(depth < segment_btree_max_depth - 1, "the B+-tree is deeper than expected");
+			const u32 index = btree_child_index(node, start);
+			path[depth]    = node;
+			indices[depth] = index;
+			depth++;
+			node = node->children[index];
+		}
+
+		path[depth]    = node;
+		indices[depth] = btree_count_keys_below(node->keys, start);
+		return depth + 1;
+	}
+
+	void SegmentBTree::update_path(_BTreeNode** path, u32 depth)
+	{
+		for(u32 level = depth; level > 0; level--)
+			btree_update_node_info(path[level - 1]);
+	}
+
+	//The upper half of the node goes to a new sibling, which is returned
+	_BTreeNode* SegmentBTree::split_node(_BTreeNode* node)
+	{
+		constexpr u32 half = segment_btree_fanout / 2;
+		_BTreeNode* sibling = allocate_node(node->is_leaf);
+		std::memcpy(sibling->keys, &node->keys[half], (node->count - half) * sizeof(u64));
+		if(node->is_leaf) std::memcpy(sibling->records, &node->records[half], (node->count - half) * sizeof(SegmentRecord));
+		else              std::memcpy(sibling->children, &node->children[half], (node->count - half) * sizeof(_BTreeNode*));
+
+		sibling->count = node->count - half;
+		for(u32 i = half; i < node->count; i++)
+			node->keys[i] = segment_btree_key_padding;
+
+		node->count = half;
+		btree_update_node_info(node);
+		btree_update_node_info(sibling);
+		return sibling;
+	}
+
+	SegmentRecord* SegmentBTree::add_node(u64 start, u64 size)
+	{
+		assert(start < segment_btree_key_padding, "the segment start can't be used as a key");
+		if(!root) root = allocate_node(true);
+
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+
+		_BTreeNode* leaf = path[depth - 1];
+		const u32 index = indices[depth - 1];
+		assert(index == leaf->count || leaf->keys[index] != start, "cannot allocate a new segment of memory where another one is already defined, check the memory declaration");
+
+		btree_shift_right(leaf, index, 1);
+		leaf->keys[index] = start;
+		leaf->records[index] = {};
+		leaf->records[index].segment = { start, size };
+		leaf->count++;
+		SegmentRecord* record = &leaf->records[index];
+
+		//Nodes are split as soon as they get full, so there is always room for the sibling in the parent
+		for(u32 level = depth; level > 0; level--) {
+			_BTreeNode* node = path[level - 1];
+			if(node->count < segment_btree_fanout) {
+				btree_update_node_info(node);
+				continue;
+			}
+
+			_BTreeNode* sibling = split_node(node);
+			if(node->is_leaf && index >= node->count)
+				record = &sibling->records[index - node->count];
+
+			if(level == 1) {
+				root = allocate_node(false);
+				root->children[0] = node;
+				root->children[1] = sibling;
+				root->count = 2;
+				btree_update_node_info(root);
+				break;
+			}
+
+			_BTreeNode* parent = path[level - 2];
+			const u32 sibling_index = indices[level - 2] + 1;
+			btree_shift_right(parent, sibling_index, 1);
+			parent->children[sibling_index] = sibling;
+			parent->count++;
+		}
+
+		return record;
+	}
+
+	SegmentRecord* SegmentBTree::find_node(u64 start)
+	{
+		_BTreeNode* node = root;
+		if(!node) return nullptr;
+
+		while(!node->is_leaf)
+			node = node->children[btree_child_index(node, start)];
+
+		const u32 index = btree_count_keys_below(node->keys, start);
+		return index < node->count && node->keys[index] == start ? &node->records[index] : nullptr;
+	}
+
+	const SegmentRecord* SegmentBTree::find_first_node()
+	{
+		if(!root) return nullptr;
+
+		const _BTreeNode* node = root;
+		while(!node->is_leaf)
+			node = node->children[0];
+
+		return &node->records[0];
+	}
+
+	const SegmentRecord* SegmentBTree::find_last_node()
+	{
+		if(!root) return nullptr;
+
+		const _BTreeNode* node = root;
+		while(!node->is_leaf)
+			node = node->children[node->count - 1];
+
+		return &node->records[node->count - 1];
+	}
+
+	SegmentRecord* SegmentBTree::find_lower_bound_node(u64 start)
+	{
+		if(!root) return nullptr;
+
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+		if(indices[depth - 1] < path[depth - 1]->count)
+			return &path[depth - 1]->records[indices[depth - 1]];
+
+		//The record is the first one of the next leaf, found below the closest ancestor with a next child
+		for(u32 level = depth - 1; level > 0; level--) {
+			const _BTreeNode* ancestor = path[level - 1];
+			if(indices[level - 1] + 1 < ancestor->count) {
+				_BTreeNode* node = ancestor->children[indices[level - 1] + 1];
+				while(!node->is_leaf)
+					node = node->children[0];
+
+				return &node->records[0];
+			}
+		}
+
+		return nullptr;
+	}
+
+	SegmentRecord* SegmentBTree::find_prev_node(u64 start)
+	{
+		if(!root) return nullptr;
+
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+		if(indices[depth - 1] > 0)
+			return &path[depth - 1]->records[indices[depth - 1] - 1];
+
+		for(u32 level = depth - 1; level > 0; level--) {
+			if(indices[level - 1] > 0) {
+				_BTreeNode* node = path[level - 1]->children[indices[level - 1] - 1];
+				while(!node->is_leaf)
+					node = node->children[node->count - 1];
+
+				return &node->records[node->count - 1];
+			}
+		}
+
+		return nullptr;
+	}
+
+	bool SegmentBTree::find_first_fit(u64 bytes, u64* start, u64 alignment) const
+	{
+		assert(alignment != 0 && (alignment & (alignment - 1)) == 0, "the alignment needs to be a power of two");
+		if(!root) return false;
+
+		if(root->subtree_start >= bytes) {
+			*start = 0;
+			return true;
+		}
+
+		if(root->subtree_max_gap < bytes) return false;
+
+		//Like in the red-black tree, subtrees are only entered when their largest hole fits the bytes
+		//wherever the padding lands, while the holes between them are checked exactly
+		const u64 required_subtree_gap = bytes + alignment - 1;
+		const _BTreeNode* node = root;
+		while(!node->is_leaf) {
+			const _BTreeNode* next_node = nullptr;
+			for(u32 i = 0; i < node->count && !next_node; i++) {
+				const _BTreeNode* child = node->children[i];
+				if(child->subtree_max_gap >= required_subtree_gap) {
+					next_node = child;
+				} else if(i + 1 < node->count && hole_fits(child->subtree_end, node->children[i + 1]->subtree_start, bytes, alignment)) {
+					*start = align_up(child->subtree_end, alignment);
+					return true;
+				}
+			}
+
+			if(!next_node) break;
+			node = next_node;
+		}
+
+		if(node->is_leaf) {
+			for(u32 i = 1; i < node->count; i++) {
+				const auto& previous = node->records[i - 1].segment;
+				if(hole_fits(previous.start + previous.size, node->records[i].segment.start, bytes, alignment)) {
+					*start = align_up(previous.start + previous.size, alignment);
+					return true;
+				}
+			}
+		}
+
+		assert(alignment > 1, "the gap information stored in the B+-tree is not consistent");
+		return false;
+	}
+
+	void SegmentBTree::remove_node(u64 start)
+	{
+		if(!root) return;
+
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+
+		_BTreeNode* leaf = path[depth - 1];
+		const u32 index = indices[depth - 1];
+		if(index == leaf->count || leaf->keys[index] != start) {
+			log_message("user tried to remove a segment which is not in the B+-tree\n");
+			return;
+		}
+
+		btree_remove_entry(leaf, index);
+
+		//There is no borrowing between siblings, empty nodes are dropped and nearly empty ones get merged
+		//with a neighbour when both fit in a single node
+		for(u32 level = depth; level > 1; level--) {
+			_BTreeNode* node = path[level - 1];
+			_BTreeNode* parent = path[level - 2];
+			const u32 node_index = indices[level - 2];
+			if(!node->count) {
+				btree_remove_entry(parent, node_index);
+				free_node(node);
+				continue;
+			}
+
+			btree_update_node_info(node);
+			if(node->count >= segment_btree_fanout / 4 || parent->count < 2)
+				continue;
+
+			const u32 left_index = node_index + 1 < parent->count ? node_index : node_index - 1;
+			_BTreeNode* left  = parent->children[left_index];
+			_BTreeNode* right = parent->children[left_index + 1];
+			if(left->count + right->count < segment_btree_fanout) {
+				btree_merge_nodes(left, right);
+				btree_update_node_info(left);
+				btree_remove_entry(parent, left_index + 1);
+				free_node(right);
+			}
+		}
+
+		if(!root->count) {
+			free_node(root);
+			root = nullptr;
+			return;
+		}
+
+		btree_update_node_info(root);
+		if(!root->is_leaf && root->count == 1) {
+			_BTreeNode* old_root = root;
+			root = root->children[0];
+			free_node(old_root);
+		}
+	}
+
+	void SegmentBTree::resize_node(u64 start, u64 size)
+	{
+		assert(root && size != 0, "a segment can't be resized to zero bytes");
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+		assert(path[depth - 1]->keys[indices[depth - 1]] == start, "the segment is not in the B+-tree");
+
+		path[depth - 1]->records[indices[depth - 1]].segment.size = size;
+		update_path(path, depth);
+	}
+
+	void SegmentBTree::move_node(u64 start, u64 new_start)
+	{
+		assert(root, "the segment is not in the B+-tree");
+		_BTreeNode* path[segment_btree_max_depth];
+		u32 indices[segment_btree_max_depth];
+		const u32 depth = find_path(start, path, indices);
+		_BTreeNode* leaf = path[depth - 1];
+		const u32 index = indices[depth - 1];
+		assert(leaf->keys[index] == start, "the segment is not in the B+-tree");
+
+		leaf->keys[index] = new_start;
+		leaf->records[index].segment.start = new_start;
+		update_path(path, depth);
+	}
+
+	static void check_btree_node(const _BTreeNode* node, u32 depth, u32* leaf_depth, u64* previous_end)
+	{
+		assert(node->count > 0 && node->count < segment_btree_fanout, "a B+-tree node has an invalid amount of entries");
+		for(u32 i = node->count; i < segment_btree_fanout; i++)
+			assert(node->keys[i] == segment_btree_key_padding, "the unused keys of a B+-tree node need to be padded");
+
+		if(node->is_leaf) {
+			if(!*leaf_depth) *leaf_depth = depth;
+			assert(*leaf_depth == depth, "all the leaves of a B+-tree need to be at the same depth");
+
+			for(u32 i = 0; i < node->count; i++) {
+				const auto& segment = node->records[i].segment;
+				assert(node->keys[i] == segment.start && segment.start >= *previous_end, "the segments of the B+-tree are not sorted or overlap");
+				*previous_end = segment.start + segment.size;
+			}
+		} else {
+			for(u32 i = 0; i < node->count; i++)
+				check_btree_node(node->children[i], depth + 1, leaf_depth, previous_end);
+		}
+
+		_BTreeNode expected;
+		std::memcpy(&expected, node, sizeof(_BTreeNode));
+		btree_update_node_info(&expected);
+		assert(expected.subtree_start == node->subtree_start && expected.subtree_end == node->subtree_end &&
+			expected.subtree_max_gap == node->subtree_max_gap && std::memcmp(expected.keys, node->keys, sizeof(node->keys)) == 0,
+			"the gap information of a B+-tree node is not up to date");
+	}
+
+	void assert_btree_validity(const SegmentBTree& segment_btree)
+	{
+		const _BTreeNode* root = segment_btree.get_root();
+		if(!root) return;
+
+		u32 leaf_depth = 0;
+		u64 previous_end = 0;
+		check_btree_node(root, 1, &leaf_depth, &previous_end);
+	}
+
+	SegmentRecord* SegmentIndex::add_node(u64 start, u64 size)
+	{
+		return type == SEGMENT_INDEX_BTREE ? btree.add_node(start, size) : tree.add_node(start, size);
+	}
+
+	SegmentRecord* SegmentIndex::find_node(u64 start)
+	{
+		return type == SEGMENT_INDEX_BTREE ? btree.find_node(start) : tree.find_node(start);
+	}
+
+	const SegmentRecord* SegmentIndex::find_last_node()
+	{
+		return type == SEGMENT_INDEX_BTREE ? btree.find_last_node() : tree.find_last_node();
+	}
+
+	SegmentRecord* SegmentIndex::find_lower_bound_node(u64 start)
+	{
+		return type == SEGMENT_INDEX_BTREE ? btree.find_lower_bound_node(start) : tree.find_lower_bound_node(start);
+	}
+
+	//The B+-tree can't walk from a record to its neighbours, so it searches them again
+	SegmentRecord* SegmentIndex::find_next_node(const SegmentRecord* record)
+	{
+		if(type == SEGMENT_INDEX_BTREE)
+			return btree.find_lower_bound_node(record->segment.start + 1);
+
+		return gfx::find_next_node(static_cast<const _Node*>(record));
+	}
+
+	SegmentRecord* SegmentIndex::find_prev_node(const SegmentRecord* record)
+	{
+		if(type == SEGMENT_INDEX_BTREE)
+			return btree.find_prev_node(record->segment.start);
+
+		return gfx::find_prev_node(static_cast<const _Node*>(record));
+	}
+
+	bool SegmentIndex::find_first_fit(u64 bytes, u64* start, u64 alignment) const
+	{
+		return type == SEGMENT_INDEX_BTREE ? btree.find_first_fit(bytes, start, alignment) : tree.find_first_fit(bytes, start, alignment);
+	}
+
+	void SegmentIndex::remove_node(u64 start)
+	{
+		if(type == SEGMENT_INDEX_BTREE) btree.remove_node(start);
+		else                            tree.remove_node(start);
+	}
+
+	void SegmentIndex::resize_node(SegmentRecord* record, u64 size)
+	{
+		if(type == SEGMENT_INDEX_BTREE) btree.resize_node(record->segment.start, size);
+		else                            tree.resize_node(static_cast<_Node*>(record), size);
+	}
+
+	void SegmentIndex::move_node(SegmentRecord* record, u64 start)
+	{
+		if(type == SEGMENT_INDEX_BTREE) btree.move_node(record->segment.start, start);
+		else                            tree.move_node(static_cast<_Node*>(record), start);
+	}
+
+	bool SegmentIndex::get_extent(u64* first_start, u64* last_end, u64* max_gap) const
+	{
+		if(type == SEGMENT_INDEX_BTREE) {
+			const _BTreeNode* root = btree.get_root();
+			if(!root) return false;
+
+			*first_start = root->subtree_start;
+			*last_end    = root->subtree_end;
+			*max_gap     = root->subtree_max_gap;
+			return true;
+		}
+
+		const _Node* root = tree.get_root();
+		if(!root) return false;
+
+		*first_start = root->subtree_start;
+		*last_end    = root->subtree_end;
+		*max_gap     = root->subtree_max_gap;
+		return true;
+	}
+
+	void SegmentIndex::cleanup()
+	{
+		tree.cleanup();
+		btree.cleanup();
+	}
+
+	static MemoryStorage* get_scratch_storage(Allocator* allocator);
+	static std::unique_lock<std::mutex> allocator_lock(Allocator* allocator);
+	static void* permanent_storage_allocate(Allocator* allocator, u32 bytes, u32 alignment, MemoryTag tag = MEMORY_TAG_UNTAGGED, bool check_hard_budget = true);
+	static u32 size_histogram_bucket(u64 bytes);
+
+	static constexpr u32 snapshot_magic   = 0x53483743; //"C7HS"
+	static constexpr u32 snapshot_version = 2;
+	//The storage bytes start at this offset of the file, enough for the mapping offsets of both Linux
+	//and Windows
+	static constexpr u64 snapshot_data_alignment = 64 * 1024;
+
+	struct _SnapshotHeader
+	{
+		u32 magic;
+		u32 version;
+		u64 segment_count;
+		u64 span_count;
+		u64 storage_bytes;
+		u64 data_offset;
+		u32 handle_count;
+		u32 handle_free_list;
+	};
+
+	//A thread cache span is saved as a regular segment, its blocks are not in the index so the free ones are
+	//marked here. Bit i is set when the i-th block of the span is free
+	struct _SnapshotSpan
+	{
+		u64 start;
+		u64 span_entry;
+		u64 free_blocks[thread_cache_span_size / thread_cache_min_block_size / 64];
+	};
+
+	namespace test
+	{
+		static u32 test_random_u32(u32* state)
+		{
+			//xorshift32, deterministic so that a failure can be reproduced
+			u32 x = *state;
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			*state = x;
+			return x;
+		}
+
+		static void tree_test_code_1()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			this_tree.add_node(1, 0);
+			this_tree.add_node(2, 0);
+			this_tree.add_node(3, 0);
+			this_tree.add_node(4, 0);
+			this_tree.add_node(5, 0);
+			this_tree.add_node(6, 0);
+			this_tree.add_node(7, 0);
+			this_tree.add_node(8, 0);
+			this_tree.add_node(9, 0);
+			this_tree.add_node(10, 0);
+			this_tree.add_node(20, 0);
+			this_tree.add_node(30, 0);
+
+			this_tree.remove_node(2);
+			this_tree.remove_node(4);
+			this_tree.remove_node(1);
+			this_tree.remove_node(8);
+
+			assert_red_black_tree_validity(this_tree);
+		}
+
+		static void tree_test_code_2()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			this_tree.add_node(2, 0);
+			this_tree.add_node(1, 0);
+			this_tree.add_node(3, 0);
+
+			this_tree.remove_node(1);
+			this_tree.remove_node(3);
+
+
+
+			assert_red_black_tree_validity(this_tree);
+		}
+
+		static void tree_test_code_3()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			this_tree.add_node(10, 0);
+			this_tree.add_node(9, 0);
+			this_tree.add_node(8, 0);
+			this_tree.add_node(7, 0);
+			this_tree.add_node(6, 0);
+			this_tree.add_node(5, 0);
+			this_tree.add_node(4, 0);
+			this_tree.add_node(3, 0);
+			this_tree.add_node(2, 0);
+
+			auto node_to_find = this_tree.find_node(6);
+			auto next_node = find_next_node(node_to_find);
+			assert(next_node->segment.start == 7, "implementation error");
+
+			this_tree.remove_node(9);
+			this_tree.remove_node(8);
+
+			assert_red_black_tree_validity(this_tree);
+		}
+
+		static void tree_test_code_4()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			this_tree.add_node(1, 0);
+			this_tree.add_node(2, 0);
+			this_tree.add_node(3, 0);
+			this_tree.add_node(4, 0);
+			this_tree.add_node(5, 0);
+
+			auto node_to_check = this_tree.find_first_node();
+			for(u32 i = 0; i < 5; i++) {
+				assert(node_to_check->segment.start == i + 1, "find_next_node algorithm not working\n");
+				node_to_check = find_next_node(node_to_check);
+			}
+		}
+
+		static void allocator_test_code_1()
+		{
+			auto allocator = allocator_create(1024, 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+
+			g_engine_allocator = &allocator;
+			void* ptr1 = mem_allocate(0x10);
+			void* ptr2 = mem_allocate(0x10);
+			void* ptr3 = mem_allocate(0x10);
+			void* ptr4 = mem_allocate(0x10);
+			void* ptr5 = mem_allocate(0x10);
+			void* ptr6 = mem_allocate(0x10);
+
+			mem_free(ptr1);
+			mem_free(ptr2);
+			mem_free(ptr3);
+			mem_free(ptr5);
+
+			void* new_ptr = mem_allocate(0x10);
+			assert(new_ptr == ptr1, "the first hole available should be reused");
+		}
+
+		static void allocator_test_code_2()
+		{
+			auto allocator = allocator_create(1024, 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+
+			const u32 pointer_count = 8;
+			void* ptrs[pointer_count];
+
+			for(u32 i = 0; i < pointer_count; i++) {
+				ptrs[i] = mem_allocate(10);
+			}
+
+
+			for(u32 i = 0; i < pointer_count; i++) {
+				mem_free(ptrs[i]);
+			}
+
+		}
+
+		static void allocator_test_code_3()
+		{
+			auto allocator = allocator_create(1024 * 1024, 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			const u32 pointer_count = 100;
+			u8* ptrs[pointer_count];
+
+			for(u32 i = 0; i < pointer_count; i++) {
+				ptrs[i] = mem_allocate<u8>(24);
+				std::memset(ptrs[i], i, 24);
+			}
+
+			u8* storage_u8 = static_cast<u8*>(allocator.permanent_storage.buffer);
+			for(u32 i = 0; i < pointer_count; i++) {
+				u64 span_index = (ptrs[i] - storage_u8) / thread_cache_span_size;
+				assert(allocator.span_classes[span_index] != 0, "small allocations need to be served by the thread cache");
+				assert(ptrs[i][0] == i && ptrs[i][23] == i, "two blocks are overlapping");
+			}
+
+			for(u32 i = 0; i < pointer_count; i++)
+				mem_free(ptrs[i]);
+
+			//Once the cache is warm, alternating allocations and frees never take the lock
+			const u64 lock_acquisitions = allocator.lock_acquisitions;
+			for(u32 i = 0; i < 1000; i++)
+				mem_free(mem_allocate(32));
+
+			assert(allocator.lock_acquisitions == lock_acquisitions, "the thread cache went through the allocator lock");
+
+			//Allocations bigger than the biggest class still go through the tree
+			void* big_ptr = mem_allocate(thread_cache_max_block_size + 1);
+			assert(allocator.segment_index.find_node((u8*)big_ptr - storage_u8), "the allocation needs to be mapped by the tree");
+			mem_free(big_ptr);
+
+			//Tagged small blocks come from spans of their tag, each span is accounted to the tag as one allocation
+			{
+				MemoryTagScope tag_scope(MEMORY_TAG_STRING);
+				mem_free(mem_allocate(32));
+				const u64 tagged_lock_acquisitions = allocator.lock_acquisitions;
+				for(u32 i = 0; i < 1000; i++)
+					mem_free(mem_allocate(32));
+
+				const auto& stats = allocator.tag_stats[MEMORY_TAG_STRING];
+				assert(allocator.lock_acquisitions == tagged_lock_acquisitions, "the tagged blocks went through the allocator lock");
+				assert(stats.live_bytes == thread_cache_span_size && stats.live_allocations == 1, "the span was not accounted to its tag");
+			}
+
+			//Without room for a whole span in the hard budget the blocks are placed in the tree
+			{
+				allocator_set_budget(&allocator, MEMORY_TAG_MODEL, 0, 1024);
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				u8* model_block = mem_allocate<u8>(32);
+				assert(!allocator.span_classes[(model_block - storage_u8) / thread_cache_span_size] && allocator.tag_stats[MEMORY_TAG_MODEL].live_bytes == 32,
+					"the block needs to be placed in the tree when the span does not fit in the budget");
+				mem_free(model_block);
+			}
+			allocator_flush_thread_cache();
+		}
+
+		static void allocator_test_code_4()
+		{
+			auto allocator = allocator_create(4 * 1024 * 1024, 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			const u32 thread_count = 4, pointer_count = 256;
+			bool blocks_valid[thread_count] = {};
+			std::vector<std::thread> threads;
+
+			for(u32 t = 0; t < thread_count; t++) {
+				threads.emplace_back([t, &blocks_valid]() {
+					u8* ptrs[pointer_count];
+					u32 random_state = t + 1;
+					bool valid = true;
+
+					for(u32 round = 0; round < 20; round++) {
+						for(u32 i = 0; i < pointer_count; i++) {
+							u32 size = 1 + test_random_u32(&random_state) % (thread_cache_max_block_size * 2);
+							ptrs[i] = mem_allocate<u8>(size);
+							ptrs[i][0] = (u8)t;
+							ptrs[i][size - 1] = (u8)t;
+						}
+
+						for(u32 i = 0; i < pointer_count; i++) {
+							valid = valid && ptrs[i][0] == (u8)t;
+							mem_free(ptrs[i]);
+						}
+					}
+
+					allocator_flush_thread_cache();
+					blocks_valid[t] = valid;
+				});
+			}
+
+			for(auto& thread : threads)
+				thread.join();
+
+			for(u32 t = 0; t < thread_count; t++)
+				assert(blocks_valid[t], "a block was shared between two threads");
+		}
+
+		static void tree_test_code_8()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			//Offsets past the 4 GB mark
+			const u64 gigabyte = 1024ull * 1024 * 1024;
+			this_tree.add_node(0, 4 * gigabyte);
+			this_tree.add_node(5 * gigabyte, 64);
+			this_tree.add_node(8 * gigabyte, 64);
+
+			u64 start = 0;
+			assert(this_tree.find_first_fit(2 * gigabyte, &start) && start == 5 * gigabyte + 64, "64 bit holes are not handled");
+			assert(this_tree.find_first_fit(gigabyte, &start) && start == 4 * gigabyte, "64 bit holes are not handled");
+			assert(this_tree.find_node(8 * gigabyte), "64 bit offsets are not handled");
+			assert_red_black_tree_validity(this_tree);
+		}
+
+		static void allocator_test_code_5()
+		{
+			//Only the address space gets reserved, 32 bit builds still can't fit this much of it
+			const u64 gigabyte = 1024ull * 1024 * 1024;
+			auto allocator = sizeof(void*) == 8 ? allocator_create(16 * gigabyte, gigabyte) : allocator_create(gigabyte / 4, gigabyte / 64);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			assert(allocator.permanent_storage.committed == 0 && allocator.temporary_storage.committed == 0, "the storages need to be committed on demand");
+
+			const u32 big_allocation_size = 8 * 1024 * 1024;
+			u8* ptr = mem_allocate<u8>(big_allocation_size);
+			ptr[big_allocation_size - 1] = 1;
+			assert(allocator.permanent_storage.committed >= big_allocation_size && allocator.permanent_storage.committed <= big_allocation_size + 2 * storage_commit_granularity, "only the used pages need to be committed");
+
+			u8* temporary_ptr = temporary_allocate<u8>(64);
+			assert(temporary_ptr[0] == 0 && get_scratch_storage(&allocator)->committed == storage_commit_granularity, "only the used pages need to be committed");
+			temporary_free(temporary_ptr);
+			mem_free(ptr);
+		}
+
+		struct alignas(32) _AlignedTestVector
+		{
+			f32 values[8];
+		};
+
+		static void allocator_test_code_6()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//Go through the segment tree only, the padding left before an aligned block needs to stay available
+			allocator.thread_caches_enabled = false;
+			u8* storage_u8 = static_cast<u8*>(allocator.permanent_storage.buffer);
+			u8* first  = mem_allocate<u8>(1);
+			u8* second = static_cast<u8*>(mem_allocate_aligned(100, 64));
+			assert(first == storage_u8 && second == storage_u8 + 64, "the aligned allocation is misplaced");
+			u8* third  = mem_allocate<u8>(40);
+			assert(third == storage_u8 + permanent_storage_min_block_size, "the padding in front of an aligned allocation should be reusable");
+			auto vectors = mem_allocate<_AlignedTestVector>(3);
+			assert(reinterpret_cast<std::uintptr_t>(vectors) % alignof(_AlignedTestVector) == 0, "alignof(T) is not honoured");
+			mem_free(vectors);
+			mem_free(third);
+			mem_free(second);
+			mem_free(first);
+			assert(allocator.permanent_storage.used == 0, "some allocations were not freed");
+
+			allocator.thread_caches_enabled = true;
+			for(u32 alignment = 1; alignment <= max_allocation_alignment; alignment <<= 1) {
+				void* small = mem_allocate_aligned(3, alignment);
+				void* big   = mem_allocate_aligned(5000, alignment);
+				assert(reinterpret_cast<std::uintptr_t>(small) % alignment == 0 && reinterpret_cast<std::uintptr_t>(big) % alignment == 0, "the requested alignment is not honoured");
+				mem_free(big);
+				mem_free(small);
+			}
+
+			//The temporary storage keeps the size header right before the aligned address
+			u8* unaligned = temporary_allocate<u8>(3);
+			auto temporary_vectors = temporary_allocate<_AlignedTestVector>(2);
+			f32* floats = temporary_allocate_aligned<f32>(16, 64);
+			assert(reinterpret_cast<std::uintptr_t>(temporary_vectors) % alignof(_AlignedTestVector) == 0, "alignof(T) is not honoured");
+			assert(reinterpret_cast<std::uintptr_t>(floats) % 64 == 0, "the requested alignment is not honoured");
+			temporary_free(floats);
+			temporary_free(temporary_vectors);
+			temporary_free(unaligned);
+			assert(get_scratch_storage(&allocator)->used == 0, "the temporary padding was not given back");
+		}
+
+		static void allocator_test_code_7()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+			allocator.thread_caches_enabled = false;
+
+			u8* first  = mem_allocate<u8>(4096);
+			u8* second = mem_allocate<u8>(4096);
+			std::memset(first, 7, 4096);
+
+			//No room after the first block, it needs to be moved and the content preserved
+			u8* moved = mem_reallocate(first, 8192);
+			assert(moved != first && moved[0] == 7 && moved[4095] == 7, "the moved block lost its content");
+
+			//The space freed by the first block can be reclaimed in place now
+			u8* third = mem_allocate<u8>(100);
+			assert(third == first, "first fit should reuse the hole");
+			u8* grown = mem_reallocate(third, 4000);
+			assert(grown == third && allocator.segment_index.find_node(0)->segment.size == 4000, "the block should have grown in place");
+			u8* shrunk = mem_reallocate(grown, 10);
+			assert(shrunk == grown && allocator.permanent_storage.used == 10 + 4096 + 8192, "the block should have shrunk in place");
+
+			//The last block can grow up to the end of the storage
+			u8* last = mem_reallocate(moved, 1024 * 1024);
+			assert(last == moved, "the last block should have grown in place");
+			assert_red_black_tree_validity(allocator.segment_index.tree);
+
+			mem_free(shrunk);
+			mem_free(second);
+			mem_free(last);
+			assert(allocator.permanent_storage.used == 0, "some allocations were not freed");
+
+			//Thread cache blocks are kept while the new size fits their class
+			allocator.thread_caches_enabled = true;
+			u8* small = mem_allocate<u8>(20);
+			assert(mem_reallocate(small, 32) == small, "the block class can fit 32 bytes");
+			u8* bigger = mem_reallocate(small, 3000);
+			assert(bigger != small, "the block should have been moved out of the thread cache");
+			mem_free(bigger);
+		}
+
+		static void allocator_test_code_8()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//Freeing in any order is fine when the whole scope is released through the marker
+			{
+				TemporaryScope scope;
+				u8* first  = temporary_allocate<u8>(100);
+				f32* second = temporary_allocate<f32>(50);
+				assert(first && second && get_scratch_storage(&allocator)->used > 0, "the temporary allocations failed");
+			}
+			assert(get_scratch_storage(&allocator)->used == 0, "the scope did not restore the marker");
+
+			//Data written in a frame needs to survive the next swap, and gets reset by the one after
+			u32* frame_data = frame_allocate<u32>(16);
+			frame_data[15] = 42;
+			frame_storage_swap();
+			u32* next_frame_data = frame_allocate<u32>(16);
+			assert(frame_data[15] == 42 && next_frame_data != frame_data, "the previous frame arena was overwritten");
+			assert(allocator.frame_storages[0].used == 64 && allocator.frame_storages[1].used == 64, "the frame arenas are not used alternately");
+			frame_storage_swap();
+			assert(frame_allocate<u32>(16) == frame_data, "the arena was not reset after two swaps");
+		}
+
+		static void allocator_test_code_9()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//Each thread fills its temporary allocations with its own pattern, any overlap between
+			//the arenas would show up when reading them back
+			const u32 thread_count = 4;
+			std::atomic<u32> failures = 0;
+			std::vector<std::thread> threads;
+			for(u32 t = 0; t < thread_count; t++) {
+				threads.emplace_back([t, &failures]() {
+					for(u32 round = 0; round < 200; round++) {
+						TemporaryScope scope;
+						u32* first  = temporary_allocate<u32>(64);
+						u32* second = temporary_allocate<u32>(128);
+						for(u32 i = 0; i < 64; i++)  first[i]  = t;
+						for(u32 i = 0; i < 128; i++) second[i] = t;
+						std::this_thread::yield();
+						for(u32 i = 0; i < 64; i++)
+							if(first[i] != t) failures++;
+						for(u32 i = 0; i < 128; i++)
+							if(second[i] != t) failures++;
+					}
+				});
+			}
+
+			for(auto& thread : threads)
+				thread.join();
+
+			assert(failures == 0, "the threads wrote in the same scratch arena");
+			//A thread which exited before the others started gives its arena to the next one
+			u32 arena_count = 0;
+			for(auto arena = allocator.scratch_arenas; arena; arena = arena->next) {
+				assert(arena->storage.used == 0, "a scratch arena was not rewound");
+				assert(arena->owner_thread == std::thread::id(), "the arena of an exited thread was not released");
+				arena_count++;
+			}
+			assert(arena_count >= 1 && arena_count <= thread_count, "each thread should have used its own arena");
+
+			//More short lived threads than scratch_arena_max_count, one at a time, all reuse the released arenas
+			for(u32 t = 0; t < scratch_arena_max_count + 1; t++) {
+				std::thread thread([]() {
+					TemporaryScope scope;
+					u32* data = temporary_allocate<u32>(16);
+					data[0] = 1;
+				});
+				thread.join();
+			}
+
+			u32 arena_count_after = 0;
+			for(auto arena = allocator.scratch_arenas; arena; arena = arena->next)
+				arena_count_after++;
+			assert(arena_count_after == arena_count, "the short lived threads did not reuse the released arenas");
+
+			//A thread which switched to another allocator still gives its arena back to the first one
+			auto other_allocator = allocator_create(1024 * 1024, 1024 * 1024);
+			std::thread([&other_allocator]() {
+				temporary_free(temporary_allocate<u32>(16));
+				g_engine_allocator = &other_allocator;
+				temporary_free(temporary_allocate<u32>(16));
+			}).join();
+			g_engine_allocator = &allocator;
+			for(auto arena = allocator.scratch_arenas; arena; arena = arena->next)
+				assert(arena->owner_thread == std::thread::id(), "the arena of the first allocator was not released");
+			assert(other_allocator.scratch_arenas->owner_thread == std::thread::id(), "the arena of the second allocator was not released");
+
+			//Cleaned up while the thread was still alive, the exiting thread leaves its storage alone
+			std::atomic<u32> step = 0;
+			std::thread thread([&other_allocator, &step]() {
+				g_engine_allocator = &other_allocator;
+				temporary_free(temporary_allocate<u32>(16));
+				step.store(1, std::memory_order_release);
+				while(step.load(std::memory_order_acquire) != 2)
+					std::this_thread::yield();
+			});
+			while(step.load(std::memory_order_acquire) != 1)
+				std::this_thread::yield();
+			allocator_cleanup(&other_allocator);
+			step.store(2, std::memory_order_release);
+			thread.join();
+			g_engine_allocator = &allocator;
+		}
+
+		struct _PoolTestObject
+		{
+			_PoolTestObject(u32 value) : value(value) { (*live_objects)++; }
+			~_PoolTestObject() { (*live_objects)--; }
+
+			u32 value;
+			u32 padding[5];
+			static inline s32* live_objects = nullptr;
+		};
+
+		static void pool_test_code_1()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			s32 live_objects = 0;
+			_PoolTestObject::live_objects = &live_objects;
+			Pool<_PoolTestObject> pool;
+
+			const u32 object_count = 200;
+			_PoolTestObject* objects[object_count];
+			for(u32 i = 0; i < object_count; i++)
+				objects[i] = pool.acquire(i);
+
+			for(u32 i = 1; i < object_count; i += 2)
+				pool.release(objects[i]);
+
+			assert(pool.size() == object_count / 2 && live_objects == object_count / 2, "the released objects were not destroyed");
+
+			u32 visited = 0;
+			pool.for_each([&visited](_PoolTestObject& object) {
+				assert(object.value % 2 == 0, "a released object is still iterated");
+				visited++;
+			});
+			assert(visited == object_count / 2, "some live objects were not iterated");
+
+			//The released slots are reused before any new slab gets allocated
+			u64 used_before = allocator.permanent_storage.used;
+			for(u32 i = 1; i < object_count; i += 2) {
+				_PoolTestObject* object = pool.acquire(i);
+				bool reused = false;
+				for(u32 j = 1; j < object_count; j += 2)
+					reused |= object == objects[j];
+
+				assert(reused, "a released slot was expected to be reused");
+			}
+			assert(allocator.permanent_storage.used == used_before, "no slab should have been allocated");
+
+			pool.cleanup();
+			assert(live_objects == 0 && pool.size() == 0, "cleanup did not destroy every object");
+		}
+
+		static u32 test_budget_callback_calls[2];
+
+		static void test_budget_callback(MemoryTag tag, u64 live_bytes, u64 budget, bool hard_budget)
+		{
+			assert(tag == MEMORY_TAG_MODEL && live_bytes > budget, "the budget callback was called for an allocation within the budget");
+			test_budget_callback_calls[hard_budget]++;
+		}
+
+		static void allocator_test_code_10()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			test_budget_callback_calls[0] = test_budget_callback_calls[1] = 0;
+			allocator_set_budget(&allocator, MEMORY_TAG_MODEL, 6000, 10000);
+			allocator_set_budget_callback(&allocator, test_budget_callback);
+
+			void* untagged = mem_allocate(100);
+			void* models[3] = {};
+			{
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				models[0] = mem_allocate(4000);
+				models[1] = mem_allocate(4000);
+				models[1] = mem_reallocate(models[1], 5000);
+			}
+
+			auto report = allocator_get_report(&allocator);
+			const auto& model_stats = report.tags[MEMORY_TAG_MODEL];
+			assert(model_stats.live_bytes == 9000 && model_stats.peak_bytes == 9000 && model_stats.live_allocations == 2, "the model allocations were not accounted");
+			assert(test_budget_callback_calls[0] == 1 && test_budget_callback_calls[1] == 0, "the soft budget callback should have been called once");
+			assert(report.size_histogram[size_histogram_bucket(4000)] == 2 && report.size_histogram[size_histogram_bucket(100)] == 1, "the size histogram is wrong");
+
+			{
+				//Would cross the hard budget, the allocation fails without asserting when made at the storage level
+				auto lock = allocator_lock(&allocator);
+				assert(!permanent_storage_allocate(&allocator, 2000, 1, MEMORY_TAG_MODEL), "the hard budget was not enforced");
+			}
+			assert(test_budget_callback_calls[1] == 1, "the hard budget callback was not called");
+
+			//The grow is refused before trying to move the block, so the callback runs once and the block stays valid
+			assert(!mem_reallocate(models[1], 7000) && test_budget_callback_calls[1] == 2, "the reallocation should have failed after a single hard budget callback");
+			assert(allocator_get_report(&allocator).tags[MEMORY_TAG_MODEL].live_bytes == 9000, "the failed reallocation changed the accounting");
+
+			//models[1] blocks the grow in place, the move only has to fit the grown bytes in the budget
+			models[0] = mem_reallocate(models[0], 4500);
+			assert(models[0] && test_budget_callback_calls[1] == 2, "the moved block was checked against the budget twice");
+			//Both blocks are live while the content is copied
+			report = allocator_get_report(&allocator);
+			assert(report.tags[MEMORY_TAG_MODEL].live_bytes == 9500 && report.tags[MEMORY_TAG_MODEL].peak_bytes == 13500, "the moved block was not accounted");
+
+			//A hole in the middle of the storage splits the free space
+			mem_free(models[0]);
+			report = allocator_get_report(&allocator);
+			assert(report.tags[MEMORY_TAG_MODEL].live_bytes == 5000 && report.tags[MEMORY_TAG_MODEL].peak_bytes == 13500, "the freed bytes were not accounted");
+			auto last_node = allocator.segment_index.find_last_node();
+			const u64 space_after_last_segment = report.permanent_storage_size - last_node->segment.start - last_node->segment.size;
+			assert(report.largest_free_gap == space_after_last_segment && report.fragmentation_ratio > 0.0, "the fragmentation metrics are wrong");
+
+			std::string json = memory_report_to_json(report);
+			assert(json.find("\"model\":{\"live_bytes\":5000,\"peak_bytes\":13500") != std::string::npos, "the json dump is missing the tag stats");
+
+			mem_free(models[1]);
+			mem_free(untagged);
+		}
+
+		static void allocator_test_code_11(SegmentIndexType segment_index_type)
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024, 16 * 1024 * 1024, segment_index_type);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//The regular block can't be moved, so it works as a barrier for the blocks after it
+			MemoryHandle handles[4];
+			u8* barrier = nullptr;
+			for(u32 i = 0; i < 4; i++) {
+				if(i == 2) barrier = mem_allocate<u8>(4000);
+				handles[i] = mem_allocate_handle(1000);
+				std::memset(mem_handle_resolve(handles[i]), (s32)i + 1, 1000);
+			}
+
+			mem_free_handle(handles[0]);
+			mem_free_handle(handles[2]);
+			assert(!mem_handle_resolve(handles[0]) && !mem_handle_resolve(handles[2]), "stale handles need to resolve to nullptr");
+
+			MemoryHandle reused_handle = mem_allocate_handle(16);
+			assert(reused_handle.index == handles[2].index && reused_handle.generation != handles[2].generation, "the freed entry should have been reused");
+			assert(!mem_handle_resolve(handles[2]), "the old handle can't see the new block");
+			mem_free_handle(reused_handle);
+
+			const u64 used_before = allocator.permanent_storage.used;
+			u32 moved_blocks = 0;
+			for(u32 i = 0; i < 8; i++)
+				moved_blocks += allocator_compact(&allocator, 0.0);
+
+			u8* storage_u8 = static_cast<u8*>(allocator.permanent_storage.buffer);
+			u8* first  = static_cast<u8*>(mem_handle_resolve(handles[1]));
+			u8* second = static_cast<u8*>(mem_handle_resolve(handles[3]));
+			assert(moved_blocks == 2 && first == storage_u8 && (u64)(second - storage_u8) == align_up((u64)(barrier - storage_u8) + 4000, handle_block_alignment), "the handle blocks were not slid down");
+			assert(first[0] == 2 && first[999] == 2 && second[0] == 4 && second[999] == 4, "the content of the moved blocks was lost");
+			assert(allocator.permanent_storage.used == used_before, "compacting can't change the used bytes");
+			assert_red_black_tree_validity(allocator.segment_index.tree);
+			assert_btree_validity(allocator.segment_index.btree);
+
+			mem_free_handle(handles[1]);
+			mem_free_handle(handles[3]);
+			mem_free(barrier);
+			assert(allocator.permanent_storage.used == 0, "some allocations were not freed");
+		}
+
+		static void allocator_test_code_12()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//Without the thread caches every free below reaches the permanent storage
+			allocator.thread_caches_enabled = false;
+			const u32 thread_count = 4, blocks_per_thread = 512;
+			static u8* blocks[thread_count * blocks_per_thread];
+			{
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				for(u32 i = 0; i < thread_count * blocks_per_thread; i++)
+					blocks[i] = mem_allocate<u8>(1 + i % 300);
+			}
+			const u64 used_before = allocator.permanent_storage.used;
+
+			std::vector<std::thread> threads;
+			for(u32 t = 0; t < thread_count; t++) {
+				threads.emplace_back([t]() {
+					for(u32 i = 0; i < blocks_per_thread; i++)
+						mem_free(blocks[t * blocks_per_thread + i]);
+				});
+			}
+
+			for(auto& thread : threads)
+				thread.join();
+
+			assert(allocator.permanent_storage.used == used_before, "the remote frees need to wait for the owner thread");
+			assert(allocator.remote_free_blocks, "the freed blocks need to be queued");
+
+			memory_end_frame();
+			assert(!allocator.remote_free_blocks && allocator.permanent_storage.used == 0, "the queue was not drained at the end of the frame");
+			assert(allocator.tag_stats[MEMORY_TAG_MODEL].live_allocations == 0, "the drained blocks need to update the tag stats");
+			assert_red_black_tree_validity(allocator.segment_index.tree);
+
+			//A worker allocating from the tree releases the queued blocks as well
+			u8* block = mem_allocate<u8>(64);
+			std::thread([&allocator, &block]() {
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				mem_free(block);
+				block = mem_allocate<u8>(4);
+				assert(allocator.permanent_storage.used == permanent_storage_min_block_size, "the worker did not drain the queue");
+
+				//The blocks the worker allocated itself are not queued
+				mem_free(mem_allocate<u8>(64));
+				assert(allocator.permanent_storage.used == permanent_storage_min_block_size && !allocator.remote_free_blocks,
+					"the worker needs to release its own blocks right away");
+			}).join();
+
+			//The block of the worker is queued when another thread frees it. This thread can't be the one, it
+			//still tracks the addresses of the blocks the first workers freed
+			std::thread([&allocator, block]() {
+				mem_free(block);
+				assert(allocator.remote_free_blocks && allocator.permanent_storage.used == permanent_storage_min_block_size,
+					"the free of the block of the worker needs to be queued");
+			}).join();
+			memory_end_frame();
+			assert(allocator.permanent_storage.used == 0, "the queue was not drained at the end of the frame");
+		}
+
+		static void allocator_test_code_13()
+		{
+			//Whatever pages the system gives, the storages need to work the same way
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024, 4 * 1024 * 1024, SEGMENT_INDEX_RED_BLACK_TREE, true);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			const auto& permanent_storage = allocator.permanent_storage;
+			assert(permanent_storage.pages == STORAGE_PAGES_REGULAR || reinterpret_cast<std::uintptr_t>(permanent_storage.buffer) % storage_huge_page_size == 0,
+				"huge page storages need to start on a huge page boundary");
+			assert(allocator.scratch_arena_size % storage_huge_page_size == 0, "the scratch arenas need to start on a huge page boundary");
+
+			//The prefault runs while the allocator is being used
+			allocator_prefault(&allocator, 16 * 1024 * 1024);
+			const u32 big_allocation_size = 5 * 1024 * 1024;
+			{
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				u8* big = mem_allocate<u8>(big_allocation_size);
+				std::memset(big, 0xAB, big_allocation_size);
+				u8* temporary = temporary_allocate<u8>(1024);
+				temporary[1023] = 1;
+				temporary_free(temporary);
+
+				//No thread is started for the Windows large pages
+				if(allocator.prefault_thread.joinable())
+					allocator.prefault_thread.join();
+				assert(big[0] == 0xAB && big[big_allocation_size - 1] == 0xAB, "the prefault changed the content of the pages");
+				assert(permanent_storage.committed >= 16 * 1024 * 1024 && permanent_storage.committed % permanent_storage.commit_granularity == 0,
+					"the prefaulted pages need to be committed");
+				mem_free(big);
+			}
+		}
+
+		struct _SnapshotTestMesh
+		{
+			RelPtr<f32> vertices;
+			u32 vertex_count;
+		};
+
+		static void allocator_test_code_14()
+		{
+			const char* snapshot_path = "memory_test_snapshot.bin";
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				std::remove(snapshot_path);
+			};
+
+			u64 mesh_offset = 0, small_block_offset = 0, used_bytes = 0;
+			MemoryHandle handle = {};
+			{
+				auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+				defer { allocator_cleanup(&allocator); };
+				g_engine_allocator = &allocator;
+
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				auto mesh = mem_allocate<_SnapshotTestMesh>(1);
+				f32* vertices = mem_allocate<f32>(300);
+				for(u32 i = 0; i < 300; i++)
+					vertices[i] = (f32)i;
+				mesh->vertices     = vertices;
+				mesh->vertex_count = 300;
+
+				handle = mem_allocate_handle(64);
+				std::memset(mem_handle_resolve(handle), 7, 64);
+
+				//Untagged small blocks come from a thread cache span, the span is saved with its live blocks while
+				//the cache itself is left out
+				MemoryTagScope untagged_scope(MEMORY_TAG_UNTAGGED);
+				u8* small_blocks[3] = { mem_allocate<u8>(32), mem_allocate<u8>(32), mem_allocate<u8>(32) };
+				std::memset(small_blocks[1], 9, 32);
+				mem_free(small_blocks[0]);
+				mem_free(small_blocks[2]);
+				small_block_offset = small_blocks[1] - static_cast<u8*>(allocator.permanent_storage.buffer);
+				used_bytes = allocator.permanent_storage.used - sizeof(ThreadCache);
+
+				mesh_offset = reinterpret_cast<u8*>(mesh) - static_cast<u8*>(allocator.permanent_storage.buffer);
+				assert(allocator_save_snapshot(&allocator, snapshot_path), "the snapshot was not saved");
+			}
+
+			//A truncated copy and a header with a bogus segment count are refused before anything gets mapped
+			const char* corrupted_path = "memory_test_snapshot_corrupted.bin";
+			defer { std::remove(corrupted_path); };
+			std::vector<u8> snapshot_bytes;
+			{
+				FILE* file = std::fopen(snapshot_path, "rb");
+				assert(file, "the snapshot was not written");
+				u8 buffer[4096];
+				for(size_t read = 0; (read = std::fread(buffer, 1, sizeof(buffer), file)) != 0;)
+					snapshot_bytes.insert(snapshot_bytes.end(), buffer, buffer + read);
+				std::fclose(file);
+			}
+			auto write_corrupted_snapshot = [&](u64 bytes) {
+				FILE* file = std::fopen(corrupted_path, "wb");
+				std::fwrite(snapshot_bytes.data(), 1, bytes, file);
+				std::fclose(file);
+			};
+
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			defer { allocator_cleanup(&allocator); };
+			g_engine_allocator = &allocator;
+
+			write_corrupted_snapshot(snapshot_bytes.size() - 1);
+			assert(!allocator_restore_snapshot(&allocator, corrupted_path), "a truncated snapshot was restored");
+			auto write_corrupted_header = [&](u64 field_offset, const void* value, u64 value_size) {
+				std::vector<u8> saved(snapshot_bytes.begin() + field_offset, snapshot_bytes.begin() + field_offset + value_size);
+				std::memcpy(snapshot_bytes.data() + field_offset, value, value_size);
+				write_corrupted_snapshot(snapshot_bytes.size());
+				std::memcpy(snapshot_bytes.data() + field_offset, saved.data(), value_size);
+			};
+			const u64 bogus_segment_count = 0xFFFFFFFFFFFFull;
+			write_corrupted_header(offsetof(_SnapshotHeader, segment_count), &bogus_segment_count, sizeof(bogus_segment_count));
+			assert(!allocator_restore_snapshot(&allocator, corrupted_path), "a snapshot with too many segments was restored");
+			const u32 bogus_free_list = 2;
+			write_corrupted_header(offsetof(_SnapshotHeader, handle_free_list), &bogus_free_list, sizeof(bogus_free_list));
+			assert(!allocator_restore_snapshot(&allocator, corrupted_path), "a snapshot with a free list out of the handle table was restored");
+			_SnapshotHeader saved_header;
+			std::memcpy(&saved_header, snapshot_bytes.data(), sizeof(saved_header));
+			const u64 bogus_handle_offset = 16;
+			write_corrupted_header(sizeof(_SnapshotHeader) + saved_header.segment_count * sizeof(SegmentRecord) + offsetof(_HandleEntry, offset),
+				&bogus_handle_offset, sizeof(bogus_handle_offset));
+			assert(!allocator_restore_snapshot(&allocator, corrupted_path), "a snapshot with a handle to the wrong segment was restored");
+			assert(allocator.permanent_storage.used == 0 && !allocator.permanent_storage.committed, "a refused snapshot touched the storage");
+
+			assert(allocator_restore_snapshot(&allocator, snapshot_path), "the snapshot was not restored");
+			assert(allocator.permanent_storage.used == used_bytes && allocator.tag_stats[MEMORY_TAG_MODEL].live_allocations == 3,
+				"the restored segments do not match the saved ones");
+
+			//The live block of the span keeps its content, and is not handed out again while the freed ones are
+			u8* small_block = static_cast<u8*>(allocator.permanent_storage.buffer) + small_block_offset;
+			assert(allocator.span_classes[small_block_offset / thread_cache_span_size] && small_block[0] == 9 && small_block[31] == 9,
+				"the thread cache span was not restored");
+			u8* new_small_blocks[2] = { mem_allocate<u8>(32), mem_allocate<u8>(32) };
+			assert(new_small_blocks[0] != small_block && new_small_blocks[1] != small_block && small_block[0] == 9,
+				"a live block of the span was handed out again");
+			mem_free(new_small_blocks[0]);
+			mem_free(new_small_blocks[1]);
+			mem_free(small_block);
+
+			auto mesh = reinterpret_cast<_SnapshotTestMesh*>(static_cast<u8*>(allocator.permanent_storage.buffer) + mesh_offset);
+			assert(mesh->vertex_count == 300 && mesh->vertices[0] == 0.0f && mesh->vertices[299] == 299.0f, "the relative pointer does not survive the snapshot");
+			u8* handle_data = static_cast<u8*>(mem_handle_resolve(handle));
+			assert(handle_data && handle_data[0] == 7 && handle_data[63] == 7, "the handles do not survive the snapshot");
+
+			//New blocks go around the restored ones
+			MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+			u8* block = mem_allocate<u8>(100);
+			assert(block >= handle_data + 64 || block + 100 <= reinterpret_cast<u8*>(mesh), "a new block overlaps the restored ones");
+			assert_red_black_tree_validity(allocator.segment_index.tree);
+
+			mem_free(block);
+			mem_free(mesh->vertices.get());
+			mem_free(mesh);
+			mem_free_handle(handle);
+			//Only the spans and the thread cache are left, the freed blocks went back to the free lists
+			auto& segment_index = allocator.segment_index;
+			for(SegmentRecord* record = segment_index.find_lower_bound_node(0); record; record = segment_index.find_next_node(record)) {
+				assert(allocator.span_classes[record->segment.start / thread_cache_span_size] || record->segment.size == sizeof(ThreadCache),
+					"the restored blocks can't be freed");
+			}
+		}
+
+		//Sums the bytes at the end of each line of the collapsed stacks
+		static u64 collapsed_stacks_total_bytes(const std::string& collapsed)
+		{
+			u64 total = 0;
+			u64 line_start = 0;
+			while(line_start < collapsed.size()) {
+				const u64 line_end = collapsed.find('\n', line_start);
+				assert(line_end != std::string::npos, "each collapsed stack ends with a new line");
+				const u64 separator = collapsed.rfind(' ', line_end);
+				assert(separator != std::string::npos && separator > line_start && separator + 1 < line_end, "each collapsed stack ends with its bytes");
+				total += std::strtoull(collapsed.c_str() + separator + 1, nullptr, 10);
+				line_start = line_end + 1;
+			}
+			return total;
+		}
+
+		static void allocator_test_code_15()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				memory_profiler_stop();
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+
+			//With one byte between the samples every allocation is sampled with its own size
+			memory_profiler_start(1);
+			u8* small = mem_allocate<u8>(100);
+			u8* freed = nullptr;
+			u8* large = nullptr;
+			{
+				MemoryTagScope tag_scope(MEMORY_TAG_MODEL);
+				freed = mem_allocate<u8>(1000);
+				large = mem_allocate<u8>(3000);
+			}
+			u8* temporary = temporary_allocate<u8>(500);
+			mem_free(freed);
+			memory_profiler_stop();
+
+			u8* unsampled = mem_allocate<u8>(7000);
+			const std::string live = memory_profiler_export_collapsed(true);
+			const std::string cumulative = memory_profiler_export_collapsed(false);
+			assert(collapsed_stacks_total_bytes(live) == 3100, "the live stacks need to contain only the blocks which were not freed");
+			assert(collapsed_stacks_total_bytes(cumulative) == 4600, "the cumulative stacks need to contain every sampled allocation");
+			assert(live.find(';') != std::string::npos, "the stacks need more than one frame");
+
+			//Frees are still matched after the profiler is stopped
+			mem_free(small);
+			assert(collapsed_stacks_total_bytes(memory_profiler_export_collapsed(true)) == 3000, "the free of a sampled block was missed");
+			mem_free(large);
+			mem_free(unsampled);
+			temporary_free(temporary);
+			assert(memory_profiler_export_collapsed(true).empty(), "no sampled block is alive");
+
+			//Starting again drops the previous samples
+			const u32 thread_count = 4, blocks_per_thread = 2000;
+			memory_profiler_start(256);
+			assert(memory_profiler_export_collapsed(false).empty(), "the samples of the previous run were not cleared");
+
+			std::vector<std::thread> threads;
+			for(u32 t = 0; t < thread_count; t++) {
+				threads.emplace_back([]() {
+					u8* blocks[64];
+					for(u32 i = 0; i < blocks_per_thread; i++) {
+						u8*& block = blocks[i % 64];
+						if(i >= 64) mem_free(block);
+						block = mem_allocate<u8>(16 + i % 100);
+					}
+					for(u8* block : blocks)
+						mem_free(block);
+				});
+			}
+			for(auto& thread : threads) thread.join();
+			memory_profiler_stop();
+
+			assert(memory_profiler_export_collapsed(true).empty(), "every block allocated by the threads was freed");
+			const u64 sampled_bytes = collapsed_stacks_total_bytes(memory_profiler_export_collapsed(false));
+			assert(sampled_bytes >= 256 * 100 && sampled_bytes <= 256 * thread_count * blocks_per_thread, "the sampled bytes need to estimate the allocated ones");
+		}
+
+		static FrameAuditReport g_test_frame_audit_report;
+		static std::string      g_test_frame_audit_attribution;
+
+		static void test_frame_audit_callback(const FrameAuditReport& report, const std::string& attribution)
+		{
+			g_test_frame_audit_report      = report;
+			g_test_frame_audit_attribution = attribution;
+		}
+
+		//A scripted frame loop, the steady state frames only use the frame and the temporary storages while
+		//the first one warms up a cache and the last one creates everything again
+		static void allocator_test_code_16()
+		{
+			auto allocator = allocator_create(1024 * 1024 * 64, 1024 * 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				frame_audit_set_callback(nullptr);
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+			frame_audit_set_callback(test_frame_audit_callback);
+
+			std::vector<u32>* uniform_cache = nullptr;
+			u8* persistent_block = nullptr;
+			auto run_frame = [&](u32 frame_index, bool recreate_resources) {
+				if(!uniform_cache || recreate_resources) {
+					delete uniform_cache;
+					uniform_cache = new std::vector<u32>(16);
+					mem_free(persistent_block);
+					persistent_block = mem_allocate<u8>(4096);
+					frame_audit_record_gl_buffers(2);
+				}
+
+				f32* transforms = frame_allocate<f32>(64 * 16);
+				char* uniform_name = temporary_allocate<char>(32);
+				for(u32 i = 0; i < 64 * 16; i++) transforms[i] = static_cast<f32>(i + frame_index);
+				std::snprintf(uniform_name, 32, "texture%u", frame_index % 16 + 1);
+				(*uniform_cache)[frame_index % 16] += static_cast<u32>(transforms[frame_index]) + uniform_name[7];
+				temporary_free(uniform_name);
+				memory_end_frame();
+			};
+
+			//The warm up frame goes over the zero budget
+			frame_audit_begin();
+			run_frame(0, false);
+			FrameAuditReport report = frame_audit_end();
+			assert(report.over_budget && g_test_frame_audit_report.over_budget, "the warm up frame allocates");
+			assert(report.counts[FRAME_AUDIT_MEM_ALLOCATE] == 1 && report.counts[FRAME_AUDIT_GL_BUFFER] == 2,
+				"the events of the warm up frame were not counted");
+#ifdef C7_FRAME_AUDIT_OPERATOR_NEW
+			assert(report.counts[FRAME_AUDIT_OPERATOR_NEW] >= 2, "the operator new calls of the warm up frame were not counted");
+#endif
+			assert(report.bytes[FRAME_AUDIT_MEM_ALLOCATE] == 4096, "the size of the allocation was not counted");
+			assert(g_test_frame_audit_attribution.find("mem_allocate 4096 bytes: ") != std::string::npos &&
+				g_test_frame_audit_attribution.find("GL buffer x2: ") != std::string::npos, "the events need to be attributed");
+
+			for(u32 frame = 1; frame < 32; frame++) {
+				g_test_frame_audit_report = {};
+				frame_audit_begin();
+				run_frame(frame, false);
+				report = frame_audit_end();
+				assert(!report.over_budget && !g_test_frame_audit_report.over_budget, "the steady state frames can't allocate");
+				assert(!report.counts[FRAME_AUDIT_OPERATOR_NEW] && !report.counts[FRAME_AUDIT_MEM_ALLOCATE] && !report.counts[FRAME_AUDIT_GL_BUFFER],
+					"an event was counted in a steady state frame");
+			}
+
+			//Within the budget the callback is not called, other threads are never counted. Starting the
+			//thread is left some room, since it allocates its state with operator new
+			g_test_frame_audit_report = {};
+			frame_audit_begin(16, 1, 2);
+			run_frame(32, true);
+			std::thread([]() { mem_free(mem_allocate<u8>(64)); delete new u32(0); }).join();
+			report = frame_audit_end();
+			assert(!report.over_budget && !g_test_frame_audit_report.over_budget, "the frame was within its budget");
+			assert(report.counts[FRAME_AUDIT_MEM_ALLOCATE] == 1, "the allocations of other threads can't be counted");
+
+			delete uniform_cache;
+			mem_free(persistent_block);
+		}
+
+		static void tree_test_code_7()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			//The nodes are stored contiguously
+			const u32 node_count = 1024;
+			for(u32 i = 0; i < node_count; i++)
+				this_tree.add_node(i, 1);
+
+			const _Node* first_node = this_tree.find_first_node();
+			const _Node* chunk_begin = first_node, *chunk_end = first_node;
+			for(auto node = first_node; node; node = find_next_node(node)) {
+				if(node < chunk_begin) chunk_begin = node;
+				if(node > chunk_end)   chunk_end   = node;
+			}
+			assert(chunk_end - chunk_begin == node_count - 1, "the nodes are not packed together");
+
+			//Freed nodes need to be reused before carving new ones
+			for(u32 i = 0; i < node_count; i += 2)
+				this_tree.remove_node(i);
+			for(u32 i = 0; i < node_count / 2; i++)
+				this_tree.add_node(node_count + i, 1);
+
+			for(auto node = this_tree.find_first_node(); node; node = find_next_node(node))
+				assert(node >= chunk_begin && node <= chunk_end, "a freed node was not reused");
+
+			assert_red_black_tree_validity(this_tree);
+		}
+
+		static void tree_test_code_5()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			const u32 key_count = 512;
+			bool inserted[key_count] = {};
+			u32 random_state = 0x12345678;
+
+			for(u32 i = 0; i < 4000; i++) {
+				u32 key = test_random_u32(&random_state) % key_count;
+				if(inserted[key]) {
+					this_tree.remove_node(key * 4);
+				} else {
+					//Variable sizes so that the holes between the segments are all different
+					this_tree.add_node(key * 4, key % 4);
+				}
+				inserted[key] = !inserted[key];
+
+				assert_red_black_tree_validity(this_tree);
+			}
+
+			u32 expected_key = 0;
+			for(auto node = this_tree.find_first_node(); node; node = find_next_node(node)) {
+				while(!inserted[expected_key]) expected_key++;
+				assert(node->segment.start == expected_key * 4, "the tree does not contain the expected segments");
+				expected_key++;
+			}
+		}
+
+		static void tree_test_code_6()
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			u64 start = 0;
+			assert(!this_tree.find_first_fit(1, &start), "an empty tree has no holes");
+
+			this_tree.add_node(8, 8);
+			this_tree.add_node(20, 4);
+			this_tree.add_node(40, 8);
+			this_tree.add_node(60, 4);
+
+			assert(this_tree.find_first_fit(8, &start) && start == 0, "the space before the first segment needs to be used");
+			assert(this_tree.find_first_fit(9, &start) && start == 24, "the lowest address hole needs to be picked");
+			assert(!this_tree.find_first_fit(17, &start), "no hole can fit this size");
+
+			this_tree.remove_node(20);
+			assert(this_tree.find_first_fit(17, &start) && start == 16, "the hole left by the deletion needs to be found");
+
+			assert(this_tree.find_first_fit(8, &start, 16) && start == 0, "the start of the storage is always aligned");
+			assert(this_tree.find_first_fit(9, &start, 16) && start == 16, "the aligned start needs to be returned");
+			assert(!this_tree.find_first_fit(20, &start, 32), "no hole can fit this size once aligned");
+		}
+
+		//The B+-tree has to give the same answers of the red-black tree, enough segments are kept alive
+		//for the B+-tree to grow a few levels and to merge its nodes back when they get removed
+		static void tree_test_code_9()
+		{
+			gfx::SegmentTree this_tree;
+			gfx::SegmentBTree this_btree;
+			defer {
+				this_tree.cleanup();
+				this_btree.cleanup();
+			};
+
+			const u32 key_count = 8192;
+			static bool inserted[key_count];
+			std::memset(inserted, 0, sizeof(inserted));
+			u32 random_state = 0x9ABCDEF1;
+
+			for(u32 i = 0; i < 60000; i++) {
+				//Inserts win at first, then removals catch up and empty the trees
+				const u32 key = test_random_u32(&random_state) % key_count;
+				const bool insert = i < 30000 ? !inserted[key] : false;
+				if(insert) {
+					SegmentRecord* record = this_btree.add_node(key * 8, 1 + key % 7);
+					record->tag = static_cast<u8>(key);
+					this_tree.add_node(key * 8, 1 + key % 7)->tag = static_cast<u8>(key);
+					inserted[key] = true;
+				} else if(inserted[key]) {
+					this_btree.remove_node(key * 8);
+					this_tree.remove_node(key * 8);
+					inserted[key] = false;
+				}
+
+				u64 tree_start = 0, btree_start = 0;
+				const u64 bytes = 1 + test_random_u32(&random_state) % 64;
+				const bool tree_found  = this_tree.find_first_fit(bytes, &tree_start);
+				const bool btree_found = this_btree.find_first_fit(bytes, &btree_start);
+				assert(tree_found == btree_found && tree_start == btree_start, "the B+-tree found a different hole");
+
+				const u64 probe = test_random_u32(&random_state) % (key_count * 8);
+				const SegmentRecord* lower_bound = this_btree.find_lower_bound_node(probe);
+				const SegmentRecord* expected = this_tree.find_lower_bound_node(probe);
+				assert((!lower_bound && !expected) || (lower_bound && expected && lower_bound->segment.start == expected->segment.start),
+					"the B+-tree lower bound is wrong");
+
+				const SegmentRecord* found = this_btree.find_node(key * 8);
+				assert(!!found == inserted[key] && (!found || found->tag == static_cast<u8>(key)), "the B+-tree lost a record");
+
+				if(i % 1024 == 0)
+					assert_btree_validity(this_btree);
+			}
+
+			assert_btree_validity(this_btree);
+			for(u32 key = 0; key < key_count; key++) {
+				if(inserted[key]) this_btree.remove_node(key * 8);
+			}
+			assert(!this_btree.get_root(), "the B+-tree needs to be empty");
 		}
 
 		void memory_run_tests()
 		{
-			tree_test_code_1();
-			tree_test_code_2();
-			tree_test_code_3();
-			tree_test_code_4();
-			allocator_test_code_1();
-			allocator_test_code_2();
-			log_message("(memory_run_tests) tests: OK\n");
+			tree_test_code_1();
+			tree_test_code_2();
+			tree_test_code_3();
+			tree_test_code_4();
+			tree_test_code_5();
+			tree_test_code_6();
+			tree_test_code_7();
+			tree_test_code_8();
+			tree_test_code_9();
+			allocator_test_code_1();
+			allocator_test_code_2();
+			allocator_test_code_3();
+			allocator_test_code_4();
+			allocator_test_code_5();
+			allocator_test_code_6();
+			allocator_test_code_7();
+			allocator_test_code_8();
+			allocator_test_code_9();
+			pool_test_code_1();
+			allocator_test_code_10();
+			allocator_test_code_11(SEGMENT_INDEX_RED_BLACK_TREE);
+			allocator_test_code_11(SEGMENT_INDEX_BTREE);
+			allocator_test_code_12();
+			allocator_test_code_13();
+			allocator_test_code_14();
+			allocator_test_code_15();
+			allocator_test_code_16();
+			log_message("(memory_run_tests) tests: OK\n");
+		}
+
+		//Reference implementation of the hole lookup used before the gap information was stored in the
+		//tree, walks every segment in order. Only kept to compare the two approaches
+		static bool find_first_fit_linear(SegmentTree& segment_tree, u64 bytes, u64* start)
+		{
+			auto node = segment_tree.find_first_node();
+			if(!node) return false;
+
+			if(node->segment.start >= bytes) {
+				*start = 0;
+				return true;
+			}
+
+			for(;;) {
+				auto next_node = find_next_node(node);
+				if(!next_node) return false;
+
+				u64 node_end = node->segment.start + node->segment.size;
+				if(next_node->segment.start - node_end >= bytes) {
+					*start = node_end;
+					return true;
+				}
+
+				node = next_node;
+			}
+		}
+
+		static void benchmark_first_fit_lookup(u32 segment_count, u32 lookup_count)
+		{
+			gfx::SegmentTree this_tree;
+			defer { this_tree.cleanup(); };
+
+			//Fragmented heap: 64 byte segments separated by 16 byte holes, the only hole which can fit the
+			//requested size is the one left by the segment removed at three quarters of the storage
+			const u32 segment_size = 64, segment_stride = 80, requested_bytes = 32;
+			for(u32 i = 0; i < segment_count; i++)
+				this_tree.add_node(i * segment_stride, segment_size);
+
+			this_tree.remove_node(((segment_count * 3) / 4) * segment_stride);
+
+			u64 linear_start = 0, tree_start = 0;
+			u64 checksum = 0;
+
+			auto linear_begin = std::chrono::steady_clock::now();
+			for(u32 i = 0; i < lookup_count; i++) {
+				find_first_fit_linear(this_tree, requested_bytes, &linear_start);
+				checksum += linear_start;
+			}
+			auto linear_end = std::chrono::steady_clock::now();
+
+			for(u32 i = 0; i < lookup_count; i++) {
+				this_tree.find_first_fit(requested_bytes, &tree_start);
+				checksum -= tree_start;
+			}
+			auto tree_end = std::chrono::steady_clock::now();
+
+			assert(checksum == 0 && linear_start == tree_start, "the two lookups need to find the same hole");
+
+			f64 linear_ns = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(linear_end - linear_begin).count() / lookup_count;
+			f64 tree_ns   = (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(tree_end - linear_end).count() / lookup_count;
+			log_message("(memory_run_benchmarks) first fit, {} segments: linear scan {:.1f} ns/lookup, segment tree {:.1f} ns/lookup\n",
+				segment_count, linear_ns, tree_ns);
+		}
+
+		//Every thread allocates a batch of small blocks of random size and frees it, over and over
+		static void benchmark_thread_scaling(u32 thread_count, bool thread_caches_enabled)
+		{
+			auto allocator = allocator_create(256 * 1024 * 1024, 1024);
+			auto current_allocator_save = g_engine_allocator;
+			defer {
+				g_engine_allocator = current_allocator_save;
+				allocator_cleanup(&allocator);
+			};
+			g_engine_allocator = &allocator;
+			allocator.thread_caches_enabled = thread_caches_enabled;
+
+			const u32 batch_size = 64, batch_count = 2000;
+			std::vector<std::thread> threads;
+
+			auto begin = std::chrono::steady_clock::now();
+			for(u32 t = 0; t < thread_count; t++) {
+				threads.emplace_back([t]() {
+					void* ptrs[batch_size];
+					u32 random_state = t + 1;
+
+					for(u32 batch = 0; batch < batch_count; batch++) {
+						for(u32 i = 0; i < batch_size; i++)
+							ptrs[i] = mem_allocate(1 + test_random_u32(&random_state) % 512);
+						for(u32 i = 0; i < batch_size; i++)
+							mem_free(ptrs[i]);
+					}
+
+					allocator_flush_thread_cache();
+				});
+			}
+
+			for(auto& thread : threads)
+				thread.join();
+			auto end = std::chrono::steady_clock::now();
+
+			const f64 operations = 2.0 * batch_size * batch_count * thread_count;
+			const f64 seconds    = std::chrono::duration<f64>(end - begin).count();
+			log_message("(memory_run_benchmarks) {} threads, thread caches {}: {:.2f} Mops/s, {} lock acquisitions, {} contended\n",
+				thread_count, thread_caches_enabled ? "on" : "off", operations / seconds / 1e6,
+				allocator.lock_acquisitions, allocator.lock_contentions);
+		}
+
+		static void benchmark_allocator_create(u64 permanent_storage_bytes)
+		{
+			auto begin = std::chrono::steady_clock::now();
+			auto allocator = allocator_create(permanent_storage_bytes, 64 * 1024 * 1024);
+			auto end = std::chrono::steady_clock::now();
+			allocator_cleanup(&allocator);
+
+			log_message("(memory_run_benchmarks) allocator_create with {} MB of permanent storage: {:.1f} us\n",
+				permanent_storage_bytes / (1024 * 1024), std::chrono::duration<f64, std::micro>(end - begin).count());
+		}
+
+		void memory_run_benchmarks()
+		{
+			benchmark_allocator_create(64ull * 1024 * 1024);
+			benchmark_allocator_create(sizeof(void*) == 8 ? 64ull * 1024 * 1024 * 1024 : 1024ull * 1024 * 1024);
+
+			benchmark_first_fit_lookup(1000,  2000);
+			benchmark_first_fit_lookup(10000, 500);
+			benchmark_first_fit_lookup(50000, 100);
+
+			u32 max_thread_count = std::thread::hardware_concurrency();
+			if(max_thread_count == 0) max_thread_count = 4;
+			for(u32 thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+				benchmark_thread_scaling(thread_count, false);
+				benchmark_thread_scaling(thread_count, true);
+			}
+		}
+	}
+
+	static void* storage_reserve(u64 bytes)
+	{
+#ifdef WINDOWS_OS
+		return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+		void* buffer = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		return buffer != MAP_FAILED ? buffer : nullptr;
+#endif
+	}
+
+	static void storage_release(void* buffer, u64 bytes)
+	{
+#ifdef WINDOWS_OS
+		VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+		munmap(buffer, bytes);
+#endif
+	}
+
+	//Tries the explicit huge pages first, they are taken from the OS pool right away, so a pool too small
+	//fails here instead of faulting later. Linux then falls back to a huge page aligned reservation which
+	//the kernel is asked to back with transparent huge pages
+	static void storage_reserve_huge(MemoryStorage* storage, u64 bytes)
+	{
+#ifdef WINDOWS_OS
+		//Large pages can't be committed on demand, the whole storage is committed with the reservation.
+		//The process needs SeLockMemoryPrivilege, otherwise the regular reservation is used
+		const u64 large_page_size = GetLargePageMinimum();
+		if(!large_page_size) return;
+
+		const u64 reserved_bytes = align_up(bytes, large_page_size);
+		storage->buffer = VirtualAlloc(nullptr, reserved_bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if(storage->buffer) {
+			storage->commit_granularity = large_page_size;
+			storage->committed          = reserved_bytes;
+			storage->pages              = STORAGE_PAGES_EXPLICIT_HUGE;
+		}
+#else
+		const u64 reserved_bytes = align_up(bytes, storage_huge_page_size);
+		void* buffer = mmap(nullptr, reserved_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(buffer != MAP_FAILED) {
+			storage->buffer             = buffer;
+			storage->commit_granularity = storage_huge_page_size;
+			storage->pages              = STORAGE_PAGES_EXPLICIT_HUGE;
+			return;
+		}
+
+		//Reserve one more huge page and trim the sides, so that the buffer starts on a huge page boundary
+		buffer = mmap(nullptr, reserved_bytes + storage_huge_page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(buffer == MAP_FAILED) return;
+
+		u8* buffer_u8  = static_cast<u8*>(buffer);
+		u8* aligned_u8 = reinterpret_cast<u8*>(align_up(reinterpret_cast<std::uintptr_t>(buffer_u8), storage_huge_page_size));
+		if(aligned_u8 != buffer_u8)
+			munmap(buffer_u8, aligned_u8 - buffer_u8);
+		if(aligned_u8 + reserved_bytes != buffer_u8 + reserved_bytes + storage_huge_page_size)
+			munmap(aligned_u8 + reserved_bytes, buffer_u8 + storage_huge_page_size - aligned_u8);
+
+		storage->buffer             = aligned_u8;
+		storage->commit_granularity = storage_huge_page_size;
+		storage->pages              = madvise(aligned_u8, reserved_bytes, MADV_HUGEPAGE) == 0 ? STORAGE_PAGES_TRANSPARENT_HUGE : STORAGE_PAGES_REGULAR;
+#endif
+	}
+
+	static MemoryStorage storage_create(u64 bytes, bool huge_pages)
+	{
+		MemoryStorage storage = {};
+		storage.size = bytes;
+		if(huge_pages)
+			storage_reserve_huge(&storage, bytes);
+
+		if(!storage.buffer) {
+			storage.buffer             = storage_reserve(align_up(bytes, storage_commit_granularity));
+			storage.commit_granularity = storage_commit_granularity;
+		}
+
+		assert(storage.buffer, "could not reserve the address space for the storage");
+		return storage;
+	}
+
+	static void storage_cleanup(MemoryStorage* storage)
+	{
+		storage_release(storage->buffer, align_up(storage->size, storage->commit_granularity));
+		*storage = {};
+	}
+
+	//Makes the first bytes of the storage accessible. The OS maps the committed pages only when they
+	//are touched for the first time, and they are already zeroed by then
+	static bool storage_commit(MemoryStorage* storage, u64 bytes)
+	{
+		if(bytes <= storage->committed)
+			return true;
+
+		const u64 new_committed = align_up(bytes, storage->commit_granularity);
+		u8* commit_start        = static_cast<u8*>(storage->buffer) + storage->committed;
+		const u64 commit_size   = new_committed - storage->committed;
+
+#ifdef WINDOWS_OS
+		if(!VirtualAlloc(commit_start, commit_size, MEM_COMMIT, PAGE_READWRITE))
+			return false;
+#else
+		if(mprotect(commit_start, commit_size, PROT_READ | PROT_WRITE) != 0)
+			return false;
+#endif
+
+		storage->committed = new_committed;
+		return true;
+	}
+
+	//Faults the committed pages in without changing their content, the allocator can be using them already
+	static void storage_populate(u8* start, u64 bytes)
+	{
+#ifdef LINUX_OS
+		if(madvise(start, bytes, MADV_POPULATE_WRITE) == 0)
+			return;
+#endif
+
+		//An atomic or with zero is a write for the OS but leaves the bytes written by other threads untouched
+		for(u64 offset = 0; offset < bytes; offset += storage_page_size)
+			std::atomic_ref(start[offset]).fetch_or(0, std::memory_order_relaxed);
+	}
+
+	//Ids of the allocators which were created and not cleaned up yet, guarded by g_engine_allocator_mutex. The
+	//threads read it on exit, before giving their scratch arenas back
+	static std::vector<u32> g_live_allocator_ids;
+
+	static bool is_allocator_id_live(u32 id)
+	{
+		return std::find(g_live_allocator_ids.begin(), g_live_allocator_ids.end(), id) != g_live_allocator_ids.end();
+	}
+
+	Allocator allocator_create(u64 permanent_storage_bytes, u64 temporary_storage_bytes, u64 frame_storage_bytes, SegmentIndexType segment_index_type, bool huge_pages)
+	{
+		static std::atomic<u32> allocator_id_counter = 0;
+
+		Allocator allocator = {};
+		//INFO @C7 nothing gets touched here, so the creation time and the memory footprint do not depend on the
+		//storage sizes anymore
+		//The scratch arenas commit their own pages, so they need to start on a huge page boundary as well
+		allocator.permanent_storage = storage_create(permanent_storage_bytes, huge_pages);
+		allocator.scratch_arena_size = align_up(temporary_storage_bytes, huge_pages ? storage_huge_page_size : storage_commit_granularity);
+		allocator.temporary_storage = storage_create(allocator.scratch_arena_size * scratch_arena_max_count, huge_pages);
+		allocator.frame_storages[0] = storage_create(frame_storage_bytes, huge_pages);
+		allocator.frame_storages[1] = storage_create(frame_storage_bytes, huge_pages);
+		allocator.handle_table      = storage_create(handle_table_max_entries * sizeof(_HandleEntry));
+		allocator.segment_index.type = segment_index_type;
+
+		//The span map is committed all at once, its pages are mapped as the spans get carved
+		const u64 span_count = (permanent_storage_bytes + thread_cache_span_size - 1) / thread_cache_span_size;
+		MemoryStorage span_classes_storage = storage_create(span_count);
+		bool span_classes_committed = storage_commit(&span_classes_storage, span_count);
+		assert(span_classes_committed, "could not commit the span map");
+		allocator.span_classes = static_cast<u8*>(span_classes_storage.buffer);
+
+		allocator.id = ++allocator_id_counter;
+		allocator.thread_caches_enabled = true;
+		{
+			std::lock_guard lock(g_engine_allocator_mutex);
+			g_live_allocator_ids.push_back(allocator.id);
+		}
+
+		return allocator;
+	}
+
+	void allocator_cleanup(Allocator* allocator)
+	{
+		if(!allocator) return;
+
+		//From here on the exiting threads leave the arenas of this allocator alone
+		{
+			std::lock_guard lock(g_engine_allocator_mutex);
+			auto id = std::find(g_live_allocator_ids.begin(), g_live_allocator_ids.end(), allocator->id);
+			if(id != g_live_allocator_ids.end())
+				g_live_allocator_ids.erase(id);
+		}
+
+		if(allocator->prefault_thread.joinable()) {
+			std::atomic_ref(allocator->prefault_cancelled).store(true, std::memory_order_relaxed);
+			allocator->prefault_thread.join();
+		}
+
+		const u64 span_count = (allocator->permanent_storage.size + thread_cache_span_size - 1) / thread_cache_span_size;
+		storage_release(allocator->span_classes, align_up(span_count, storage_commit_granularity));
+
+		storage_cleanup(&allocator->permanent_storage);
+		storage_cleanup(&allocator->temporary_storage);
+		storage_cleanup(&allocator->frame_storages[0]);
+		storage_cleanup(&allocator->frame_storages[1]);
+		storage_cleanup(&allocator->handle_table);
+		allocator->segment_index.cleanup();
+	}
+
+	static std::unique_lock<std::mutex> allocator_lock(Allocator* allocator)
+	{
+		std::unique_lock lock(g_engine_allocator_mutex, std::try_to_lock);
+		if(!lock.owns_lock()) {
+			lock.lock();
+			allocator->lock_contentions++;
+		}
+
+		allocator->lock_acquisitions++;
+		return lock;
+	}
+
+	//Both the permanent_storage functions require g_engine_allocator_mutex to be locked
+	//Requires g_engine_allocator_mutex to be locked
+	static bool tag_stats_fit_hard_budget(Allocator* allocator, MemoryTag tag, u64 bytes)
+	{
+		const auto& stats = allocator->tag_stats[tag];
+		if(!stats.hard_budget || stats.live_bytes + bytes <= stats.hard_budget)
+			return true;
+
+		if(allocator->budget_callback)
+			allocator->budget_callback(tag, stats.live_bytes + bytes, stats.hard_budget, true);
+
+		return false;
+	}
+
+	//Requires g_engine_allocator_mutex to be locked
+	static void tag_stats_update(Allocator* allocator, MemoryTag tag, u64 old_bytes, u64 new_bytes)
+	{
+		auto& stats = allocator->tag_stats[tag];
+		const u64 old_live_bytes = stats.live_bytes;
+		stats.live_bytes = stats.live_bytes - old_bytes + new_bytes;
+		if(stats.live_bytes > stats.peak_bytes)
+			stats.peak_bytes = stats.live_bytes;
+
+		if(stats.soft_budget && old_live_bytes <= stats.soft_budget && stats.live_bytes > stats.soft_budget && allocator->budget_callback)
+			allocator->budget_callback(tag, stats.live_bytes, stats.soft_budget, false);
+	}
+
+	static u32 size_histogram_bucket(u64 bytes)
+	{
+		return static_cast<u32>(std::bit_width(bytes - 1));
+	}
+
+	//check_hard_budget is false only when the caller already checked the budget for these bytes
+	static void* permanent_storage_allocate(Allocator* allocator, u32 bytes, u32 alignment, MemoryTag tag, bool check_hard_budget)
+	{
+		//Every block needs to fit the link of the remote free list
+		if(bytes < permanent_storage_min_block_size)
+			bytes = permanent_storage_min_block_size;
+
+		//the allocation first tries to cover the holes generated from deallocations, the lookup descends
+		//the tree following the gap information of each subtree. If no hole is big enough the allocation
+		//is pushed at the end of the tree. Both the red-black tree and the B+-tree balance themselves
+		auto& segment_index = allocator->segment_index;
+		u8* storage_u8 = reinterpret_cast<u8*>(allocator->permanent_storage.buffer);
+
+		if(check_hard_budget && !tag_stats_fit_hard_budget(allocator, tag, bytes))
+			return nullptr;
+
+		u64 new_allocation_start = 0;
+		if(!segment_index.find_first_fit(bytes, &new_allocation_start, alignment)) {
+			auto last_allocation_node = segment_index.find_last_node();
+			if(last_allocation_node)
+				new_allocation_start = align_up(last_allocation_node->segment.start + last_allocation_node->segment.size, alignment);
+		}
+
+		if(new_allocation_start + bytes > allocator->permanent_storage.size)
+			return nullptr;
+
+		if(!storage_commit(&allocator->permanent_storage, new_allocation_start + bytes))
+			return nullptr;
+
+		SegmentRecord* node = segment_index.add_node(new_allocation_start, bytes);
+		node->tag = tag;
+		allocator->permanent_storage.used += bytes;
+		allocator->tag_stats[tag].live_allocations++;
+		tag_stats_update(allocator, tag, 0, bytes);
+
+		return storage_u8 + new_allocation_start;
+	}
+
+	static void permanent_storage_free(Allocator* allocator, u64 node_start)
+	{
+		auto& segment_index = allocator->segment_index;
+		auto node = segment_index.find_node(node_start);
+
+		if(!node) {
+			log_message("user tried to free a nullptr node");
+			return;
+		}
+
+		assert(!node->handle, "blocks allocated with mem_allocate_handle need to be freed with mem_free_handle");
+		const MemoryTag tag = static_cast<MemoryTag>(node->tag);
+		allocator->permanent_storage.used -= node->segment.size;
+		allocator->tag_stats[tag].live_allocations--;
+		tag_stats_update(allocator, tag, node->segment.size, 0);
+		segment_index.remove_node(node_start);
+	}
+
+	//Open addressing set of the permanent storage blocks the thread allocated from one allocator. Its own
+	//frees of them are released right away, only the blocks of other threads go through the remote list.
+	//A block freed by another thread keeps its entry until the address is allocated again, which at worst
+	//releases a later free directly. Using another allocator starts over with an empty set
+	struct _ThreadBlockSet
+	{
+		u32    allocator_id;
+		u32    count;
+		u32    capacity;
+		void** blocks;
+
+		//malloc keeps the growths out of the operator new frame audit
+		~_ThreadBlockSet() { std::free(blocks); }
+	};
+
+	static thread_local _ThreadBlockSet t_thread_blocks = {};
+
+	static u32 thread_block_slot(void* ptr, u32 capacity)
+	{
+		return static_cast<u32>((reinterpret_cast<std::uintptr_t>(ptr) >> 4) * 0x9E3779B97F4A7C15ull >> 32) & (capacity - 1);
+	}
+
+	//False when the block was already in the set
+	static bool thread_block_set_insert(void** blocks, u32 capacity, void* ptr)
+	{
+		u32 slot = thread_block_slot(ptr, capacity);
+		while(blocks[slot] && blocks[slot] != ptr)
+			slot = (slot + 1) & (capacity - 1);
+
+		const bool inserted = !blocks[slot];
+		blocks[slot] = ptr;
+		return inserted;
+	}
+
+	static void thread_blocks_add(Allocator* allocator, void* ptr)
+	{
+		auto& set = t_thread_blocks;
+		if(set.allocator_id != allocator->id) {
+			if(set.blocks)
+				std::memset(set.blocks, 0, set.capacity * sizeof(void*));
+			set.allocator_id = allocator->id;
+			set.count = 0;
+		}
+
+		//Kept at most half full so that the probes stay short
+		if((set.count + 1) * 2 > set.capacity) {
+			const u32 capacity = set.capacity ? set.capacity * 2 : 64;
+			auto blocks = static_cast<void**>(std::calloc(capacity, sizeof(void*)));
+			assert(blocks, "the blocks of the thread can't be tracked\n");
+			for(u32 i = 0; i < set.capacity; i++) {
+				if(set.blocks[i])
+					thread_block_set_insert(blocks, capacity, set.blocks[i]);
+			}
+			std::free(set.blocks);
+			set.blocks   = blocks;
+			set.capacity = capacity;
+		}
+
+		if(thread_block_set_insert(set.blocks, set.capacity, ptr))
+			set.count++;
+	}
+
+	//False when the block was allocated by another thread
+	static bool thread_blocks_remove(Allocator* allocator, void* ptr)
+	{
+		auto& set = t_thread_blocks;
+		if(set.allocator_id != allocator->id || !set.count)
+			return false;
+
+		u32 slot = thread_block_slot(ptr, set.capacity);
+		while(set.blocks[slot] != ptr) {
+			if(!set.blocks[slot])
+				return false;
+			slot = (slot + 1) & (set.capacity - 1);
+		}
+
+		//The entries after the hole which probed over it are shifted back, so no tombstone is needed
+		set.blocks[slot] = nullptr;
+		set.count--;
+		for(u32 next = (slot + 1) & (set.capacity - 1); set.blocks[next]; next = (next + 1) & (set.capacity - 1)) {
+			const u32 home = thread_block_slot(set.blocks[next], set.capacity);
+			if(((next - home) & (set.capacity - 1)) >= ((next - slot) & (set.capacity - 1))) {
+				set.blocks[slot] = set.blocks[next];
+				set.blocks[next] = nullptr;
+				slot = next;
+			}
+		}
+		return true;
+	}
+
+	//Blocks allocated with an alignment of 1 can start anywhere, so the link is copied in and out of them
+	static void push_remote_free(Allocator* allocator, void* ptr)
+	{
+		auto block = static_cast<_FreeBlock*>(ptr);
+		std::atomic_ref remote_free_blocks(allocator->remote_free_blocks);
+		_FreeBlock* head = remote_free_blocks.load(std::memory_order_relaxed);
+		do {
+			std::memcpy(ptr, &head, sizeof(head));
+		} while(!remote_free_blocks.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	//Requires g_engine_allocator_mutex to be locked. The whole list is taken at once, so the pushing
+	//threads never race with the release of a single block
+	static void drain_remote_frees(Allocator* allocator)
+	{
+		std::atomic_ref remote_free_blocks(allocator->remote_free_blocks);
+		if(!remote_free_blocks.load(std::memory_order_relaxed))
+			return;
+
+		u8* storage_u8 = static_cast<u8*>(allocator->permanent_storage.buffer);
+		_FreeBlock* block = remote_free_blocks.exchange(nullptr, std::memory_order_acquire);
+		while(block) {
+			_FreeBlock* next = nullptr;
+			std::memcpy(&next, block, sizeof(next));
+			permanent_storage_free(allocator, reinterpret_cast<u8*>(block) - storage_u8);
+			block = next;
+		}
+	}
+
+	static u32 thread_cache_class_index(u32 bytes)
+	{
+		u32 class_index = 0;
+		for(u32 block_size = thread_cache_min_block_size; block_size < bytes; block_size <<= 1)
+			class_index++;
+
+		return class_index;
+	}
+
+	//An entry of span_classes packs the class plus one in its low bits and the tag of the span in the high ones
+	static constexpr u32 span_class_bits = 4;
+	static_assert(thread_cache_class_count < (1 << span_class_bits) && MEMORY_TAG_COUNT <= (1 << (8 - span_class_bits)),
+		"the class and the tag of a span need to fit in a byte");
+
+	static u8 span_entry_pack(MemoryTag tag, u32 class_index)
+	{
+		return static_cast<u8>((tag << span_class_bits) | (class_index + 1));
+	}
+
+	static u32 span_entry_class(u8 span_entry)
+	{
+		return (span_entry & ((1 << span_class_bits) - 1)) - 1;
+	}
+
+	static MemoryTag span_entry_tag(u8 span_entry)
+	{
+		return static_cast<MemoryTag>(span_entry >> span_class_bits);
+	}
+
+	//Caches the last allocator the thread used, the id is compared instead of the pointer because
+	//allocators can be recreated at the same address
+	struct _ThreadCacheBinding
+	{
+		u32          allocator_id;
+		ThreadCache* cache;
+	};
+
+	static thread_local _ThreadCacheBinding t_thread_cache_binding = {};
+
+	static ThreadCache* get_thread_cache(Allocator* allocator)
+	{
+		if(t_thread_cache_binding.allocator_id == allocator->id)
+			return t_thread_cache_binding.cache;
+
+		//The thread either never used this allocator or switched between multiple ones, so the registered
+		//caches are checked before creating a new one
+		auto lock = allocator_lock(allocator);
+		const auto this_thread = std::this_thread::get_id();
+
+		ThreadCache* cache = allocator->thread_caches;
+		while(cache && cache->owner_thread != this_thread)
+			cache = cache->next;
+
+		if(!cache) {
+			cache = static_cast<ThreadCache*>(permanent_storage_allocate(allocator, sizeof(ThreadCache), alignof(ThreadCache)));
+			if(!cache) return nullptr;
+
+			new (cache) ThreadCache{};
+			cache->owner_thread = this_thread;
+			cache->next = allocator->thread_caches;
+			allocator->thread_caches = cache;
+		}
+
+		t_thread_cache_binding.allocator_id = allocator->id;
+		t_thread_cache_binding.cache        = cache;
+		return cache;
+	}
+
+	//Requires g_engine_allocator_mutex to be locked. The span is a single allocation of the tag, so it is
+	//accounted and checked against the budgets like any other block
+	static bool carve_thread_cache_span(Allocator* allocator, MemoryTag tag, u32 class_index)
+	{
+		//Without room for a whole span the regular path serves the block, and calls the budget callback
+		//only when the block itself does not fit
+		const auto& stats = allocator->tag_stats[tag];
+		if(stats.hard_budget && stats.live_bytes + thread_cache_span_size > stats.hard_budget)
+			return false;
+
+		u8* span = static_cast<u8*>(permanent_storage_allocate(allocator, thread_cache_span_size, thread_cache_span_size, tag, false));
+		if(!span) return false;
+
+		u8* storage_u8 = static_cast<u8*>(allocator->permanent_storage.buffer);
+		allocator->span_classes[(span - storage_u8) / thread_cache_span_size] = span_entry_pack(tag, class_index);
+
+		const u32 block_size = thread_cache_min_block_size << class_index;
+		_FreeBlock*& central_free_blocks = allocator->central_free_blocks[tag][class_index];
+		for(u32 offset = 0; offset < thread_cache_span_size; offset += block_size) {
+			auto block = reinterpret_cast<_FreeBlock*>(span + offset);
+			block->next = central_free_blocks;
+			central_free_blocks = block;
+		}
+
+		return true;
+	}
+
+	static void* thread_cache_allocate(Allocator* allocator, u32 bytes, MemoryTag tag)
+	{
+		ThreadCache* cache = get_thread_cache(allocator);
+		if(!cache) return nullptr;
+
+		const u32 class_index = thread_cache_class_index(bytes);
+		_FreeBlock*& free_blocks = cache->free_blocks[tag][class_index];
+		u32& free_block_count    = cache->free_block_count[tag][class_index];
+
+		if(!free_blocks) {
+			auto lock = allocator_lock(allocator);
+			_FreeBlock*& central_free_blocks = allocator->central_free_blocks[tag][class_index];
+			for(u32 i = 0; i < thread_cache_batch_size; i++) {
+				if(!central_free_blocks && !carve_thread_cache_span(allocator, tag, class_index))
+					break;
+
+				_FreeBlock* block   = central_free_blocks;
+				central_free_blocks = block->next;
+				block->next         = free_blocks;
+				free_blocks         = block;
+				free_block_count++;
+			}
+
+			//Not even a span fits in the permanent storage or in the budget, the regular allocation path handles this
+			if(!free_blocks) return nullptr;
+		}
+
+		_FreeBlock* block = free_blocks;
+		free_blocks = block->next;
+		free_block_count--;
+
+		auto& class_allocations = cache->class_allocations[class_index];
+		class_allocations.store(class_allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return block;
+	}
+
+	//Requires g_engine_allocator_mutex to be locked
+	static void thread_cache_drain(Allocator* allocator, ThreadCache* cache, MemoryTag tag, u32 class_index, u32 block_count)
+	{
+		_FreeBlock*& free_blocks         = cache->free_blocks[tag][class_index];
+		_FreeBlock*& central_free_blocks = allocator->central_free_blocks[tag][class_index];
+		for(u32 i = 0; i < block_count && free_blocks; i++) {
+			_FreeBlock* block = free_blocks;
+			free_blocks = block->next;
+			cache->free_block_count[tag][class_index]--;
+
+			block->next = central_free_blocks;
+			central_free_blocks = block;
+		}
+	}
+
+	static void thread_cache_free(Allocator* allocator, void* ptr, u8 span_entry)
+	{
+		ThreadCache* cache = get_thread_cache(allocator);
+		auto block = static_cast<_FreeBlock*>(ptr);
+		const MemoryTag tag   = span_entry_tag(span_entry);
+		const u32 class_index = span_entry_class(span_entry);
+
+		if(!cache) {
+			auto lock = allocator_lock(allocator);
+			block->next = allocator->central_free_blocks[tag][class_index];
+			allocator->central_free_blocks[tag][class_index] = block;
+			return;
+		}
+
+		block->next = cache->free_blocks[tag][class_index];
+		cache->free_blocks[tag][class_index] = block;
+
+		//Keep half of the blocks so that alternating allocations and frees do not bounce on the lock
+		if(++cache->free_block_count[tag][class_index] > thread_cache_max_class_blocks) {
+			auto lock = allocator_lock(allocator);
+			thread_cache_drain(allocator, cache, tag, class_index, thread_cache_max_class_blocks - thread_cache_batch_size);
+		}
+	}
+
+	void allocator_prefault(Allocator* allocator, u64 permanent_storage_bytes)
+	{
+		assert(!allocator->prefault_thread.joinable(), "the previous prefault of the allocator is still running\n");
+		auto& permanent_storage = allocator->permanent_storage;
+#ifdef WINDOWS_OS
+		//The large pages were committed and locked with the reservation, there is nothing to fault in
+		if(permanent_storage.pages == STORAGE_PAGES_EXPLICIT_HUGE)
+			return;
+#endif
+
+		const u64 bytes = permanent_storage_bytes < permanent_storage.size ? permanent_storage_bytes : permanent_storage.size;
+		{
+			auto lock = allocator_lock(allocator);
+			if(!storage_commit(&permanent_storage, bytes)) {
+				log_message("could not commit the pages to prefault\n");
+				return;
+			}
+		}
+
+		//The pages are faulted in small steps, so that allocator_cleanup does not wait for the whole range
+		allocator->prefault_cancelled = false;
+		u8* buffer = static_cast<u8*>(permanent_storage.buffer);
+		allocator->prefault_thread = std::thread([allocator, buffer, bytes]() {
+			for(u64 offset = 0; offset < bytes && !std::atomic_ref(allocator->prefault_cancelled).load(std::memory_order_relaxed); offset += storage_huge_page_size)
+				storage_populate(buffer + offset, bytes - offset < storage_huge_page_size ? bytes - offset : storage_huge_page_size);
+		});
+	}
+
+	void allocator_flush_thread_cache()
+	{
+		if(!g_engine_allocator || t_thread_cache_binding.allocator_id != g_engine_allocator->id)
+			return;
+
+		ThreadCache* cache = t_thread_cache_binding.cache;
+		auto lock = allocator_lock(g_engine_allocator);
+		for(u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+			for(u32 i = 0; i < thread_cache_class_count; i++)
+				thread_cache_drain(g_engine_allocator, cache, static_cast<MemoryTag>(tag), i, cache->free_block_count[tag][i]);
+		}
+	}
+
+	struct _ScratchArenaBinding
+	{
+		u32           allocator_id;
+		Allocator*    allocator;
+		ScratchArena* arena;
+	};
+
+	static thread_local _ScratchArenaBinding t_scratch_arena_binding = {};
+
+	//Gives the arenas of an exiting thread back to the allocators they were carved from, so that short lived
+	//threads do not exhaust scratch_arena_max_count. Kept apart from the binding, which stays trivial to read
+	//on the fast path. An allocator which was cleaned up in the meantime is skipped through its id
+	struct _ScratchArenaRelease
+	{
+		static constexpr u32 max_allocators = 8;
+
+		_ScratchArenaBinding bindings[max_allocators];
+		u32 binding_count;
+
+		void track(const _ScratchArenaBinding& binding)
+		{
+			for(u32 i = 0; i < binding_count; i++) {
+				if(bindings[i].allocator_id == binding.allocator_id)
+					return;
+			}
+
+			//The oldest allocator is forgotten, its arena stays with this thread until it is cleaned up
+			if(binding_count == max_allocators) {
+				std::memmove(bindings, bindings + 1, (max_allocators - 1) * sizeof(_ScratchArenaBinding));
+				binding_count--;
+			}
+			bindings[binding_count++] = binding;
+		}
+
+		~_ScratchArenaRelease()
+		{
+			std::lock_guard lock(g_engine_allocator_mutex);
+			for(u32 i = 0; i < binding_count; i++) {
+				if(!is_allocator_id_live(bindings[i].allocator_id) || bindings[i].allocator->id != bindings[i].allocator_id)
+					continue;
+
+				//The committed pages are kept for the next thread
+				ScratchArena* arena = bindings[i].arena;
+				arena->owner_thread = std::thread::id();
+				arena->storage.used = 0;
+			}
+			t_scratch_arena_binding = {};
+		}
+	};
+
+	static thread_local _ScratchArenaRelease t_scratch_arena_release;
+
+	static MemoryStorage* get_scratch_storage(Allocator* allocator)
+	{
+		if(t_scratch_arena_binding.allocator_id == allocator->id)
+			return &t_scratch_arena_binding.arena->storage;
+
+		//Same as the thread caches, an arena which was registered by this thread is reused, otherwise the one
+		//of a thread which exited
+		auto lock = allocator_lock(allocator);
+		const auto this_thread = std::this_thread::get_id();
+
+		ScratchArena* arena = allocator->scratch_arenas;
+		ScratchArena* released_arena = nullptr;
+		while(arena && arena->owner_thread != this_thread) {
+			if(!released_arena && arena->owner_thread == std::thread::id())
+				released_arena = arena;
+			arena = arena->next;
+		}
+
+		if(!arena && released_arena) {
+			arena = released_arena;
+			arena->owner_thread = this_thread;
+		} else if(!arena) {
+			auto& temporary_storage = allocator->temporary_storage;
+			assert(temporary_storage.used + allocator->scratch_arena_size <= temporary_storage.size, "too many threads are using the temporary storage\n");
+
+			arena = static_cast<ScratchArena*>(permanent_storage_allocate(allocator, sizeof(ScratchArena), alignof(ScratchArena)));
+			assert(arena, "there is not enough space in the permanent storage for the scratch arena\n");
+
+			//The arena commits its own pages, the reservation only keeps track of the carved bytes
+			new (arena) ScratchArena{};
+			arena->storage.buffer = static_cast<u8*>(temporary_storage.buffer) + temporary_storage.used;
+			arena->storage.size   = allocator->scratch_arena_size;
+			arena->storage.pages  = temporary_storage.pages;
+			arena->storage.commit_granularity = temporary_storage.commit_granularity;
+			//Large pages on Windows are committed with the reservation
+			if(temporary_storage.committed > temporary_storage.used)
+				arena->storage.committed = temporary_storage.committed - temporary_storage.used < allocator->scratch_arena_size ? temporary_storage.committed - temporary_storage.used : allocator->scratch_arena_size;
+			arena->owner_thread   = this_thread;
+			arena->next           = allocator->scratch_arenas;
+			allocator->scratch_arenas = arena;
+			temporary_storage.used += allocator->scratch_arena_size;
+		}
+
+		t_scratch_arena_binding.allocator_id = allocator->id;
+		t_scratch_arena_binding.allocator    = allocator;
+		t_scratch_arena_binding.arena        = arena;
+		//Using the release object registers its destructor for this thread
+		t_scratch_arena_release.track(t_scratch_arena_binding);
+		return &arena->storage;
+	}
+
+	static thread_local MemoryTag t_memory_tag = MEMORY_TAG_UNTAGGED;
+
+	MemoryTagScope::MemoryTagScope(MemoryTag tag) : previous_tag(t_memory_tag)
+	{
+		t_memory_tag = tag;
+	}
+
+	MemoryTagScope::~MemoryTagScope()
+	{
+		t_memory_tag = previous_tag;
+	}
+
+	enum _AllocationSampleState : u32
+	{
+		ALLOCATION_SAMPLE_WRITING = 0x00,
+		ALLOCATION_SAMPLE_LIVE    = 0x01,
+		ALLOCATION_SAMPLE_FREED   = 0x02,
+		//Temporary and frame allocations are released in bulk, so they are never tracked as live
+		ALLOCATION_SAMPLE_UNTRACKED = 0x03,
+	};
+
+	struct _AllocationSample
+	{
+		void* frames[memory_profiler_max_frames];
+		u64   weight;
+		u32   frame_count;
+		std::atomic<u32> state;
+	};
+
+	//Open addressing entry from the address of a live sample to its index, freed entries keep the probe
+	//chains intact with the tombstone address
+	struct _SampledAddress
+	{
+		std::atomic<std::uintptr_t> address;
+		u32 sample_index;
+	};
+
+	static constexpr u32 memory_profiler_address_capacity = memory_profiler_max_samples * 2;
+	static constexpr std::uintptr_t sampled_address_tombstone = 1;
+
+	struct _MemoryProfiler
+	{
+		std::atomic<u64> sample_interval;
+		std::atomic<u32> sample_count;
+		std::atomic<u32> live_samples;
+		//Committed once by the first start and reused afterwards, the profiler never goes through the
+		//allocation functions it samples
+		MemoryStorage samples_storage;
+		MemoryStorage addresses_storage;
+	};
+
+	static _MemoryProfiler g_memory_profiler = {};
+	//Bytes the thread can still allocate before its next sample
+	static thread_local s64 t_profiler_bytes_until_sample = 0;
+
+	//Never inlined, so that skipped_frames counts the callers to leave out after this function
+	MEMORY_NOINLINE static u32 capture_call_stack(void** frames, u32 max_frames, u32 skipped_frames)
+	{
+#ifdef WINDOWS_OS
+		return CaptureStackBackTrace(skipped_frames + 1, max_frames, frames, nullptr);
+#else
+		void* captured_frames[memory_profiler_max_frames + 8];
+		const u32 skipped = skipped_frames + 1;
+		const s32 captured = backtrace(captured_frames, static_cast<s32>(max_frames + skipped));
+		const u32 frame_count = captured > static_cast<s32>(skipped) ? static_cast<u32>(captured) - skipped : 0;
+		std::memcpy(frames, captured_frames + skipped, frame_count * sizeof(void*));
+		return frame_count;
+#endif
+	}
+
+	MEMORY_NOINLINE static void profiler_take_sample(void* ptr, u64 weight, bool track_lifetime)
+	{
+		const u32 sample_index = g_memory_profiler.sample_count.fetch_add(1, std::memory_order_relaxed);
+		if(sample_index >= memory_profiler_max_samples)
+			return;
+
+		auto samples = static_cast<_AllocationSample*>(g_memory_profiler.samples_storage.buffer);
+		_AllocationSample& sample = samples[sample_index];
+		sample.weight      = weight;
+		sample.frame_count = capture_call_stack(sample.frames, memory_profiler_max_frames, 1);
+
+		if(track_lifetime) {
+			auto addresses = static_cast<_SampledAddress*>(g_memory_profiler.addresses_storage.buffer);
+			const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(ptr);
+			for(u32 i = (address >> 4) % memory_profiler_address_capacity;; i = (i + 1) % memory_profiler_address_capacity) {
+				std::uintptr_t expected = 0;
+				if(addresses[i].address.compare_exchange_strong(expected, address, std::memory_order_relaxed)) {
+					addresses[i].sample_index = sample_index;
+					break;
+				}
+			}
+
+			g_memory_profiler.live_samples.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		sample.state.store(track_lifetime ? ALLOCATION_SAMPLE_LIVE : ALLOCATION_SAMPLE_UNTRACKED, std::memory_order_release);
+	}
+
+	//A relaxed load and a branch while the profiler is stopped
+	static void profiler_on_allocate(void* ptr, u64 bytes, bool track_lifetime)
+	{
+		const u64 sample_interval = g_memory_profiler.sample_interval.load(std::memory_order_relaxed);
+		if(!sample_interval || !ptr)
+			return;
+
+		t_profiler_bytes_until_sample -= static_cast<s64>(bytes);
+		if(t_profiler_bytes_until_sample > 0)
+			return;
+
+		t_profiler_bytes_until_sample = static_cast<s64>(sample_interval);
+		profiler_take_sample(ptr, bytes > sample_interval ? bytes : sample_interval, track_lifetime);
+	}
+
+	//Frees keep updating the live samples after the profiler is stopped, until it starts again
+	static void profiler_on_free(void* ptr)
+	{
+		if(!ptr || !g_memory_profiler.live_samples.load(std::memory_order_relaxed))
+			return;
+
+		auto addresses = static_cast<_SampledAddress*>(g_memory_profiler.addresses_storage.buffer);
+		auto samples   = static_cast<_AllocationSample*>(g_memory_profiler.samples_storage.buffer);
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(ptr);
+		for(u32 i = (address >> 4) % memory_profiler_address_capacity;; i = (i + 1) % memory_profiler_address_capacity) {
+			std::uintptr_t entry_address = addresses[i].address.load(std::memory_order_relaxed);
+			if(!entry_address)
+				return;
+
+			if(entry_address == address && addresses[i].address.compare_exchange_strong(entry_address, sampled_address_tombstone, std::memory_order_relaxed)) {
+				samples[addresses[i].sample_index].state.store(ALLOCATION_SAMPLE_FREED, std::memory_order_relaxed);
+				g_memory_profiler.live_samples.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+
+	void memory_profiler_start(u64 sample_interval_bytes)
+	{
+		assert(sample_interval_bytes, "the sample interval needs to be at least one byte");
+		g_memory_profiler.sample_interval.store(0, std::memory_order_relaxed);
+
+		auto& samples_storage   = g_memory_profiler.samples_storage;
+		auto& addresses_storage = g_memory_profiler.addresses_storage;
+		if(!samples_storage.buffer) {
+			samples_storage   = storage_create(memory_profiler_max_samples * sizeof(_AllocationSample));
+			addresses_storage = storage_create(memory_profiler_address_capacity * sizeof(_SampledAddress));
+			bool committed = storage_commit(&samples_storage, samples_storage.size) && storage_commit(&addresses_storage, addresses_storage.size);
+			assert(committed, "could not commit the pages of the memory profiler");
+		}
+
+		const u32 used_samples = g_memory_profiler.sample_count.load(std::memory_order_relaxed);
+		std::memset(samples_storage.buffer, 0, (used_samples < memory_profiler_max_samples ? used_samples : memory_profiler_max_samples) * sizeof(_AllocationSample));
+		std::memset(addresses_storage.buffer, 0, addresses_storage.size);
+		g_memory_profiler.sample_count.store(0, std::memory_order_relaxed);
+		g_memory_profiler.live_samples.store(0, std::memory_order_relaxed);
+		g_memory_profiler.sample_interval.store(sample_interval_bytes, std::memory_order_release);
+	}
+
+	void memory_profiler_stop()
+	{
+		g_memory_profiler.sample_interval.store(0, std::memory_order_relaxed);
+	}
+
+	//Function name when the binary exports it, module and offset otherwise, which addr2line can resolve
+	static std::string profiler_frame_name(void* frame)
+	{
+		std::string name;
+#ifdef LINUX_OS
+		char** symbols = backtrace_symbols(&frame, 1);
+		if(symbols) {
+			const char* symbol = symbols[0];
+			const char* open  = std::strchr(symbol, '(');
+			const char* plus  = open ? std::strchr(open, '+') : nullptr;
+			if(open && plus && plus != open + 1) {
+				std::string mangled(open + 1, plus);
+				s32 status = -1;
+				char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+				name = status == 0 ? demangled : mangled;
+				std::free(demangled);
+			} else {
+				const char* close = open ? std::strchr(open, ')') : nullptr;
+				const char* module = std::strrchr(symbol, '/');
+				module = module && module < open ? module + 1 : symbol;
+				name = open && close ? std::string(module, open) + std::string(open + 1, close) : symbol;
+			}
+			std::free(symbols);
+		}
+#endif
+
+		if(name.empty()) {
+			char address[32];
+			std::snprintf(address, sizeof(address), "0x%llx", static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(frame)));
+			name = address;
+		}
+
+		//The frames are separated by ';' and the bytes by the last space
+		for(char& c : name) {
+			if(c == ';') c = ':';
+		}
+		return name;
+	}
+
+	//The frames are captured from the callee to the root, the collapsed stacks go from the root to the callee
+	static void append_collapsed_stack(std::string* stack, void* const* frames, u32 frame_count, std::unordered_map<void*, std::string>* frame_names)
+	{
+		if(!frame_count) {
+			*stack += "[unknown]";
+			return;
+		}
+
+		for(u32 frame = frame_count; frame > 0; frame--) {
+			void* address = frames[frame - 1];
+			auto name = frame_names->find(address);
+			if(name == frame_names->end())
+				name = frame_names->emplace(address, profiler_frame_name(address)).first;
+
+			*stack += name->second;
+			if(frame > 1) *stack += ';';
+		}
+	}
+
+	std::string memory_profiler_export_collapsed(bool live_only)
+	{
+		auto samples = static_cast<const _AllocationSample*>(g_memory_profiler.samples_storage.buffer);
+		u32 sample_count = g_memory_profiler.sample_count.load(std::memory_order_relaxed);
+		if(sample_count > memory_profiler_max_samples) sample_count = memory_profiler_max_samples;
+
+		std::unordered_map<void*, std::string> frame_names;
+		std::map<std::string, u64> stacks;
+		std::string stack;
+		for(u32 i = 0; i < sample_count; i++) {
+			const u32 state = samples[i].state.load(std::memory_order_acquire);
+			if(state == ALLOCATION_SAMPLE_WRITING || (live_only && state != ALLOCATION_SAMPLE_LIVE))
+				continue;
+
+			stack.clear();
+			append_collapsed_stack(&stack, samples[i].frames, samples[i].frame_count, &frame_names);
+			stacks[stack] += samples[i].weight;
+		}
+
+		std::string collapsed;
+		for(const auto& [frames, bytes] : stacks) {
+			collapsed += frames;
+			collapsed += ' ';
+			collapsed += std::to_string(bytes);
+			collapsed += '\n';
+		}
+		return collapsed;
+	}
+
+	struct _FrameAuditedEvent
+	{
+		void* frames[memory_profiler_max_frames];
+		u64   bytes;
+		u32   count;
+		u32   frame_count;
+		FrameAuditEvent event;
+	};
+
+	struct _FrameAudit
+	{
+		std::atomic<bool> running;
+		u32 budget[FRAME_AUDIT_EVENT_COUNT];
+		FrameAuditReport report;
+		u32 attributed_count;
+		_FrameAuditedEvent attributed_events[frame_audit_max_attributed_events];
+		FrameAuditCallback callback;
+	};
+
+	static _FrameAudit g_frame_audit = {};
+	//Only the thread which began the audit is counted, so that the loading threads can keep allocating
+	static thread_local bool t_frame_audit_active = false;
+
+	const char* frame_audit_event_name(FrameAuditEvent event)
+	{
+		switch(event) {
+		case FRAME_AUDIT_OPERATOR_NEW: return "operator new";
+		case FRAME_AUDIT_MEM_ALLOCATE: return "mem_allocate";
+		case FRAME_AUDIT_GL_BUFFER:    return "GL buffer";
+		default:                       return "unknown";
 		}
 	}
 
-	Allocator allocator_create(u32 permanent_storage_bytes, u32 temporary_storage_bytes)
+	MEMORY_NOINLINE static void frame_audit_record(FrameAuditEvent event, u32 count, u64 bytes)
+	{
+		g_frame_audit.report.counts[event] += count;
+		g_frame_audit.report.bytes[event] += bytes;
+		if(g_frame_audit.attributed_count == frame_audit_max_attributed_events)
+			return;
+
+		_FrameAuditedEvent& attributed_event = g_frame_audit.attributed_events[g_frame_audit.attributed_count++];
+		attributed_event.event       = event;
+		attributed_event.bytes       = bytes;
+		attributed_event.count       = count;
+		attributed_event.frame_count = capture_call_stack(attributed_event.frames, memory_profiler_max_frames, 1);
+	}
+
+	//A thread local load and a branch outside of the audited frames
+	static void frame_audit_on_event(FrameAuditEvent event, u64 bytes)
+	{
+		if(t_frame_audit_active)
+			frame_audit_record(event, 1, bytes);
+	}
+
+	void frame_audit_record_gl_buffers(u32 count)
+	{
+		if(t_frame_audit_active)
+			frame_audit_record(FRAME_AUDIT_GL_BUFFER, count, 0);
+	}
+
+	void frame_audit_set_callback(FrameAuditCallback callback)
+	{
+		g_frame_audit.callback = callback;
+	}
+
+	void frame_audit_begin(u32 operator_new_budget, u32 mem_allocate_budget, u32 gl_buffer_budget)
 	{
-		Allocator allocator = {};
-		allocator.permanent_storage.buffer = ::operator new(permanent_storage_bytes);
-		allocator.temporary_storage.buffer = ::operator new(temporary_storage_bytes);
+		const bool was_running = g_frame_audit.running.exchange(true, std::memory_order_acquire);
+		assert(!was_running, "only one thread at a time can audit its frames");
+
+		g_frame_audit.budget[FRAME_AUDIT_OPERATOR_NEW] = operator_new_budget;
+		g_frame_audit.budget[FRAME_AUDIT_MEM_ALLOCATE] = mem_allocate_budget;
+		g_frame_audit.budget[FRAME_AUDIT_GL_BUFFER]    = gl_buffer_budget;
+		g_frame_audit.report = {};
+		g_frame_audit.attributed_count = 0;
+		t_frame_audit_active = true;
+	}
 
-		std::memset(allocator.permanent_storage.buffer, 0, permanent_storage_bytes);
-		std::memset(allocator.temporary_storage.buffer, 0, temporary_storage_bytes);
+	FrameAuditReport frame_audit_end()
+	{
+		assert(t_frame_audit_active, "frame_audit_end needs to be called by the thread which began the audit");
+		t_frame_audit_active = false;
+
+		FrameAuditReport report = g_frame_audit.report;
+		for(u32 i = 0; i < FRAME_AUDIT_EVENT_COUNT; i++)
+			report.over_budget |= report.counts[i] > g_frame_audit.budget[i];
+
+		if(report.over_budget) {
+			//Every line is an event of the frame followed by its call stack, from the root to the callee
+			std::unordered_map<void*, std::string> frame_names;
+			std::string attribution;
+			for(u32 i = 0; i < g_frame_audit.attributed_count; i++) {
+				const _FrameAuditedEvent& attributed_event = g_frame_audit.attributed_events[i];
+				attribution += frame_audit_event_name(attributed_event.event);
+				if(attributed_event.event == FRAME_AUDIT_GL_BUFFER)
+					attribution += " x" + std::to_string(attributed_event.count) + ": ";
+				else
+					attribution += " " + std::to_string(attributed_event.bytes) + " bytes: ";
+				append_collapsed_stack(&attribution, attributed_event.frames, attributed_event.frame_count, &frame_names);
+				attribution += '\n';
+			}
 
-		allocator.permanent_storage.size = permanent_storage_bytes;
-		allocator.temporary_storage.size = temporary_storage_bytes;
+			if(g_frame_audit.callback) {
+				g_frame_audit.callback(report, attribution);
+			} else {
+				log_message("(frame_audit_end) operator new: {}/{}, mem_allocate: {}/{}, GL buffers: {}/{}\n{}",
+					report.counts[FRAME_AUDIT_OPERATOR_NEW], g_frame_audit.budget[FRAME_AUDIT_OPERATOR_NEW],
+					report.counts[FRAME_AUDIT_MEM_ALLOCATE], g_frame_audit.budget[FRAME_AUDIT_MEM_ALLOCATE],
+					report.counts[FRAME_AUDIT_GL_BUFFER], g_frame_audit.budget[FRAME_AUDIT_GL_BUFFER], attribution);
+				assert(false, "the frame went over its allocation budget");
+			}
+		}
 
-		return allocator;
+		g_frame_audit.running.store(false, std::memory_order_release);
+		return report;
 	}
 
-	void allocator_cleanup(Allocator* allocator)
+	//Without g_engine_allocator everything comes from the global heap. The size and the alignment of each block
+	//are stored right before it, so that mem_free and mem_reallocate work for aligned blocks as well
+	struct _HeapBlockHeader
 	{
-		if(!allocator) return;
+		u32 size;
+		u32 alignment;
+	};
 
-		::operator delete(allocator->permanent_storage.buffer);
-		::operator delete(allocator->temporary_storage.buffer);
+	static void* heap_allocate(u32 bytes, u32 alignment)
+	{
+		if(alignment < sizeof(_HeapBlockHeader))
+			alignment = sizeof(_HeapBlockHeader);
+
+		u8* block = static_cast<u8*>(::operator new(alignment + bytes, std::align_val_t{alignment}));
+		auto header = reinterpret_cast<_HeapBlockHeader*>(block + alignment) - 1;
+		header->size      = bytes;
+		header->alignment = alignment;
+		return block + alignment;
 	}
 
-	void* mem_allocate(u32 bytes)
+	static _HeapBlockHeader* heap_get_header(void* ptr)
 	{
-		//INFO @C7 for some reason ::operator new called with 0 bytes does not return nullptr...
-		if(bytes == 0)
-			return nullptr;
+		return reinterpret_cast<_HeapBlockHeader*>(ptr) - 1;
+	}
 
-		if(!g_engine_allocator) {
-			return ::operator new(bytes);
-		}
+	static void heap_free(void* ptr)
+	{
+		if(!ptr) return;
 
-		std::scoped_lock lock(g_engine_allocator_mutex);
+		const u32 alignment = heap_get_header(ptr)->alignment;
+		::operator delete(static_cast<u8*>(ptr) - alignment, std::align_val_t{alignment});
+	}
 
-		//the allocation methodology now consist of pushing the allocation start and size at the
-		//end of the tree. The tree having a red-black implementation will balance itself
-		auto& segment_tree = g_engine_allocator->segment_tree;
-		auto last_allocation_node = segment_tree.find_last_node();
-		u8* storage_u8 = reinterpret_cast<u8*>(g_engine_allocator->permanent_storage.buffer);
+	static bool is_valid_alignment(u32 alignment)
+	{
+		return alignment != 0 && (alignment & (alignment - 1)) == 0 && alignment <= max_allocation_alignment;
+	}
 
-		u32 new_allocation_start = 0;
-		if(last_allocation_node) {
-			if(last_allocation_node->segment.start > g_engine_allocator->permanent_storage.used * 2 || g_engine_allocator->dense_allocations_left != 0) {
-				u32& dense_allocations_left = g_engine_allocator->dense_allocations_left;
-				if(dense_allocations_left == 0) {
-					dense_allocations_left = 10;
-				} else {
-					dense_allocations_left--;
-				}
+	void* mem_allocate(u32 bytes)
+	{
+		return mem_allocate_aligned(bytes, 1);
+	}
 
-				for(auto node = segment_tree.find_first_node();;) {
-					auto next_node = find_next_node(node);
-					if(!next_node) break;
+	void* mem_allocate_aligned(u32 bytes, u32 alignment)
+	{
+		frame_audit_on_event(FRAME_AUDIT_MEM_ALLOCATE, bytes);
+		assert(is_valid_alignment(alignment), "the alignment needs to be a power of two not bigger than max_allocation_alignment\n");
 
-					u32 node_start      = node->segment.start;
-					u32 node_size       = node->segment.size;
-					u32 next_node_start = next_node->segment.start;
+		//INFO @C7 for some reason ::operator new called with 0 bytes does not return nullptr...
+		if(bytes == 0)
+			return nullptr;
 
-					if(next_node_start - (node_start + node_size) >= bytes) {
-						u32 new_allocation_start = node_start + node_size;
-						segment_tree.add_node(new_allocation_start, bytes);
-						g_engine_allocator->permanent_storage.used += bytes;
-						return storage_u8 + new_allocation_start;
-					}
+		if(!g_engine_allocator) {
+			void* ptr = heap_allocate(bytes, alignment);
+			profiler_on_allocate(ptr, bytes, true);
+			return ptr;
+		}
 
-					node = next_node;
-				}
-				//If we get here no allocation with the right amount of space was found between the holes,
-				//just mem_allocate at the end
+		//The thread cache blocks are aligned to their own size inside of the spans
+		const MemoryTag tag = t_memory_tag;
+		const u32 block_bytes = bytes > alignment ? bytes : alignment;
+		if(block_bytes <= thread_cache_max_block_size && g_engine_allocator->thread_caches_enabled) {
+			if(void* ptr = thread_cache_allocate(g_engine_allocator, block_bytes, tag)) {
+				profiler_on_allocate(ptr, bytes, true);
+				return ptr;
 			}
-
-			new_allocation_start = last_allocation_node->segment.start + last_allocation_node->segment.size;
 		}
 
-		segment_tree.add_node(new_allocation_start, bytes);
-		g_engine_allocator->permanent_storage.used += bytes;
+		//The storage buffer is page aligned, so aligning the offset is enough
+		auto lock = allocator_lock(g_engine_allocator);
+		drain_remote_frees(g_engine_allocator);
+		void* ptr = permanent_storage_allocate(g_engine_allocator, bytes, alignment, tag);
+		assert(ptr, "there is not enough space in the permanent storage or the hard budget of the tag was reached\n");
+		g_engine_allocator->size_histogram[size_histogram_bucket(bytes)]++;
+		lock.unlock();
 
-		return storage_u8 + new_allocation_start;
+		thread_blocks_add(g_engine_allocator, ptr);
+		profiler_on_allocate(ptr, bytes, true);
+		return ptr;
 	}
 
-	void* mem_allocate_zeroed(u32 bytes)
+	void* mem_allocate_zeroed(u32 bytes, u32 alignment)
 	{
-		void* ptr = mem_allocate(bytes);
+		void* ptr = mem_allocate_aligned(bytes, alignment);
 		std::memset(ptr, 0, bytes);
 		return ptr;
 	}
 
 	void mem_free(void* ptr)
 	{
+		profiler_on_free(ptr);
 		if(!g_engine_allocator) {
-			::operator delete(ptr);
+			heap_free(ptr);
 			return;
 		}
 
-		std::scoped_lock lock(g_engine_allocator_mutex);
+		if(!ptr) return;
 
-		u32 node_start = (u8*)ptr - (u8*)g_engine_allocator->permanent_storage.buffer;
-		auto& segment_tree = g_engine_allocator->segment_tree;
-		auto node = segment_tree.find_node(node_start);
+		u64 node_start = (u8*)ptr - (u8*)g_engine_allocator->permanent_storage.buffer;
+		assert(node_start < g_engine_allocator->permanent_storage.size, "the pointer does not belong to the permanent storage");
 
-		if(!node) {
-			log_message("user tried to free a nullptr node");
+		//The spans are never given back to the tree, so reading the class does not require the lock
+		u8 span_entry = g_engine_allocator->span_classes[node_start / thread_cache_span_size];
+		if(span_entry) {
+			thread_cache_free(g_engine_allocator, ptr, span_entry);
 			return;
 		}
 
-		g_engine_allocator->permanent_storage.used -= node->segment.size;
-		segment_tree.remove_node(node_start);
+		if(!thread_blocks_remove(g_engine_allocator, ptr)) {
+			push_remote_free(g_engine_allocator, ptr);
+			return;
+		}
+
+		auto lock = allocator_lock(g_engine_allocator);
+		permanent_storage_free(g_engine_allocator, node_start);
+	}
+
+	//Biggest alignment a block placed at ptr already has, the moved blocks keep it
+	static u32 get_pointer_alignment(const void* ptr)
+	{
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(ptr);
+		const std::uintptr_t alignment = address & (~address + 1);
+		return alignment < max_allocation_alignment ? static_cast<u32>(alignment) : max_allocation_alignment;
+	}
+
+	static void* move_allocation(void* ptr, u32 old_bytes, u32 new_bytes)
+	{
+		void* new_ptr = mem_allocate_aligned(new_bytes, get_pointer_alignment(ptr));
+		std::memcpy(new_ptr, ptr, old_bytes < new_bytes ? old_bytes : new_bytes);
+		mem_free(ptr);
+		return new_ptr;
+	}
+
+	void* mem_reallocate(void* ptr, u32 new_bytes)
+	{
+		if(!ptr)
+			return mem_allocate(new_bytes);
+
+		if(new_bytes == 0) {
+			mem_free(ptr);
+			return nullptr;
+		}
+
+		if(!g_engine_allocator)
+			return move_allocation(ptr, heap_get_header(ptr)->size, new_bytes);
+
+		u64 node_start = (u8*)ptr - (u8*)g_engine_allocator->permanent_storage.buffer;
+		assert(node_start < g_engine_allocator->permanent_storage.size, "the pointer does not belong to the permanent storage");
+
+		//A thread cache block can be used as it is up to its class size, the moved block keeps the tag of the span
+		u8 span_entry = g_engine_allocator->span_classes[node_start / thread_cache_span_size];
+		if(span_entry) {
+			const u32 block_size = thread_cache_min_block_size << span_entry_class(span_entry);
+			if(new_bytes <= block_size)
+				return ptr;
+
+			MemoryTagScope tag_scope(span_entry_tag(span_entry));
+			return move_allocation(ptr, block_size, new_bytes);
+		}
+
+		void* new_ptr = nullptr;
+		{
+			auto lock = allocator_lock(g_engine_allocator);
+			auto& segment_index = g_engine_allocator->segment_index;
+			auto& permanent_storage = g_engine_allocator->permanent_storage;
+			SegmentRecord* node = segment_index.find_node(node_start);
+			assert(node, "the pointer was not allocated in the permanent storage");
+
+			//The segment can grow up to the start of the next one, or to the end of the storage
+			const u64 old_bytes = node->segment.size;
+			const MemoryTag tag = static_cast<MemoryTag>(node->tag);
+			const SegmentRecord* next_node = segment_index.find_next_node(node);
+			const u64 limit = next_node ? next_node->segment.start : permanent_storage.size;
+			if(new_bytes < permanent_storage_min_block_size)
+				new_bytes = permanent_storage_min_block_size;
+
+			//The budget is checked once for the grown bytes, whichever path serves them. On failure the block
+			//is left untouched, the same as realloc
+			if(new_bytes > old_bytes && !tag_stats_fit_hard_budget(g_engine_allocator, tag, new_bytes - old_bytes))
+				return nullptr;
+
+			if(node_start + new_bytes <= limit && storage_commit(&permanent_storage, node_start + new_bytes)) {
+				permanent_storage.used = permanent_storage.used - old_bytes + new_bytes;
+				tag_stats_update(g_engine_allocator, tag, old_bytes, new_bytes);
+				segment_index.resize_node(node, new_bytes);
+				return ptr;
+			}
+
+			//The moved block keeps the tag and the alignment of the original one
+			drain_remote_frees(g_engine_allocator);
+			new_ptr = permanent_storage_allocate(g_engine_allocator, new_bytes, get_pointer_alignment(ptr), tag, false);
+			if(!new_ptr)
+				return nullptr;
+
+			g_engine_allocator->size_histogram[size_histogram_bucket(new_bytes)]++;
+			std::memcpy(new_ptr, ptr, old_bytes);
+			permanent_storage_free(g_engine_allocator, node_start);
+		}
+
+		//The moved block belongs to the thread which reallocated it
+		thread_blocks_remove(g_engine_allocator, ptr);
+		thread_blocks_add(g_engine_allocator, new_ptr);
+
+		frame_audit_on_event(FRAME_AUDIT_MEM_ALLOCATE, new_bytes);
+		profiler_on_free(ptr);
+		profiler_on_allocate(new_ptr, new_bytes, true);
+		return new_ptr;
 	}
 
 	void* temporary_allocate(u32 bytes)
 	{
+		return temporary_allocate_aligned(bytes, 1);
+	}
+
+	void* temporary_allocate_aligned(u32 bytes, u32 alignment)
+	{
+		assert(is_valid_alignment(alignment), "the alignment needs to be a power of two not bigger than max_allocation_alignment\n");
+
 		if(bytes == 0)
 			return nullptr;
 
-		if(!g_engine_allocator)
-			return ::operator new(bytes);
+		if(!g_engine_allocator) {
+			void* ptr = heap_allocate(bytes, alignment);
+			profiler_on_allocate(ptr, bytes, false);
+			return ptr;
+		}
 
-		//Add 4 to the total amount of bytes used in the system to make space for the object size.
-		//That makes it easier to understand by how much the counter needs to be decremented
+		//The allocation size is written right before the returned address. That makes it easier to understand
+		//by how much the counter needs to be decremented. The padding required by the alignment goes in front
+		//of the size, and is counted in it so that temporary_free gives it back as well
 		const u32 size_of_padding_at_beginning = sizeof(u32);
-		bytes  += size_of_padding_at_beginning;
 
-		auto& temporary_storage = g_engine_allocator->temporary_storage;
+		auto& temporary_storage = *get_scratch_storage(g_engine_allocator);
 		u8* storage_u8 = static_cast<u8*>(temporary_storage.buffer);
-		assert(temporary_storage.used + bytes < temporary_storage.size, "there is now enough space in the temporary allocator for the requested space\n");
-		u8* return_address = storage_u8 + temporary_storage.used;
-		temporary_storage.used += bytes;
+		const u64 allocation_start = temporary_storage.used;
+		const u64 return_offset    = align_up(allocation_start + size_of_padding_at_beginning, alignment);
+		const u64 allocation_end   = return_offset + bytes;
 
-		//Write the allocation size at the end
-		*reinterpret_cast<u32*>(return_address) = bytes;
+		assert(allocation_end < temporary_storage.size, "there is now enough space in the temporary allocator for the requested space\n");
+		bool committed = storage_commit(&temporary_storage, allocation_end);
+		assert(committed, "could not commit the pages of the temporary storage");
+		temporary_storage.used = allocation_end;
 
-		return return_address + size_of_padding_at_beginning;
+		const u32 allocation_size = static_cast<u32>(allocation_end - allocation_start);
+		std::memcpy(storage_u8 + return_offset - size_of_padding_at_beginning, &allocation_size, sizeof(u32));
+
+		profiler_on_allocate(storage_u8 + return_offset, bytes, false);
+		return storage_u8 + return_offset;
 	}
 
 	void temporary_free(void* ptr)
 	{
 		if(!g_engine_allocator) {
-			::operator delete(ptr);
+			heap_free(ptr);
 			return;
 		}
 
 		//Load the temporary allocation size
 		const u32 size_of_padding_at_beginning = sizeof(u32);
-		u32* size_ptr = reinterpret_cast<u32*>((u8*)ptr - size_of_padding_at_beginning);
-		assert(size_ptr, "There is a weird issue going on here, this should never be 0");
-		temporary_decrease_counter(*size_ptr);
+		u32 allocation_size = 0;
+		std::memcpy(&allocation_size, (u8*)ptr - size_of_padding_at_beginning, sizeof(u32));
+		assert(allocation_size, "There is a weird issue going on here, this should never be 0");
+		temporary_decrease_counter(allocation_size);
 
 		//INFO @C7 there is really nothing to mem_free if a temporary buffer is used, you can mark the memory on top
 		//of the temporary stack being no longer used by decreasing the counter with the related function
@@ -773,7 +4022,7 @@ namespace gfx
 	void temporary_free_c_str(char* c_string)
 	{
 		if(!g_engine_allocator) {
-			::operator delete(c_string);
+			heap_free(c_string);
 			return;
 		}
 
@@ -790,6 +4039,623 @@ namespace gfx
 			return;
 #endif
 
-		g_engine_allocator->temporary_storage.used -= bytes;
+		get_scratch_storage(g_engine_allocator)->used -= bytes;
+	}
+
+	TemporaryMarker temporary_get_marker()
+	{
+		if(!g_engine_allocator)
+			return {};
+
+		return { get_scratch_storage(g_engine_allocator)->used };
+	}
+
+	void temporary_restore_marker(TemporaryMarker marker)
+	{
+		if(!g_engine_allocator)
+			return;
+
+		auto scratch_storage = get_scratch_storage(g_engine_allocator);
+		assert(marker.used <= scratch_storage->used, "the marker was taken after some of the current allocations were freed");
+		scratch_storage->used = marker.used;
+	}
+
+	//Without g_engine_allocator the frame allocations come from the heap, and are kept in these lists
+	//until their arena is reset
+	static std::vector<void*> heap_frame_allocations[2];
+	static u32 heap_current_frame = 0;
+
+	void* frame_allocate(u32 bytes, u32 alignment)
+	{
+		assert(is_valid_alignment(alignment), "the alignment needs to be a power of two not bigger than max_allocation_alignment\n");
+
+		if(bytes == 0)
+			return nullptr;
+
+		if(!g_engine_allocator) {
+			void* ptr = heap_allocate(bytes, alignment);
+			heap_frame_allocations[heap_current_frame].push_back(ptr);
+			profiler_on_allocate(ptr, bytes, false);
+			return ptr;
+		}
+
+		auto& frame_storage = g_engine_allocator->frame_storages[g_engine_allocator->current_frame_storage];
+		const u64 allocation_start = align_up(frame_storage.used, alignment);
+		const u64 allocation_end   = allocation_start + bytes;
+
+		assert(allocation_end <= frame_storage.size, "there is not enough space in the frame storage for the requested space\n");
+		bool committed = storage_commit(&frame_storage, allocation_end);
+		assert(committed, "could not commit the pages of the frame storage");
+		frame_storage.used = allocation_end;
+
+		profiler_on_allocate(static_cast<u8*>(frame_storage.buffer) + allocation_start, bytes, false);
+		return static_cast<u8*>(frame_storage.buffer) + allocation_start;
+	}
+
+	void frame_storage_swap()
+	{
+		if(!g_engine_allocator) {
+			heap_current_frame = 1 - heap_current_frame;
+			for(void* ptr : heap_frame_allocations[heap_current_frame])
+				heap_free(ptr);
+
+			heap_frame_allocations[heap_current_frame].clear();
+			return;
+		}
+
+		g_engine_allocator->current_frame_storage = 1 - g_engine_allocator->current_frame_storage;
+		g_engine_allocator->frame_storages[g_engine_allocator->current_frame_storage].used = 0;
+	}
+
+	const char* memory_tag_name(MemoryTag tag)
+	{
+		switch(tag) {
+		case MEMORY_TAG_UNTAGGED: return "untagged";
+		case MEMORY_TAG_MODEL:    return "model";
+		case MEMORY_TAG_TEXTURE:  return "texture";
+		case MEMORY_TAG_STRING:   return "string";
+		default:                  return "unknown";
+		}
+	}
+
+	void allocator_set_budget(Allocator* allocator, MemoryTag tag, u64 soft_budget, u64 hard_budget)
+	{
+		assert(tag < MEMORY_TAG_COUNT, "invalid memory tag");
+		auto lock = allocator_lock(allocator);
+		allocator->tag_stats[tag].soft_budget = soft_budget;
+		allocator->tag_stats[tag].hard_budget = hard_budget;
+	}
+
+	void allocator_set_budget_callback(Allocator* allocator, MemoryBudgetCallback callback)
+	{
+		auto lock = allocator_lock(allocator);
+		allocator->budget_callback = callback;
+	}
+
+	MemoryReport allocator_get_report(Allocator* allocator)
+	{
+		MemoryReport report = {};
+		auto lock = allocator_lock(allocator);
+
+		std::memcpy(report.tags, allocator->tag_stats, sizeof(report.tags));
+		std::memcpy(report.size_histogram, allocator->size_histogram, sizeof(report.size_histogram));
+		report.permanent_storage_size      = allocator->permanent_storage.size;
+		report.permanent_storage_used      = allocator->permanent_storage.used;
+		report.permanent_storage_committed = allocator->permanent_storage.committed;
+		report.lock_acquisitions           = allocator->lock_acquisitions;
+		report.lock_contentions            = allocator->lock_contentions;
+
+		//The blocks handed out by the thread caches are counted in the bucket of their class size
+		for(ThreadCache* cache = allocator->thread_caches; cache; cache = cache->next) {
+			for(u32 i = 0; i < thread_cache_class_count; i++)
+				report.size_histogram[size_histogram_bucket(thread_cache_min_block_size << i)] += cache->class_allocations[i].load(std::memory_order_relaxed);
+		}
+
+		//Besides the holes between the segments, the space before the first one and after the last one
+		//can also be allocated
+		u64 first_start = 0, last_end = 0, max_gap = 0;
+		report.largest_free_gap = report.permanent_storage_size;
+		if(allocator->segment_index.get_extent(&first_start, &last_end, &max_gap)) {
+			const u64 space_after_last_segment = report.permanent_storage_size - last_end;
+			report.largest_free_gap = max_gap;
+			if(first_start > report.largest_free_gap)              report.largest_free_gap = first_start;
+			if(space_after_last_segment > report.largest_free_gap) report.largest_free_gap = space_after_last_segment;
+		}
+
+		const u64 free_bytes = report.permanent_storage_size - report.permanent_storage_used;
+		report.fragmentation_ratio = free_bytes ? 1.0 - (f64)report.largest_free_gap / (f64)free_bytes : 0.0;
+
+		return report;
+	}
+
+	std::string memory_report_to_json(const MemoryReport& report)
+	{
+		std::string json = "{\"tags\":{";
+		for(u32 i = 0; i < MEMORY_TAG_COUNT; i++) {
+			const auto& stats = report.tags[i];
+			json += std::format("{}\"{}\":{{\"live_bytes\":{},\"peak_bytes\":{},\"live_allocations\":{},\"soft_budget\":{},\"hard_budget\":{}}}",
+				i ? "," : "", memory_tag_name(static_cast<MemoryTag>(i)), stats.live_bytes, stats.peak_bytes,
+				stats.live_allocations, stats.soft_budget, stats.hard_budget);
+		}
+
+		json += std::format("}},\"permanent_storage\":{{\"size\":{},\"used\":{},\"committed\":{},\"largest_free_gap\":{},\"fragmentation_ratio\":{:.4f}}}",
+			report.permanent_storage_size, report.permanent_storage_used, report.permanent_storage_committed,
+			report.largest_free_gap, report.fragmentation_ratio);
+
+		json += ",\"size_histogram\":[";
+		for(u32 i = 0; i < memory_size_histogram_bucket_count; i++)
+			json += std::format("{}{}", i ? "," : "", report.size_histogram[i]);
+
+		json += std::format("],\"lock_acquisitions\":{},\"lock_contentions\":{}}}", report.lock_acquisitions, report.lock_contentions);
+		return json;
+	}
+
+	MemoryHandle mem_allocate_handle(u32 bytes)
+	{
+		assert(g_engine_allocator, "handles require g_engine_allocator to be defined\n");
+		Allocator* allocator = g_engine_allocator;
+		auto lock = allocator_lock(allocator);
+		drain_remote_frees(allocator);
+
+		//Freed entries get reused first, their generation was already bumped when they were freed
+		auto& handle_table = allocator->handle_table;
+		auto entries = static_cast<_HandleEntry*>(handle_table.buffer);
+		u32 index = 0;
+		if(allocator->handle_free_list) {
+			index = allocator->handle_free_list - 1;
+			allocator->handle_free_list = entries[index].next_free;
+		} else {
+			assert(allocator->handle_count < handle_table_max_entries, "the handle table is full\n");
+			index = allocator->handle_count++;
+			bool committed = storage_commit(&handle_table, (u64)allocator->handle_count * sizeof(_HandleEntry));
+			assert(committed, "could not commit the pages of the handle table");
+			entries[index].generation = 1;
+		}
+
+		void* ptr = permanent_storage_allocate(allocator, bytes, handle_block_alignment, t_memory_tag);
+		assert(ptr, "there is not enough space in the permanent storage or the hard budget of the tag was reached\n");
+		allocator->size_histogram[size_histogram_bucket(bytes)]++;
+
+		const u64 offset = static_cast<u8*>(ptr) - static_cast<u8*>(allocator->permanent_storage.buffer);
+		allocator->segment_index.find_node(offset)->handle = index + 1;
+		entries[index].offset    = offset;
+		entries[index].next_free = 0;
+		return { index, entries[index].generation };
+	}
+
+	//Requires g_engine_allocator_mutex to be locked
+	static _HandleEntry* get_handle_entry(Allocator* allocator, MemoryHandle handle)
+	{
+		auto entries = static_cast<_HandleEntry*>(allocator->handle_table.buffer);
+		if(handle.index >= allocator->handle_count || entries[handle.index].generation != handle.generation)
+			return nullptr;
+
+		return &entries[handle.index];
+	}
+
+	void* mem_handle_resolve(MemoryHandle handle)
+	{
+		assert(g_engine_allocator, "handles require g_engine_allocator to be defined\n");
+		auto lock = allocator_lock(g_engine_allocator);
+		_HandleEntry* entry = get_handle_entry(g_engine_allocator, handle);
+		return entry ? static_cast<u8*>(g_engine_allocator->permanent_storage.buffer) + entry->offset : nullptr;
+	}
+
+	void mem_free_handle(MemoryHandle handle)
+	{
+		assert(g_engine_allocator, "handles require g_engine_allocator to be defined\n");
+		Allocator* allocator = g_engine_allocator;
+		auto lock = allocator_lock(allocator);
+
+		_HandleEntry* entry = get_handle_entry(allocator, handle);
+		if(!entry) {
+			log_message("user tried to free a stale handle\n");
+			return;
+		}
+
+		allocator->segment_index.find_node(entry->offset)->handle = 0;
+		permanent_storage_free(allocator, entry->offset);
+
+		//Bumping the generation invalidates every copy of the handle
+		entry->generation++;
+		entry->next_free = allocator->handle_free_list;
+		allocator->handle_free_list = handle.index + 1;
+	}
+
+	u32 allocator_compact(Allocator* allocator, f64 time_budget_us)
+	{
+		auto lock = allocator_lock(allocator);
+		auto begin = std::chrono::steady_clock::now();
+
+		auto& segment_index = allocator->segment_index;
+		auto entries = static_cast<_HandleEntry*>(allocator->handle_table.buffer);
+		u8* storage_u8 = static_cast<u8*>(allocator->permanent_storage.buffer);
+
+		SegmentRecord* node = segment_index.find_lower_bound_node(allocator->compaction_cursor);
+		if(!node) node = segment_index.find_lower_bound_node(0);
+		if(!node) return 0;
+
+		const SegmentRecord* previous_node = segment_index.find_prev_node(node);
+		u64 previous_end = previous_node ? previous_node->segment.start + previous_node->segment.size : 0;
+
+		//At least one block is visited on each call, so that a tiny budget still makes progress.
+		//Moving a block down between its neighbours keeps the order of the tree, so only its start changes
+		u32 moved_blocks = 0;
+		while(node) {
+			if(node->handle) {
+				const u64 new_start = align_up(previous_end, handle_block_alignment);
+				if(new_start < node->segment.start) {
+					std::memmove(storage_u8 + new_start, storage_u8 + node->segment.start, node->segment.size);
+					entries[node->handle - 1].offset = new_start;
+					segment_index.move_node(node, new_start);
+					moved_blocks++;
+				}
+			}
+
+			previous_end = node->segment.start + node->segment.size;
+			node = segment_index.find_next_node(node);
+
+			if(std::chrono::duration<f64, std::micro>(std::chrono::steady_clock::now() - begin).count() >= time_budget_us)
+				break;
+		}
+
+		//Once the end of the storage is reached the next call starts over
+		allocator->compaction_cursor = node ? node->segment.start : 0;
+		return moved_blocks;
+	}
+
+	void memory_end_frame()
+	{
+		frame_storage_swap();
+
+		if(g_engine_allocator && std::atomic_ref(g_engine_allocator->remote_free_blocks).load(std::memory_order_relaxed)) {
+			auto lock = allocator_lock(g_engine_allocator);
+			drain_remote_frees(g_engine_allocator);
+		}
+
+		if(g_engine_allocator && g_engine_allocator->compaction_time_budget_us > 0.0)
+			allocator_compact(g_engine_allocator, g_engine_allocator->compaction_time_budget_us);
+	}
+
+	//Requires g_engine_allocator_mutex to be locked. Spans, thread caches and scratch arenas are only
+	//meaningful to the process which created them
+	static bool is_allocator_internal_block(Allocator* allocator, u64 start)
+	{
+		u8* block = static_cast<u8*>(allocator->permanent_storage.buffer) + start;
+		for(ThreadCache* cache = allocator->thread_caches; cache; cache = cache->next) {
+			if(block == reinterpret_cast<u8*>(cache)) return true;
+		}
+		for(ScratchArena* arena = allocator->scratch_arenas; arena; arena = arena->next) {
+			if(block == reinterpret_cast<u8*>(arena)) return true;
+		}
+
+		return false;
+	}
+
+	bool allocator_save_snapshot(Allocator* allocator, const char* path)
+	{
+		auto lock = allocator_lock(allocator);
+		drain_remote_frees(allocator);
+
+		std::vector<SegmentRecord> records;
+		std::vector<_SnapshotSpan> spans;
+		std::unordered_map<u64, u64> span_positions;
+		u64 storage_bytes = 0;
+		auto& segment_index = allocator->segment_index;
+		for(SegmentRecord* record = segment_index.find_lower_bound_node(0); record; record = segment_index.find_next_node(record)) {
+			if(is_allocator_internal_block(allocator, record->segment.start))
+				continue;
+
+			const u64 span_index = record->segment.start / thread_cache_span_size;
+			if(u8 span_entry = allocator->span_classes[span_index]) {
+				span_positions[span_index] = spans.size();
+				spans.push_back({ record->segment.start, span_entry, {} });
+			}
+
+			records.push_back(*record);
+			storage_bytes = record->segment.start + record->segment.size;
+		}
+
+		//Every block of a span which is not in a free list is live. The lists of the thread caches are read
+		//without their owners, which is why no other thread can use the allocator while the snapshot is saved
+		u8* storage_u8 = static_cast<u8*>(allocator->permanent_storage.buffer);
+		auto mark_free_blocks = [&](const _FreeBlock* block) {
+			for(; block; block = block->next) {
+				const u64 offset = reinterpret_cast<const u8*>(block) - storage_u8;
+				_SnapshotSpan& span = spans[span_positions[offset / thread_cache_span_size]];
+				const u64 block_index = (offset - span.start) / (thread_cache_min_block_size << span_entry_class(static_cast<u8>(span.span_entry)));
+				span.free_blocks[block_index / 64] |= 1ull << (block_index % 64);
+			}
+		};
+		for(u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+			for(u32 i = 0; i < thread_cache_class_count; i++) {
+				mark_free_blocks(allocator->central_free_blocks[tag][i]);
+				for(ThreadCache* cache = allocator->thread_caches; cache; cache = cache->next)
+					mark_free_blocks(cache->free_blocks[tag][i]);
+			}
+		}
+
+		//Whole pages are stored, so that the file can be mapped up to the last saved segment
+		_SnapshotHeader header = {};
+		header.magic            = snapshot_magic;
+		header.version          = snapshot_version;
+		header.segment_count    = records.size();
+		header.span_count       = spans.size();
+		header.storage_bytes    = align_up(storage_bytes, storage_page_size);
+		header.handle_count     = allocator->handle_count;
+		header.handle_free_list = allocator->handle_free_list;
+		const u64 metadata_bytes = sizeof(_SnapshotHeader) + records.size() * sizeof(SegmentRecord) + (u64)header.handle_count * sizeof(_HandleEntry) +
+			spans.size() * sizeof(_SnapshotSpan);
+		header.data_offset      = align_up(metadata_bytes, snapshot_data_alignment);
+
+		FILE* file = std::fopen(path, "wb");
+		if(!file) {
+			log_message("could not open {} to write the snapshot\n", path);
+			return false;
+		}
+		defer { std::fclose(file); };
+
+		static const u8 padding[storage_page_size] = {};
+		bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+		written = written && std::fwrite(records.data(), sizeof(SegmentRecord), records.size(), file) == records.size();
+		written = written && std::fwrite(allocator->handle_table.buffer, sizeof(_HandleEntry), header.handle_count, file) == header.handle_count;
+		written = written && std::fwrite(spans.data(), sizeof(_SnapshotSpan), spans.size(), file) == spans.size();
+		for(u64 offset = metadata_bytes; written && offset < header.data_offset; offset += storage_page_size) {
+			const u64 bytes = header.data_offset - offset < storage_page_size ? header.data_offset - offset : storage_page_size;
+			written = std::fwrite(padding, 1, bytes, file) == bytes;
+		}
+
+		//Commits are page aligned, so the rest of the last page is committed as well
+		assert(header.storage_bytes <= allocator->permanent_storage.committed, "the saved segments need to be committed");
+		written = written && std::fwrite(allocator->permanent_storage.buffer, 1, header.storage_bytes, file) == header.storage_bytes;
+
+		if(!written)
+			log_message("could not write the snapshot to {}\n", path);
+		return written;
+	}
+
+	static bool get_file_size(FILE* file, u64* size)
+	{
+#ifdef WINDOWS_OS
+		struct _stat64 file_stat;
+		if(_fstat64(_fileno(file), &file_stat) != 0)
+			return false;
+#else
+		struct stat file_stat;
+		if(fstat(fileno(file), &file_stat) != 0)
+			return false;
+#endif
+		*size = static_cast<u64>(file_stat.st_size);
+		return true;
+	}
+
+	//Every link of the free list stays in the table without cycles, and every other entry is used by the
+	//record at its offset, which points back to it
+	static bool validate_snapshot_handles(const std::vector<SegmentRecord>& records, const _HandleEntry* entries, u32 handle_count, u32 handle_free_list)
+	{
+		//0 unused, 1 free, 2 used by a record
+		std::vector<u8> entry_states(handle_count, 0);
+		for(u32 link = handle_free_list; link; link = entries[link - 1].next_free) {
+			if(link > handle_count || entry_states[link - 1])
+				return false;
+			entry_states[link - 1] = 1;
+		}
+
+		for(const SegmentRecord& record : records) {
+			if(!record.handle)
+				continue;
+
+			const u32 index = record.handle - 1;
+			if(index >= handle_count || entry_states[index] || entries[index].offset != record.segment.start)
+				return false;
+			entry_states[index] = 2;
+		}
+
+		for(u8 state : entry_states) {
+			if(!state) return false;
+		}
+		return true;
+	}
+
+	bool allocator_restore_snapshot(Allocator* allocator, const char* path)
+	{
+		auto lock = allocator_lock(allocator);
+		auto& permanent_storage = allocator->permanent_storage;
+		assert(!permanent_storage.used && !allocator->thread_caches && !allocator->scratch_arenas && !allocator->handle_count,
+			"snapshots can only be restored in an allocator which was just created\n");
+
+		FILE* file = std::fopen(path, "rb");
+		if(!file) {
+			log_message("could not open the snapshot {}\n", path);
+			return false;
+		}
+		defer { std::fclose(file); };
+
+		_SnapshotHeader header = {};
+		if(std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != snapshot_magic || header.version != snapshot_version) {
+			log_message("{} is not a snapshot of this version\n", path);
+			return false;
+		}
+
+		if(header.storage_bytes > permanent_storage.size || header.handle_count > handle_table_max_entries) {
+			log_message("the snapshot {} does not fit in the allocator\n", path);
+			return false;
+		}
+
+		//Every segment takes at least permanent_storage_min_block_size bytes of the storage, so a bigger count
+		//comes from a corrupted header. Once it is bounded the metadata size can't overflow
+		u64 file_size = 0;
+		const u64 metadata_bytes = sizeof(header) + header.segment_count * sizeof(SegmentRecord) + (u64)header.handle_count * sizeof(_HandleEntry) +
+			header.span_count * sizeof(_SnapshotSpan);
+		if(header.segment_count > header.storage_bytes / permanent_storage_min_block_size || header.span_count > header.storage_bytes / thread_cache_span_size ||
+			header.data_offset < metadata_bytes ||
+			!get_file_size(file, &file_size) || header.data_offset > file_size || file_size - header.data_offset < header.storage_bytes) {
+			log_message("the snapshot {} is truncated or corrupted\n", path);
+			return false;
+		}
+
+		std::vector<SegmentRecord> records(header.segment_count);
+		bool read = std::fread(records.data(), sizeof(SegmentRecord), records.size(), file) == records.size();
+		read = read && storage_commit(&allocator->handle_table, (u64)header.handle_count * sizeof(_HandleEntry));
+		read = read && std::fread(allocator->handle_table.buffer, sizeof(_HandleEntry), header.handle_count, file) == header.handle_count;
+		std::vector<_SnapshotSpan> spans(header.span_count);
+		read = read && std::fread(spans.data(), sizeof(_SnapshotSpan), spans.size(), file) == spans.size();
+		if(!read) {
+			log_message("the snapshot {} is truncated\n", path);
+			return false;
+		}
+
+		//The records are rebuilt into the index as they are, so they have to be sorted and inside of the storage
+		u64 records_end = 0;
+		for(const SegmentRecord& record : records) {
+			if(record.segment.start < records_end || record.segment.start > header.storage_bytes || record.segment.size > header.storage_bytes - record.segment.start ||
+				record.tag >= MEMORY_TAG_COUNT) {
+				log_message("the snapshot {} has invalid segments\n", path);
+				return false;
+			}
+			records_end = record.segment.start + record.segment.size;
+		}
+
+		//A span has to be one of the restored segments, and a handle has to be used by exactly one of them
+		auto find_record = [&records](u64 start) -> const SegmentRecord* {
+			auto it = std::lower_bound(records.begin(), records.end(), start, [](const SegmentRecord& record, u64 start) { return record.segment.start < start; });
+			return it != records.end() && it->segment.start == start ? &*it : nullptr;
+		};
+		for(const _SnapshotSpan& span : spans) {
+			const SegmentRecord* record = find_record(span.start);
+			const u8 span_entry = static_cast<u8>(span.span_entry);
+			if(!record || record->segment.size != thread_cache_span_size || span.start % thread_cache_span_size || span.span_entry != span_entry ||
+				!span_entry || span_entry_class(span_entry) >= thread_cache_class_count || span_entry_tag(span_entry) != record->tag) {
+				log_message("the snapshot {} has invalid thread cache spans\n", path);
+				return false;
+			}
+		}
+
+		if(!validate_snapshot_handles(records, static_cast<const _HandleEntry*>(allocator->handle_table.buffer), header.handle_count, header.handle_free_list)) {
+			log_message("the snapshot {} has invalid handles\n", path);
+			return false;
+		}
+
+		//Explicit huge pages can't be replaced by a file mapping, they get a copy of the file instead
+		bool mapped = false;
+#ifdef LINUX_OS
+		if(header.storage_bytes && permanent_storage.pages != STORAGE_PAGES_EXPLICIT_HUGE) {
+			void* buffer = mmap(permanent_storage.buffer, header.storage_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), header.data_offset);
+			mapped = buffer != MAP_FAILED;
+			if(mapped) permanent_storage.committed = header.storage_bytes;
+		}
+#endif
+
+		if(!mapped && header.storage_bytes) {
+			read = storage_commit(&permanent_storage, header.storage_bytes) && std::fseek(file, static_cast<long>(header.data_offset), SEEK_SET) == 0;
+			read = read && std::fread(permanent_storage.buffer, 1, header.storage_bytes, file) == header.storage_bytes;
+			if(!read) {
+				log_message("could not read the storage of the snapshot {}\n", path);
+				return false;
+			}
+		}
+
+		//The records are sorted, the index is rebuilt with the same tags and handles
+		for(const SegmentRecord& record : records) {
+			SegmentRecord* node = allocator->segment_index.add_node(record.segment.start, record.segment.size);
+			node->tag    = record.tag;
+			node->handle = record.handle;
+
+			const MemoryTag tag = static_cast<MemoryTag>(record.tag);
+			permanent_storage.used += record.segment.size;
+			allocator->tag_stats[tag].live_allocations++;
+			tag_stats_update(allocator, tag, 0, record.segment.size);
+		}
+
+		//The free blocks of the spans go to the central lists, the threads take them from there
+		u8* storage_u8 = static_cast<u8*>(permanent_storage.buffer);
+		for(const _SnapshotSpan& span : spans) {
+			const u8 span_entry = static_cast<u8>(span.span_entry);
+			allocator->span_classes[span.start / thread_cache_span_size] = span_entry;
+
+			const u32 class_index = span_entry_class(span_entry);
+			const u32 block_size  = thread_cache_min_block_size << class_index;
+			_FreeBlock*& central_free_blocks = allocator->central_free_blocks[span_entry_tag(span_entry)][class_index];
+			for(u32 i = 0; i < thread_cache_span_size / block_size; i++) {
+				if(!(span.free_blocks[i / 64] & (1ull << (i % 64))))
+					continue;
+
+				auto block = reinterpret_cast<_FreeBlock*>(storage_u8 + span.start + (u64)i * block_size);
+				block->next = central_free_blocks;
+				central_free_blocks = block;
+			}
+		}
+
+		allocator->handle_count     = header.handle_count;
+		allocator->handle_free_list = header.handle_free_list;
+		return true;
+	}
+}
+
+//With C7_FRAME_AUDIT_OPERATOR_NEW every ::operator new of the process goes through the frame audit. It is
+//meant for the audit builds only, and can't be used when the application replaces them on its own
+#ifdef C7_FRAME_AUDIT_OPERATOR_NEW
+static void* audited_operator_new(std::size_t bytes, std::size_t alignment)
+{
+	gfx::frame_audit_on_event(gfx::FRAME_AUDIT_OPERATOR_NEW, bytes);
+	if(!bytes) bytes = 1;
+
+	for(;;) {
+#ifdef WINDOWS_OS
+		void* ptr = alignment ? _aligned_malloc(bytes, alignment) : std::malloc(bytes);
+#else
+		void* ptr = alignment ? std::aligned_alloc(alignment, (bytes + alignment - 1) & ~(alignment - 1)) : std::malloc(bytes);
+#endif
+		if(ptr) return ptr;
+
+		std::new_handler handler = std::get_new_handler();
+		if(!handler) throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void* audited_operator_new_nothrow(std::size_t bytes, std::size_t alignment) noexcept
+{
+	try {
+		return audited_operator_new(bytes, alignment);
+	} catch(...) {
+		return nullptr;
+	}
+}
+
+static void audited_operator_delete(void* ptr, bool aligned) noexcept
+{
+#ifdef WINDOWS_OS
+	if(aligned) {
+		_aligned_free(ptr);
+		return;
 	}
-}
\ No newline at end of file
+#else
+	//aligned_alloc blocks are freed like the others
+	(void)aligned;
+#endif
+	std::free(ptr);
+}
+
+void* operator new(std::size_t bytes)                                             { return audited_operator_new(bytes, 0); }
+void* operator new[](std::size_t bytes)                                           { return audited_operator_new(bytes, 0); }
+void* operator new(std::size_t bytes, std::align_val_t alignment)                 { return audited_operator_new(bytes, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t bytes, std::align_val_t alignment)               { return audited_operator_new(bytes, static_cast<std::size_t>(alignment)); }
+void* operator new(std::size_t bytes, const std::nothrow_t&) noexcept             { return audited_operator_new_nothrow(bytes, 0); }
+void* operator new[](std::size_t bytes, const std::nothrow_t&) noexcept           { return audited_operator_new_nothrow(bytes, 0); }
+void* operator new(std::size_t bytes, std::align_val_t alignment, const std::nothrow_t&) noexcept   { return audited_operator_new_nothrow(bytes, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t bytes, std::align_val_t alignment, const std::nothrow_t&) noexcept { return audited_operator_new_nothrow(bytes, static_cast<std::size_t>(alignment)); }
+
+void operator delete(void* ptr) noexcept                                          { audited_operator_delete(ptr, false); }
+void operator delete[](void* ptr) noexcept                                        { audited_operator_delete(ptr, false); }
+void operator delete(void* ptr, std::size_t) noexcept                             { audited_operator_delete(ptr, false); }
+void operator delete[](void* ptr, std::size_t) noexcept                           { audited_operator_delete(ptr, false); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept                   { audited_operator_delete(ptr, false); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept                 { audited_operator_delete(ptr, false); }
+void operator delete(void* ptr, std::align_val_t) noexcept                        { audited_operator_delete(ptr, true); }
+void operator delete[](void* ptr, std::align_val_t) noexcept                      { audited_operator_delete(ptr, true); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept           { audited_operator_delete(ptr, true); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept         { audited_operator_delete(ptr, true); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { audited_operator_delete(ptr, true); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { audited_operator_delete(ptr, true); }
+#endif
\ No newline at end of file
@@ -1,12 +1,21 @@
 #pragma once
 #include <type_traits>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
 #include "utils/types.h"
 
 namespace gfx
 {
+	//Offsets are 64 bits wide so that the storages are not capped at 4 GB
 	struct MemorySegment
 	{
-		u32 start, size;
+		u64 start, size;
 	};
 
 	enum _NodeColor : u8
@@ -14,94 +23,596 @@ namespace gfx
 		NODE_COLOR_UNDEFINED    = 0x00,
 		NODE_COLOR_BLACK        = 0x01,
 		NODE_COLOR_RED          = 0x02,
-		//Marks imperfections when performing deletions that need to be solved
-		NODE_COLOR_DOUBLE_BLACK = 0x04
 	};
 
-	struct _Node
+	//Part of an allocation shared by every segment index, segment.start is treated as the ordering id
+	struct SegmentRecord
 	{
-		//segment.start is treated as the ordering id
 		MemorySegment segment;
+		//Not used by the indices themselves, they follow the segment when it gets moved around
+		u8 tag;
+		u32 handle;
+	};
+
+	struct _Node : SegmentRecord
+	{
+		//Augmented data describing the whole subtree rooted in this node: the range it spans and the
+		//largest hole found between two consecutive segments inside of it. Kept updated on every
+		//insertion, deletion and rotation
+		u64 subtree_start, subtree_end;
+		u64 subtree_max_gap;
 		_NodeColor color;
 
 		_Node* parent;
 		_Node *left, *right;
 	};
 
+	//The storages reserve their whole size as virtual memory on creation, pages are then committed in
+	//storage_commit_granularity steps as the used space grows, so they stay untouched (and zeroed)
+	//until they are actually needed
+	static constexpr u64 storage_commit_granularity = 1024 * 1024;
+	//Storages backed by huge pages are reserved and committed in steps of this size instead
+	static constexpr u64 storage_huge_page_size = 2 * 1024 * 1024;
+	//Regular page size of every supported platform
+	static constexpr u64 storage_page_size      = 4096;
+
+	enum StoragePages : u8
+	{
+		STORAGE_PAGES_REGULAR          = 0x00,
+		//madvise(MADV_HUGEPAGE), the kernel assembles the huge pages when it can
+		STORAGE_PAGES_TRANSPARENT_HUGE = 0x01,
+		//MAP_HUGETLB or MEM_LARGE_PAGES, taken from the pool configured in the OS when the storage is reserved
+		STORAGE_PAGES_EXPLICIT_HUGE    = 0x02,
+	};
+
+	struct MemoryStorage
+	{
+		void* buffer;
+		u64 size;
+		u64 used;
+		u64 committed;
+		u64 commit_granularity;
+		StoragePages pages;
+	};
+
+	static constexpr u32 cache_line_size = 64;
+	//Most segments a SegmentTree can hold, its nodes are carved from a reservation of this many
+	static constexpr u32 segment_tree_max_nodes = 1 << 22;
+	//Biggest alignment the allocation functions can guarantee, enough for AVX-512 loads and for the
+	//GL_MIN_MAP_BUFFER_ALIGNMENT of the mapped GPU buffers
+	static constexpr u32 max_allocation_alignment = cache_line_size;
+
 	class SegmentTree
 	{
 	public:
 		SegmentTree() {}
+		SegmentTree(const SegmentTree&) = delete;
+		SegmentTree(SegmentTree&& right) noexcept;
+		SegmentTree& operator=(SegmentTree&& right) noexcept;
 		~SegmentTree() {
-			if(root) { cleanup(); }
+			cleanup();
 		}
-		void add_node(u32 start, u32 size);
-		_Node** find_place_to_insert_node(u32 start, _Node** parent);
-		_Node* find_node(u32 start);
+		_Node* add_node(u64 start, u64 size);
+		_Node** find_place_to_insert_node(u64 start, _Node** parent);
+		_Node* find_node(u64 start);
 		const _Node* find_first_node();
 		const _Node* find_last_node();
-		void remove_node(u32 start);
+		//Finds the lowest address hole (the space before the first segment included) which can fit the
+		//requested amount of bytes in O(log(n)) by descending the subtree gap information.
+		//Returns false if no hole is big enough. With an alignment (power of two) greater than one,
+		//subtrees are only visited if their largest hole can fit the bytes wherever the padding lands
+		bool find_first_fit(u64 bytes, u64* start, u64 alignment = 1) const;
+		void remove_node(u64 start);
+		//Changes the size of a segment without moving it, the caller checks that it does not overlap the next one
+		void resize_node(_Node* node, u64 size);
+		//Changes the start of a segment, the caller checks that it stays between the previous and the next one
+		void move_node(_Node* node, u64 start);
+		//First node starting at or after start
+		_Node* find_lower_bound_node(u64 start);
+		//Releases every node and the reservation they are stored in
 		void cleanup();
 
 		inline const _Node* get_root() const { return root; }
 	private:
-		//INFO @C7: In addition to performing the insertion/deletion operations, the functions also can make sure
-		//with recursive calls that the tree is still valid according to the RB tree rules, the flag in the
-		//tree_delete_check function explicitly says if the recursive calls perform a deletion or just
-		//rearranges the newly created tree structure
+		//INFO @C7: In addition to performing the insertion/deletion operations, the functions also make sure
+		//that the tree is still valid according to the RB tree rules. tree_delete_check takes the parent
+		//explicitly because the node which replaced the deleted one can be null
 		void tree_insert_check(_Node* node);
-		void tree_delete_check(_Node* node, bool perform_deletion);
+		void tree_delete_check(_Node* node, _Node* parent);
+		void rotate_left(_Node* node);
+		void rotate_right(_Node* node);
+		_Node* allocate_node();
+		void   free_node(_Node* node);
 
 		_Node* root = nullptr;
+
+		//The nodes are carved in order from a storage reserved by the tree itself, the same way as the handle
+		//table of the allocator, so the bookkeeping stays contiguous and never reaches the global heap. The
+		//reservation is made by the first node
+		MemoryStorage node_storage = {};
+		u32           nodes_used   = 0;
+		//Freed nodes are linked through their parent pointer and get reused before carving new ones
+		_Node* free_nodes = nullptr;
 	};
 
-	struct MemoryStorage
+	//Wide nodes keep the keys of a B+-tree contiguous, a lookup reads a few cache lines per level
+	//instead of one node per comparison
+	static constexpr u32 segment_btree_fanout    = 32;
+	static constexpr u32 segment_btree_max_depth = 16;
+	//Unused key slots are padded with the biggest signed value, so the search can compare the whole
+	//array with signed 64 bit SIMD instructions. Segment starts never get that high
+	static constexpr u64 segment_btree_key_padding = 0x7FFFFFFFFFFFFFFFull;
+
+	struct alignas(cache_line_size) _BTreeNode
 	{
-		void* buffer;
-		u32 size;
-		u32 used;
+		//Starts of the segments in a leaf, lowest start of every child subtree in an inner node
+		u64 keys[segment_btree_fanout];
+		//Same augmented data of the red-black tree nodes
+		u64 subtree_start, subtree_end;
+		u64 subtree_max_gap;
+		u32 count;
+		bool is_leaf;
+		union
+		{
+			_BTreeNode*   children[segment_btree_fanout];
+			SegmentRecord records[segment_btree_fanout];
+		};
+	};
+
+	//B+-tree alternative to SegmentTree with the same operations. The records live inside the leaves,
+	//so the pointers returned by the functions are only valid until the next insertion or deletion
+	class SegmentBTree
+	{
+	public:
+		SegmentBTree() {}
+		SegmentBTree(const SegmentBTree&) = delete;
+		SegmentBTree(SegmentBTree&& right) noexcept;
+		SegmentBTree& operator=(SegmentBTree&& right) noexcept;
+		~SegmentBTree() {
+			cleanup();
+		}
+		SegmentRecord* add_node(u64 start, u64 size);
+		SegmentRecord* find_node(u64 start);
+		const SegmentRecord* find_first_node();
+		const SegmentRecord* find_last_node();
+		//First record starting at or after start
+		SegmentRecord* find_lower_bound_node(u64 start);
+		//Last record starting before start
+		SegmentRecord* find_prev_node(u64 start);
+		//Same holes SegmentTree::find_first_fit would pick
+		bool find_first_fit(u64 bytes, u64* start, u64 alignment = 1) const;
+		void remove_node(u64 start);
+		void resize_node(u64 start, u64 size);
+		void move_node(u64 start, u64 new_start);
+		void cleanup();
+
+		inline const _BTreeNode* get_root() const { return root; }
+	private:
+		//Fills the nodes visited from the root to the leaf which holds start (or where it would be
+		//inserted) and the child/key index taken in each of them, returns the depth of the leaf plus one
+		u32 find_path(u64 start, _BTreeNode** path, u32* indices) const;
+		void update_path(_BTreeNode** path, u32 depth);
+		_BTreeNode* split_node(_BTreeNode* node);
+		_BTreeNode* allocate_node(bool is_leaf);
+		void        free_node(_BTreeNode* node);
+
+		_BTreeNode* root = nullptr;
+		//Freed nodes are linked through their first child and get reused before reaching the global heap
+		_BTreeNode* free_nodes = nullptr;
+	};
+
+	enum SegmentIndexType : u8
+	{
+		SEGMENT_INDEX_RED_BLACK_TREE = 0x00,
+		SEGMENT_INDEX_BTREE          = 0x01,
+	};
+
+	//Forwards every operation to the index selected at allocator_create
+	struct SegmentIndex
+	{
+		SegmentIndexType type;
+		SegmentTree      tree;
+		SegmentBTree     btree;
+
+		SegmentRecord* add_node(u64 start, u64 size);
+		SegmentRecord* find_node(u64 start);
+		const SegmentRecord* find_last_node();
+		SegmentRecord* find_lower_bound_node(u64 start);
+		SegmentRecord* find_next_node(const SegmentRecord* record);
+		SegmentRecord* find_prev_node(const SegmentRecord* record);
+		bool find_first_fit(u64 bytes, u64* start, u64 alignment = 1) const;
+		void remove_node(u64 start);
+		void resize_node(SegmentRecord* record, u64 size);
+		void move_node(SegmentRecord* record, u64 start);
+		//Range covered by the segments and the largest hole between them, false if there are no segments
+		bool get_extent(u64* first_start, u64* last_end, u64* max_gap) const;
+		void cleanup();
+	};
+
+	//Small allocations are served by per thread caches without taking g_engine_allocator_mutex,
+	//every size class is a power of two
+	static constexpr u32 thread_cache_class_count      = 8;
+	static constexpr u32 thread_cache_min_block_size   = 16;
+	static constexpr u32 thread_cache_max_block_size   = thread_cache_min_block_size << (thread_cache_class_count - 1);
+	//The blocks of a class are carved from spans of the permanent storage, aligned to their size so
+	//that the class of a block can be found from its offset
+	static constexpr u32 thread_cache_span_size        = 64 * 1024;
+	//Amount of blocks moved between a thread cache and the allocator every time the lock is taken
+	static constexpr u32 thread_cache_batch_size       = 32;
+	static constexpr u32 thread_cache_max_class_blocks = thread_cache_batch_size * 2;
+
+	struct _FreeBlock
+	{
+		_FreeBlock* next;
+	};
+
+	//The blocks of the permanent storage are never smaller than a link, so that any of them can be queued
+	//by a remote free
+	static constexpr u32 permanent_storage_min_block_size = sizeof(_FreeBlock);
+
+	//Which subsystem owns a permanent allocation. The tag is stored in the segment tree node, small blocks
+	//come from thread cache spans carved for their tag so the whole span is accounted to it
+	enum MemoryTag : u8
+	{
+		MEMORY_TAG_UNTAGGED = 0,
+		MEMORY_TAG_MODEL,
+		MEMORY_TAG_TEXTURE,
+		MEMORY_TAG_STRING,
+		MEMORY_TAG_COUNT,
+	};
+
+	struct ThreadCache
+	{
+		//A block only goes back to the lists of the tag of its span
+		_FreeBlock* free_blocks[MEMORY_TAG_COUNT][thread_cache_class_count];
+		u32         free_block_count[MEMORY_TAG_COUNT][thread_cache_class_count];
+
+		//Only written by the owner, read when building a MemoryReport
+		std::atomic<u64> class_allocations[thread_cache_class_count];
+
+		std::thread::id owner_thread;
+		ThreadCache*    next;
+	};
+
+	struct MemoryTagStats
+	{
+		u64 live_bytes;
+		u64 peak_bytes;
+		u64 live_allocations;
+		//0 means no budget. Crossing the soft budget only calls the budget callback, an allocation
+		//which would cross the hard budget fails after calling it
+		u64 soft_budget;
+		u64 hard_budget;
+	};
+
+	//Called while g_engine_allocator_mutex is locked, so it must not use the permanent storage
+	typedef void(*MemoryBudgetCallback)(MemoryTag tag, u64 live_bytes, u64 budget, bool hard_budget);
+
+	//Bucket i counts the allocations of (2^(i-1), 2^i] bytes
+	static constexpr u32 memory_size_histogram_bucket_count = 33;
+
+	static constexpr u32 handle_table_max_entries = 1 << 20;
+	static constexpr u32 handle_block_alignment   = 16;
+
+	struct _HandleEntry
+	{
+		u64 offset;
+		u32 generation;
+		u32 next_free;
+	};
+
+	//Generational index to a block which can be moved by the compactor. Handles of freed blocks
+	//resolve to nullptr, even after their entry gets reused
+	struct MemoryHandle
+	{
+		u32 index;
+		u32 generation;
+	};
+
+	//32 bit builds can't afford to reserve as much address space
+	static constexpr u32 scratch_arena_max_count = sizeof(void*) == 8 ? 64 : 8;
+
+	//Temporary storage of a single thread, carved from the shared reservation the first time the thread
+	//asks for temporary memory. Only its owner touches it afterwards, so no lock is needed
+	struct ScratchArena
+	{
+		MemoryStorage   storage;
+		std::thread::id owner_thread;
+		ScratchArena*   next;
 	};
 
 	struct Allocator
 	{
+		//Reservation the scratch arenas are carved from, used counts the bytes already handed to the threads
 		MemoryStorage temporary_storage;
+		u64 scratch_arena_size;
+		//Arenas registered by the threads, their descriptors are stored in the permanent storage
+		ScratchArena* scratch_arenas;
 		MemoryStorage permanent_storage;
-		//Maps allocations in the permanent_storage
-		SegmentTree segment_tree;
-		//This basically marks the number of allocation done in O(n*log(n)) time complexity
-		//to cover holes generated from deallocations. If the value is zero the allocation
-		//takes O(log(n))
-		u32 dense_allocations_left = 0;
+		//Two arenas used one frame each, swapping them only resets the one used two frames ago,
+		//so what is built in a frame can still be read in the next one
+		MemoryStorage frame_storages[2];
+		u32 current_frame_storage;
+		//Maps allocations in the permanent_storage, holes left by deallocations are found
+		//through the gap information stored in the tree, so allocating takes O(log(n))
+		SegmentIndex segment_index;
+
+		//Assigned on creation, lets each thread find out whether its cache belongs to this allocator
+		u32 id;
+		bool thread_caches_enabled;
+		//Caches registered by the threads, they are stored in the permanent storage
+		ThreadCache* thread_caches;
+		//Blocks shared between the thread caches, refilled by carving new spans when empty
+		_FreeBlock* central_free_blocks[MEMORY_TAG_COUNT][thread_cache_class_count];
+		//For each span of the permanent storage stores the size class it serves plus one in the low bits
+		//and its tag in the high ones, 0 means the span is used by regular allocations
+		u8* span_classes;
+
+		//Both updated while holding g_engine_allocator_mutex, a contention is counted when the lock
+		//was not free on the first try
+		u64 lock_acquisitions;
+		u64 lock_contentions;
+
+		//Telemetry of the permanent storage, updated while holding g_engine_allocator_mutex. A thread cache
+		//span is accounted as a single allocation of its tag, the blocks handed out from it only in the size
+		//histogram
+		MemoryTagStats tag_stats[MEMORY_TAG_COUNT];
+		u64 size_histogram[memory_size_histogram_bucket_count];
+		MemoryBudgetCallback budget_callback;
+
+		//Blocks allocated through handles can be moved by allocator_compact, which resumes from the cursor
+		MemoryStorage handle_table;
+		u32 handle_count;
+		//Index plus one of the first free entry of the table, 0 when every entry is used
+		u32 handle_free_list;
+		u64 compaction_cursor;
+		//memory_end_frame compacts the storage for this long, 0 disables it
+		f64 compaction_time_budget_us;
+
+		//A thread frees the blocks of the permanent storage it allocated directly under the lock. The blocks
+		//freed by any other thread are pushed here without locking, linked through their first bytes, and the
+		//whole list is released by the next thread taking the lock to allocate or by memory_end_frame. Only
+		//accessed through std::atomic_ref so that the allocator stays movable
+		alignas(cache_line_size) _FreeBlock* remote_free_blocks;
+
+		//Started by allocator_prefault, allocator_cleanup stops it before releasing the storages
+		std::thread prefault_thread;
+		bool        prefault_cancelled;
+	};
+
+	struct MemoryReport
+	{
+		MemoryTagStats tags[MEMORY_TAG_COUNT];
+		u64 permanent_storage_size;
+		u64 permanent_storage_used;
+		u64 permanent_storage_committed;
+		//Largest range of the permanent storage an allocation could still take
+		u64 largest_free_gap;
+		//0 when all the free space is contiguous, approaches 1 as it gets split in small holes
+		f64 fragmentation_ratio;
+		u64 size_histogram[memory_size_histogram_bucket_count];
+		u64 lock_acquisitions;
+		u64 lock_contentions;
 	};
 
 	void assert_red_black_tree_validity(const SegmentTree& segment_tree);
+	void assert_btree_validity(const SegmentBTree& segment_btree);
 
 	namespace test
 	{
 		void memory_run_tests();
+		void memory_run_benchmarks();
 	}
 
 	//static Allocator* g_engine_allocator = nullptr;
-	Allocator allocator_create(u32 permanent_storage_bytes, u32 temporary_storage_bytes);
+	//The storages are only reserved here, so generous sizes do not cost anything until they are used.
+	//Each thread gets its own temporary_storage_bytes of temporary storage. The B+-tree index is faster
+	//to search with many live segments, the red-black tree is cheaper to update with a few of them
+	//With huge_pages the permanent, temporary and frame storages try explicit huge pages first, then
+	//transparent ones, then regular pages, the outcome is stored in MemoryStorage::pages. On Windows the
+	//large pages can't be committed on demand, so they commit and lock the whole size of every storage
+	//right away, the sizes need to be the ones actually needed
+	Allocator allocator_create(u64 permanent_storage_bytes, u64 temporary_storage_bytes, u64 frame_storage_bytes = 16 * 1024 * 1024,
+							   SegmentIndexType segment_index_type = SEGMENT_INDEX_RED_BLACK_TREE, bool huge_pages = false);
 	void      allocator_cleanup(Allocator* allocator);
+	//Gives the blocks cached by the calling thread back to g_engine_allocator. Worker threads should call
+	//this before exiting, otherwise the blocks stay unused in their cache until the allocator is destroyed
+	void      allocator_flush_thread_cache();
+	//Commits the first bytes of the permanent storage and faults their pages in on a background thread, so
+	//that the first allocations do not pay for the page faults inside the frame loop. The allocator must
+	//not be moved while the prefault is running. Windows large pages are resident from the creation of
+	//the storage, no thread is started for them
+	void      allocator_prefault(Allocator* allocator, u64 permanent_storage_bytes);
+	void      allocator_set_budget(Allocator* allocator, MemoryTag tag, u64 soft_budget, u64 hard_budget);
+	void      allocator_set_budget_callback(Allocator* allocator, MemoryBudgetCallback callback);
+
+	MemoryReport allocator_get_report(Allocator* allocator);
+	std::string  memory_report_to_json(const MemoryReport& report);
+	const char*  memory_tag_name(MemoryTag tag);
+
+	//Sampling profiler of mem_allocate, temporary_allocate and frame_allocate, it works with or without
+	//g_engine_allocator. Each thread takes a sample every sample_interval_bytes it allocates and stores its
+	//call stack, a sample stands for max(bytes, sample_interval_bytes) of allocations. Starting it again
+	//clears the previous samples, once memory_profiler_max_samples are taken the new ones get dropped
+	static constexpr u32 memory_profiler_max_samples = 64 * 1024;
+	static constexpr u32 memory_profiler_max_frames  = 32;
+
+	void        memory_profiler_start(u64 sample_interval_bytes);
+	void        memory_profiler_stop();
+	//One "root;caller;callee bytes" line per call stack, the format of flamegraph.pl and speedscope. With
+	//live_only only the mem_allocate samples which were not freed yet are counted, temporary and frame
+	//allocations are only part of the cumulative stacks
+	std::string memory_profiler_export_collapsed(bool live_only);
+
+	//Counts what the calling thread allocates between frame_audit_begin and frame_audit_end, the steady
+	//state frame is expected to use only temporary_allocate and frame_allocate. Crossing a budget calls
+	//the audit callback, without one the events are logged with their call stacks and the audit asserts
+	enum FrameAuditEvent : u8
+	{
+		//Only counted when the engine is built with C7_FRAME_AUDIT_OPERATOR_NEW
+		FRAME_AUDIT_OPERATOR_NEW = 0x00,
+		FRAME_AUDIT_MEM_ALLOCATE = 0x01,
+		//Counted by frame_audit_record_gl_buffers, which follows every glGenBuffers of the engine
+		FRAME_AUDIT_GL_BUFFER    = 0x02,
+		FRAME_AUDIT_EVENT_COUNT
+	};
+
+	struct FrameAuditReport
+	{
+		u32  counts[FRAME_AUDIT_EVENT_COUNT];
+		//Always 0 for FRAME_AUDIT_GL_BUFFER, where the count is the amount of buffers
+		u64  bytes[FRAME_AUDIT_EVENT_COUNT];
+		bool over_budget;
+	};
+
+	//The attribution has a line for each one of the first frame_audit_max_attributed_events events
+	typedef void(*FrameAuditCallback)(const FrameAuditReport& report, const std::string& attribution);
+	static constexpr u32 frame_audit_max_attributed_events = 64;
+
+	void             frame_audit_begin(u32 operator_new_budget = 0, u32 mem_allocate_budget = 0, u32 gl_buffer_budget = 0);
+	FrameAuditReport frame_audit_end();
+	void             frame_audit_set_callback(FrameAuditCallback callback);
+	void             frame_audit_record_gl_buffers(u32 count);
+	const char*      frame_audit_event_name(FrameAuditEvent event);
+
+	//The permanent allocations made by the calling thread get the tag until the scope ends
+	struct MemoryTagScope
+	{
+		MemoryTagScope(MemoryTag tag);
+		~MemoryTagScope();
+		MemoryTagScope(const MemoryTagScope&) = delete;
+		MemoryTagScope& operator=(const MemoryTagScope&) = delete;
+
+		MemoryTag previous_tag;
+	};
 
 	//This functions will either use the g_engine_allocator functionalities or mem_allocate memory from the standard heap
 	//allocate_temporary and free_temporary behave the same way to mem_allocate and mem_free if g_engine_allocator is not defined
 	void* mem_allocate(u32 bytes);
-	void* mem_allocate_zeroed(u32 bytes);
+	//The alignment needs to be a power of two not bigger than max_allocation_alignment
+	void* mem_allocate_aligned(u32 bytes, u32 alignment);
+	void* mem_allocate_zeroed(u32 bytes, u32 alignment = 1);
+	//Grows or shrinks the block in place when the bytes after it are free, otherwise the content is moved
+	//to a new block with the same alignment and the old one is freed. Returns nullptr and keeps the block
+	//when growing it would cross the hard budget of its tag
+	void* mem_reallocate(void* ptr, u32 new_bytes);
 	void  mem_free(void* ptr);
 	void* temporary_allocate(u32 bytes);
+	void* temporary_allocate_aligned(u32 bytes, u32 alignment);
 	void  temporary_free(void* ptr);
 	//Frees a c_string allocated in the temporary storage
 	void  temporary_free_c_str(char* c_string);
 	void  temporary_decrease_counter(u32 bytes);
 
+	//Everything allocated in the temporary storage after a marker is taken is released at once when the
+	//marker is restored, regardless of the order. Without g_engine_allocator restoring does nothing
+	struct TemporaryMarker
+	{
+		u64 used;
+	};
+
+	TemporaryMarker temporary_get_marker();
+	void temporary_restore_marker(TemporaryMarker marker);
+
+	//Restores the marker taken on construction when leaving the scope
+	struct TemporaryScope
+	{
+		TemporaryScope() : marker(temporary_get_marker()) {}
+		~TemporaryScope() { temporary_restore_marker(marker); }
+		TemporaryScope(const TemporaryScope&) = delete;
+		TemporaryScope& operator=(const TemporaryScope&) = delete;
+
+		TemporaryMarker marker;
+	};
+
+	//Frame allocations are never freed one by one, they stay valid for the current and the next frame.
+	//frame_storage_swap needs to be called once per frame, like the temporary storage they are meant
+	//for the main thread only
+	void* frame_allocate(u32 bytes, u32 alignment = 1);
+	void  frame_storage_swap();
+
+	//Handle blocks need g_engine_allocator. The pointer returned by mem_handle_resolve stays valid
+	//until the next compaction, so it should not be kept across frames
+	MemoryHandle mem_allocate_handle(u32 bytes);
+	void*        mem_handle_resolve(MemoryHandle handle);
+	void         mem_free_handle(MemoryHandle handle);
+	//Slides the handle blocks towards the start of the permanent storage, closing the holes in front of
+	//them, until time_budget_us runs out. Returns the amount of moved blocks
+	u32          allocator_compact(Allocator* allocator, f64 time_budget_us);
+	//Swaps the frame arenas, releases the blocks freed by other threads and runs the compactor for
+	//g_engine_allocator->compaction_time_budget_us
+	void         memory_end_frame();
+
+	//Writes the permanent storage and the layout of its segments to a file, the thread cache spans are saved
+	//with the blocks they still hand out. The caches and the bookkeeping of the allocator are left out, and
+	//no other thread can use the allocator while it runs. Pointers between the blocks need to be RelPtr
+	bool allocator_save_snapshot(Allocator* allocator, const char* path);
+	//Only works on an allocator which was just created. On Linux the file is mapped copy-on-write over the
+	//permanent storage, so the pages are only read from the file when they are touched. The segments, spans
+	//and handles of the file are validated first, a corrupted file is refused without touching the storage
+	bool allocator_restore_snapshot(Allocator* allocator, const char* path);
+
+	//Pointer stored as the distance from its own address, it stays valid when the memory holding both the
+	//pointer and the pointed object is mapped somewhere else, like a restored snapshot. A distance of 0
+	//is the null pointer, so it can't point to itself
+	template<typename T>
+	class RelPtr
+	{
+	public:
+		RelPtr() {}
+		RelPtr(T* ptr) {
+			set(ptr);
+		}
+		//The copy points to the same object from its own address
+		RelPtr(const RelPtr& right) {
+			set(right.get());
+		}
+		RelPtr& operator=(const RelPtr& right) {
+			set(right.get());
+			return *this;
+		}
+		RelPtr& operator=(T* ptr) {
+			set(ptr);
+			return *this;
+		}
+
+		inline T* get() const {
+			return offset ? reinterpret_cast<T*>(reinterpret_cast<std::intptr_t>(this) + offset) : nullptr;
+		}
+		inline void set(T* ptr) {
+			offset = ptr ? reinterpret_cast<std::intptr_t>(ptr) - reinterpret_cast<std::intptr_t>(this) : 0;
+		}
+
+		inline T* operator->() const { return get(); }
+		inline T& operator*() const { return *get(); }
+		inline T& operator[](u64 index) const { return get()[index]; }
+		inline explicit operator bool() const { return offset != 0; }
+
+	private:
+		s64 offset = 0;
+	};
+
+	//The templated forms always honour alignof(T)
 	template<typename T>
 	T* mem_allocate(u32 count = 1)
 	{
 		//TODO @C7 should also check for triviality in the future
 		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
-		return reinterpret_cast<T*>(mem_allocate(count * sizeof(T)));
+		return reinterpret_cast<T*>(mem_allocate_aligned(count * sizeof(T), alignof(T)));
+	}
+
+	template<typename T>
+	T* mem_allocate_aligned(u32 count, u32 alignment)
+	{
+		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
+		return reinterpret_cast<T*>(mem_allocate_aligned(count * sizeof(T), alignment > alignof(T) ? alignment : alignof(T)));
+	}
+
+	template<typename T>
+	T* mem_reallocate(T* ptr, u32 new_count)
+	{
+		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
+		return reinterpret_cast<T*>(mem_reallocate(static_cast<void*>(ptr), new_count * sizeof(T)));
 	}
 
 	template<typename T>
@@ -109,7 +620,7 @@ namespace gfx
 	{
 		//TODO @C7 should also check for triviality in the future
 		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
-		return reinterpret_cast<T*>(mem_allocate_zeroed(count * sizeof(T)));
+		return reinterpret_cast<T*>(mem_allocate_zeroed(count * sizeof(T), alignof(T)));
 	}
 
 	//only for structs that have members with constructors (needs to have default constructor)
@@ -119,7 +630,7 @@ namespace gfx
 		//A type can also be standard layout while requiring explicit constructor code to be executed
 		//so std::is_standard_layout is wrong here
 		static_assert(std::is_default_constructible_v<T>, "T in an invalid type");
-		void* ptr = mem_allocate(count * sizeof(T));
+		void* ptr = mem_allocate_aligned(count * sizeof(T), alignof(T));
 		new (ptr) T;
 		return reinterpret_cast<T*>(ptr);
 	}
@@ -136,7 +647,135 @@ namespace gfx
 	T* temporary_allocate(u32 count)
 	{
 		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
-		return reinterpret_cast<T*>(temporary_allocate(count * sizeof(T)));
+		return reinterpret_cast<T*>(temporary_allocate_aligned(count * sizeof(T), alignof(T)));
+	}
+
+	template<typename T>
+	T* frame_allocate(u32 count)
+	{
+		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
+		return reinterpret_cast<T*>(frame_allocate(count * sizeof(T), alignof(T)));
+	}
+
+	template<typename T>
+	T* temporary_allocate_aligned(u32 count, u32 alignment)
+	{
+		static_assert(std::is_standard_layout_v<T>, "T in an invalid type");
+		return reinterpret_cast<T*>(temporary_allocate_aligned(count * sizeof(T), alignment > alignof(T) ? alignment : alignof(T)));
 	}
 
-}
\ No newline at end of file
+	//Fixed size objects stored in slabs taken from the engine allocator. Acquiring and releasing are O(1),
+	//free slots are linked through their own storage and the live ones are tracked by a bitmask per slab
+	//so that they can be iterated. Not thread safe
+	template<typename T, u32 slots_per_slab = 64>
+	class Pool
+	{
+		static_assert(slots_per_slab > 0 && slots_per_slab <= 64, "the live slots of a slab are tracked in a single u64");
+		static_assert(alignof(T) <= max_allocation_alignment, "T needs a bigger alignment than the allocator can guarantee");
+
+		struct _Slab;
+		struct _Slot
+		{
+			_Slab* slab;
+			union
+			{
+				_Slot* next_free;
+				alignas(T) u8 object[sizeof(T)];
+			};
+		};
+
+		struct _Slab
+		{
+			_Slot  slots[slots_per_slab];
+			u64    live_mask;
+			_Slab* next;
+		};
+
+	public:
+		Pool() {}
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+		~Pool() {
+			cleanup();
+		}
+
+		template<typename... Args>
+		T* acquire(Args&&... args)
+		{
+			if(!free_slots)
+				add_slab();
+
+			_Slot* slot = free_slots;
+			free_slots  = slot->next_free;
+			slot->slab->live_mask |= u64(1) << (slot - slot->slab->slots);
+			live_count++;
+			return new (slot->object) T(std::forward<Args>(args)...);
+		}
+
+		void release(T* object)
+		{
+			if(!object) return;
+
+			_Slot* slot = reinterpret_cast<_Slot*>(reinterpret_cast<u8*>(object) - offsetof(_Slot, object));
+			object->~T();
+			slot->slab->live_mask &= ~(u64(1) << (slot - slot->slab->slots));
+			slot->next_free = free_slots;
+			free_slots      = slot;
+			live_count--;
+		}
+
+		//Calls function on every live object, releasing the object being visited is allowed
+		template<typename Function>
+		void for_each(Function&& function)
+		{
+			for(_Slab* slab = slabs; slab; slab = slab->next) {
+				for(u64 mask = slab->live_mask; mask; mask &= mask - 1) {
+					_Slot& slot = slab->slots[std::countr_zero(mask)];
+					function(*std::launder(reinterpret_cast<T*>(slot.object)));
+				}
+			}
+		}
+
+		u32 size() const
+		{
+			return live_count;
+		}
+
+		//Destroys the live objects and gives the slabs back to the allocator
+		void cleanup()
+		{
+			for_each([](T& object) { object.~T(); });
+
+			while(slabs) {
+				_Slab* next = slabs->next;
+				mem_free(slabs);
+				slabs = next;
+			}
+
+			free_slots = nullptr;
+			live_count = 0;
+		}
+
+	private:
+		void add_slab()
+		{
+			_Slab* slab = mem_allocate<_Slab>(1);
+			slab->live_mask = 0;
+			slab->next      = slabs;
+			slabs           = slab;
+
+			//Linked backwards so that the slots are handed out in address order
+			for(u32 i = slots_per_slab; i > 0; i--) {
+				_Slot& slot    = slab->slots[i - 1];
+				slot.slab      = slab;
+				slot.next_free = free_slots;
+				free_slots     = &slot;
+			}
+		}
+
+	private:
+		_Slab* slabs      = nullptr;
+		_Slot* free_slots = nullptr;
+		u32    live_count = 0;
+	};
+}
@@ -68,6 +68,7 @@ namespace gfx
         defer { glBindVertexArray(0); };
 
 		glGenBuffers(1, &freetype_instance.batched_glyphs_buffer.vertex_buffer);
+		frame_audit_record_gl_buffers(1);
 
 		glGenTextures(1, &freetype_instance.glyph_texture_handle);
 		glBindTexture(GL_TEXTURE_2D, freetype_instance.glyph_texture_handle);
@@ -170,9 +171,9 @@ namespace gfx
 		const u32 texture_width  = freetype_instance.texture_width;
 		const u32 texture_height = freetype_instance.texture_height;
 
-		//Create a temporary buffer to store all the batched data and then send everything to opengl in a single glBufferSubData api call
-		f32* batched_data_buffer = temporary_allocate<f32>(6 * 4 * string_length);
-		defer { temporary_free(batched_data_buffer); };
+		//Create a frame buffer to store all the batched data and then send everything to opengl in a single glBufferSubData api call,
+		//the frame arena gets reset on its own so no free is needed
+		f32* batched_data_buffer = frame_allocate<f32>(6 * 4 * string_length);
 
 		u32 buffer_offset = 0;
 		for(u32 i = 0; i < string_length; i++) {
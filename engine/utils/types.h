@@ -12,13 +12,19 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
-static_assert(sizeof(unsigned long) == 4);
 static_assert(sizeof(unsigned long long) == 8);
 
 //Mainly added for Windows API support instead of using their types like LONG DWORD etc
+#ifdef __linux__
+//long is 64 bits wide on LP64 systems
+typedef int32_t            l32;
+typedef uint32_t           ul32;
+#else
+static_assert(sizeof(unsigned long) == 4);
 typedef long               l32;
-typedef long long          l64;
 typedef unsigned long      ul32;
+#endif
+typedef long long          l64;
 typedef unsigned long long ul64;
 
 static_assert(sizeof(float) == 4, "f32 is not 32-bit on this system");